@@ -0,0 +1,155 @@
+// Copyright (c) 2024 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#ifdef SMOOTH_ENABLE_COUNTERS
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#endif
+
+namespace smooth {
+
+// Hot-path event counters, compiled in with SMOOTH_ENABLE_COUNTERS (the
+// CMake option of the same name). Without it the SMOOTH_COUNT macros expand
+// to nothing and their arguments are not evaluated.
+enum counter_id {
+    k_counter_lookups,          // hashmap find, find_with_hash and contains
+    k_counter_hits,
+    k_counter_misses,
+    k_counter_nodes_visited,    // chain entries walked by fixed_hashmap lookups, not inserts or erases
+    k_counter_keys_compared,    // entries whose tag matched, so the key was read
+    k_counter_migration_steps,  // hashmap::move_progressively() calls that moved elements
+    k_counter_elements_stolen,  // elements taken by fixed_hashmap::steal_elements()
+    k_counter_treefies,
+    k_counter_un_treefies,
+    k_num_counters
+};
+
+inline const char *counter_name(counter_id id) {
+    static const char *const names[k_num_counters] = {
+            "lookups", "hits", "misses", "nodes_visited", "keys_compared",
+            "migration_steps", "elements_stolen", "treefies", "un_treefies"};
+    return names[id];
+}
+
+// Totals over all threads, including threads that have exited.
+struct counter_snapshot {
+    uint64_t values[k_num_counters] = {};
+
+    uint64_t operator[](counter_id id) const { return values[id]; }
+
+    // Events between earlier and this snapshot.
+    counter_snapshot since(const counter_snapshot &earlier) const {
+        counter_snapshot delta;
+        for (size_t i = 0; i < k_num_counters; i++) {
+            delta.values[i] = values[i] - earlier.values[i];
+        }
+        return delta;
+    }
+};
+
+#ifdef SMOOTH_ENABLE_COUNTERS
+
+// One thread's counters. Only the owning thread writes them, with a plain
+// load and store rather than a locked add; the atomics only make reads
+// from counters_snapshot() well defined.
+struct counter_cells {
+    std::atomic<uint64_t> values[k_num_counters];
+
+    counter_cells() {
+        for (size_t i = 0; i < k_num_counters; i++) {
+            values[i].store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+class counter_registry {
+public:
+    // Never destroyed, so threads exiting during static destruction can
+    // still retire their cells.
+    static counter_registry &instance() {
+        static counter_registry *registry = new counter_registry();
+        return *registry;
+    }
+
+    void add(counter_cells *cells) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        live_.push_back(cells);
+    }
+
+    void retire(counter_cells *cells) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < k_num_counters; i++) {
+            retired_.values[i] += cells->values[i].load(std::memory_order_relaxed);
+        }
+        live_.erase(std::remove(live_.begin(), live_.end(), cells), live_.end());
+    }
+
+    counter_snapshot snapshot() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        counter_snapshot total = retired_;
+        for (counter_cells *cells : live_) {
+            for (size_t i = 0; i < k_num_counters; i++) {
+                total.values[i] += cells->values[i].load(std::memory_order_relaxed);
+            }
+        }
+        return total;
+    }
+
+private:
+    counter_registry() = default;
+
+    std::mutex mutex_;
+    std::vector<counter_cells *> live_;
+    counter_snapshot retired_;
+};
+
+struct thread_counters {
+    counter_cells cells;
+
+    thread_counters() { counter_registry::instance().add(&cells); }
+    ~thread_counters() { counter_registry::instance().retire(&cells); }
+};
+
+inline counter_cells &local_counters() {
+    static thread_local thread_counters counters;
+    return counters.cells;
+}
+
+inline void count_event(counter_id id, uint64_t n) {
+    std::atomic<uint64_t> &cell = local_counters().values[id];
+    cell.store(cell.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline counter_snapshot counters_snapshot() {
+    return counter_registry::instance().snapshot();
+}
+
+#define SMOOTH_COUNT(id) ::smooth::count_event(::smooth::id, 1)
+#define SMOOTH_COUNT_N(id, n) ::smooth::count_event(::smooth::id, (n))
+#define SMOOTH_COUNT_LOOKUP(found)                                                                    \
+    do {                                                                                              \
+        ::smooth::count_event(::smooth::k_counter_lookups, 1);                                        \
+        ::smooth::count_event((found) ? ::smooth::k_counter_hits : ::smooth::k_counter_misses, 1);   \
+    } while (0)
+
+#else
+
+inline counter_snapshot counters_snapshot() {
+    return counter_snapshot();
+}
+
+#define SMOOTH_COUNT(id) ((void)0)
+#define SMOOTH_COUNT_N(id, n) ((void)0)
+#define SMOOTH_COUNT_LOOKUP(found) ((void)0)
+
+#endif  // SMOOTH_ENABLE_COUNTERS
+
+}  // namespace smooth
@@ -7,9 +7,17 @@
 #include <iostream>
 #include <vector>
 #include <list>
+#include <memory>
 #include  <utility>
+#include "counters.h"
+#include "hash.h"
+#include "lookup_filter.h"
+#include "map_events.h"
+#include "memory_usage.h"
 #include "mmap_array.h"
-#include "mmap_array.h"
+#include "occupancy_bitmap.h"
+#include "probes.h"
+#include "table_stats.h"
 #include "tree_list.h"
 
 namespace smooth {
@@ -24,8 +32,9 @@ public:
     using pointer = value_type *;
     using reference = value_type &;
 
-    fixed_map_iterator_base(TableType *table, IteratorType bucket_it, size_t index, bool end)
-            : table_(table), bucket_it_(bucket_it), index_(index), end_(end) {}
+    fixed_map_iterator_base(TableType *table, const occupancy_bitmap *occupied, IteratorType bucket_it,
+                            size_t index, bool end)
+            : bucket_it_(bucket_it), table_(table), occupied_(occupied), index_(index), end_(end) {}
 
     // Prefix increment
     fixed_map_iterator_base &operator++() {
@@ -69,15 +78,10 @@ protected:
             return;
         }
 
-        bool found = false;
-        while (++index_ < table().size()) {
-            if (!table()[index_].empty()) {
-                bucket_it_ = table()[index_].begin();
-                found = true;
-                break;
-            }
-        }
-        if (!found) {
+        index_ = occupied_->find_next(index_ + 1);
+        if (index_ < table().size()) {
+            bucket_it_ = table()[index_].begin();
+        } else {
             end_ = true;
         }
     }
@@ -88,12 +92,13 @@ protected:
 
     IteratorType bucket_it_;
     TableType *table_;
+    const occupancy_bitmap *occupied_;
     size_t index_ = 0;
     bool end_;
 };
 
 
-template<typename Key, typename Mapped, typename Hash = std::hash<Key>>
+template<typename Key, typename Mapped, typename Hash = keyed_hash<Key>>
 class fixed_hashmap {
 public:
     using value_type = std::pair<Key, Mapped>;
@@ -114,68 +119,63 @@ public:
             : public fixed_map_iterator_base<typename bucket_type::iterator, value_type, mmap_array<bucket_type>, bucket_type> {
         using Base = fixed_map_iterator_base<typename bucket_type::iterator, value_type, mmap_array<bucket_type>, bucket_type>;
     public:
-        iterator(mmap_array<bucket_type> *table, typename bucket_type::iterator bucket_it, size_t index, bool end) :
+        iterator(mmap_array<bucket_type> *table, const occupancy_bitmap *occupied,
+                 typename bucket_type::iterator bucket_it, size_t index, bool end) :
                 fixed_map_iterator_base<typename bucket_type::iterator, value_type, mmap_array<bucket_type>, bucket_type>(
-                        table, bucket_it, index, end) {}
+                        table, occupied, bucket_it, index, end) {}
 
-        friend class fixed_hashmap<Key, Mapped>;
+        friend class fixed_hashmap<Key, Mapped, Hash>;
     };
 
     class const_iterator
             : public fixed_map_iterator_base<typename bucket_type::const_iterator, const value_type, const mmap_array<bucket_type>, bucket_type> {
     public:
-        explicit const_iterator(const mmap_array<bucket_type> *table,
+        explicit const_iterator(const mmap_array<bucket_type> *table, const occupancy_bitmap *occupied,
                                 typename bucket_type::const_iterator bucket_it, size_t index, bool end) :
                 fixed_map_iterator_base<typename bucket_type::const_iterator, const value_type, const mmap_array<bucket_type>, bucket_type>(
-                        table, bucket_it, index, end) {}
+                        table, occupied, bucket_it, index, end) {}
 
         explicit const_iterator(const iterator &it) :
                 fixed_map_iterator_base<typename bucket_type::const_iterator, const value_type, const mmap_array<bucket_type>, bucket_type>(
-                        it.table_, it.bucket_it_, it.index_, it.end_) {}
+                        it.table_, it.occupied_, it.bucket_it_, it.index_, it.end_) {}
 
         friend class fixed_hashmap<Key, Mapped, Hash>;
     };
 
     iterator begin() noexcept {
-        for (size_t i = 0; i < table_.size(); ++i) {
-            auto &bucket = table_[i];
-            if (!bucket.empty()) {
-                return iterator(&table_, bucket.begin(), i, false);
-            }
+        size_t i = occupied_.find_next(0);
+        if (i < table_.size()) {
+            return iterator(&table_, &occupied_, table_[i].begin(), i, false);
         }
-        return iterator(&table_, typename bucket_type::iterator(nullptr), 0, true);
+        return iterator(&table_, &occupied_, typename bucket_type::iterator(nullptr), 0, true);
     }
 
     iterator end() noexcept {
-        return iterator(&table_, typename bucket_type::iterator(nullptr), 0, true);
+        return iterator(&table_, &occupied_, typename bucket_type::iterator(nullptr), 0, true);
     }
 
     const_iterator begin() const noexcept {
-        for (size_t i = 0; i < table_.size(); ++i) {
-            auto &bucket = table_[i];
-            if (!bucket.empty()) {
-                return const_iterator(&table_, bucket.begin(), i, false);
-            }
+        size_t i = occupied_.find_next(0);
+        if (i < table_.size()) {
+            return const_iterator(&table_, &occupied_, table_[i].begin(), i, false);
         }
-        return const_iterator(&table_, typename bucket_type::const_iterator(nullptr), 0, true);
+        return const_iterator(&table_, &occupied_, typename bucket_type::const_iterator(nullptr), 0, true);
     }
 
     const_iterator end() const noexcept {
-        return const_iterator(&table_, typename bucket_type::const_iterator(nullptr), 0, true);
+        return const_iterator(&table_, &occupied_, typename bucket_type::const_iterator(nullptr), 0, true);
     }
 
     const_iterator cbegin() const {
-        for (size_t i = 0; i < table_.size(); ++i) {
-            auto &bucket = table_[i];
-            if (!bucket.empty()) {
-                return const_iterator(&table_, bucket.cbegin(), i, false);
-            }
+        size_t i = occupied_.find_next(0);
+        if (i < table_.size()) {
+            return const_iterator(&table_, &occupied_, table_[i].cbegin(), i, false);
         }
-        return const_iterator(&table_, typename bucket_type::const_iterator(nullptr), 0, true);
+        return const_iterator(&table_, &occupied_, typename bucket_type::const_iterator(nullptr), 0, true);
     }
 
     const_iterator cend() const {
-        return const_iterator(&table_, typename bucket_type::const_iterator(nullptr), 0, true);
+        return const_iterator(&table_, &occupied_, typename bucket_type::const_iterator(nullptr), 0, true);
     }
 
     bool empty() const { return size_ == 0; }
@@ -184,36 +184,66 @@ public:
     // add swap support
     void swap(fixed_hashmap &other) {
         table_.swap(other.table_);
+        occupied_.swap(other.occupied_);
         std::swap(size_, other.size_);
         std::swap(stolen_bucket_, other.stolen_bucket_);
         std::swap(hash_function_, other.hash_function_);
+        filter_.swap(other.filter_);
+        std::swap(longest_chain_, other.longest_chain_);
+        std::swap(tree_nodes_, other.tree_nodes_);
+        std::swap(payload_bytes_, other.payload_bytes_);
+        std::swap(listener_, other.listener_);
     }
 
     // Constructor
     explicit fixed_hashmap(int initial_size = 10, const Hash &hash = Hash())
             : table_(initial_size),
+              occupied_(initial_size),
               stolen_bucket_(initial_size - 1),
               size_(0),
-              hash_function_(hash) {
+              hash_function_(hash),
+              longest_chain_(0),
+              tree_nodes_(0),
+              payload_bytes_(0),
+              listener_(nullptr) {
     }
 
     fixed_hashmap(fixed_hashmap &&other) noexcept
             : table_(std::move(other.table_)),
+              occupied_(std::move(other.occupied_)),
               stolen_bucket_(table_.size() - 1),
               size_(other.size_),
-              hash_function_(std::move(other.hash_function_)) {
+              hash_function_(std::move(other.hash_function_)),
+              filter_(std::move(other.filter_)),
+              longest_chain_(other.longest_chain_),
+              tree_nodes_(other.tree_nodes_),
+              payload_bytes_(other.payload_bytes_),
+              listener_(other.listener_) {
         other.size_ = 0;
+        other.tree_nodes_ = 0;
+        other.payload_bytes_ = 0;
         other.stolen_bucket_ = 0;
     }
 
     // Move assignment operator
     fixed_hashmap &operator=(fixed_hashmap &&other) noexcept {
         if (this != &other) {
+            // mmap_array releases its memory without destroying the buckets,
+            // so free this map's nodes before taking other's table.
+            clear();
             table_ = std::move(other.table_);
+            occupied_ = std::move(other.occupied_);
             size_ = other.size_;
             stolen_bucket_ = other.stolen_bucket_;
             hash_function_ = std::move(other.hash_function_);
+            filter_ = std::move(other.filter_);
+            longest_chain_ = other.longest_chain_;
+            tree_nodes_ = other.tree_nodes_;
+            payload_bytes_ = other.payload_bytes_;
+            listener_ = other.listener_;
             other.size_ = 0;
+            other.tree_nodes_ = 0;
+            other.payload_bytes_ = 0;
             other.stolen_bucket_ = 0;
         }
         return *this;
@@ -223,27 +253,61 @@ public:
         clear();
     }
 
+    // Erase every element. The bucket array and the lookup filter, if
+    // enabled, are kept and emptied in place, so the map can be refilled.
     void clear() {
-        for (size_t i = 0; i < table_.size(); i++) {
+        for (size_t i = occupied_.find_next(0); i < table_.size(); i = occupied_.find_next(i + 1)) {
             table_[i].clear();
+            occupied_.reset(i);
+        }
+        if (filter_) {
+            filter_->clear();
         }
-        table_.clear();
+        stolen_bucket_ = table_.size() - 1;
         size_ = 0;
+        longest_chain_ = 0;
+        tree_nodes_ = 0;
+        payload_bytes_ = 0;
+    }
+
+    // Keep a counting Bloom filter of the keys, so most lookups of absent
+    // keys stop after one cache line instead of walking a bucket (see
+    // lookup_filter.h). Costs about 5 bytes per bucket and a filter update
+    // on every insert and erase.
+    void enable_lookup_filter() {
+        if (filter_) {
+            return;
+        }
+        filter_.reset(new counting_bloom_filter(table_.size()));
+        for (size_t i = occupied_.find_next(0); i < table_.size(); i = occupied_.find_next(i + 1)) {
+            for (auto it = table_[i].begin(); it != table_[i].end(); ++it) {
+                filter_->add(hash_of(it->first));
+            }
+        }
     }
 
+    void disable_lookup_filter() { filter_.reset(); }
+
+    bool has_lookup_filter() const { return filter_ != nullptr; }
+
     // true in the bool field indicates new insertion, false indicates existing key for updating.
     template<typename... Args>
     std::pair<iterator, bool> emplace_with_key(Key &&key, Args &&... args) {
-        int index = hash(key);
+        size_t hash_value = hash_of(key);
+        size_t index = bucket_index(hash_value);
         auto &bucket = table_[index];
-        for (auto it = bucket.begin(); it != bucket.end(); ++it) {
-            if (it->first == key) {
-                return std::pair<iterator, bool>(iterator(&table_, it, index, false), false);
-            }
+        auto found = find_for_update(bucket, key, hash_value);
+        if (found != bucket.end()) {
+            return std::pair<iterator, bool>(iterator(&table_, &occupied_, found, index, false), false);
         }
-        auto it = table_[index].emplace(std::forward<Args>(args)...);
+        size_t tree_before = tree_nodes_in(bucket);
+        auto it = bucket.emplace_tagged(tag_of(hash_value), std::forward<Args>(args)...);
+        note_inserted(bucket, tree_before, *it);
+        occupied_.set(index);
+        filter_add(hash_value);
+        note_chain_length(bucket.size());
         size_++;
-        return std::pair<iterator, bool>(iterator(&table_, it, index, false), true);
+        return std::pair<iterator, bool>(iterator(&table_, &occupied_, it, index, false), true);
     }
 
     template<typename... Args>
@@ -255,85 +319,130 @@ public:
 
     template<typename P>
     std::pair<iterator, bool> insert(P &&kv) {
-        int index = hash(kv.first);
+        return insert_with_hash(std::forward<P>(kv), hash_of(kv.first));
+    }
+
+    // The *_with_hash variants take hash_of(key), computed by the caller.
+    template<typename P>
+    std::pair<iterator, bool> insert_with_hash(P &&kv, size_t hash_value) {
+        size_t index = bucket_index(hash_value);
         auto &bucket = table_[index];
-        for (auto it = bucket.begin(); it != bucket.end(); ++it) {
-            if (it->first == kv.first) {
-                return std::pair<iterator, bool>(iterator(&table_, it, index, false), false);
-            }
+        auto found = find_for_update(bucket, kv.first, hash_value);
+        if (found != bucket.end()) {
+            return std::pair<iterator, bool>(iterator(&table_, &occupied_, found, index, false), false);
         }
-        auto it = bucket.insert(std::forward<P>(kv));
+        size_t tree_before = tree_nodes_in(bucket);
+        auto it = bucket.insert_tagged(std::forward<P>(kv), tag_of(hash_value));
+        note_inserted(bucket, tree_before, *it);
+        occupied_.set(index);
+        filter_add(hash_value);
+        note_chain_length(bucket.size());
         size_++;
-        return std::pair<iterator, bool>(iterator(&table_, it, index, false), true);
+        return std::pair<iterator, bool>(iterator(&table_, &occupied_, it, index, false), true);
     }
 
     // Remove a key-value pair from the hashmap
     size_t erase(const Key &key) {
-        int index = hash(key);
+        return erase_with_hash(key, hash_of(key));
+    }
+
+    size_t erase_with_hash(const Key &key, size_t hash_value) {
+        if (filtered_out(hash_value)) {
+            return 0;
+        }
+        size_t index = bucket_index(hash_value);
         auto &bucket = table_[index];
-        for (auto it = bucket.begin(); it != bucket.end(); ++it) {
-            if (it->first == key) {
-                bucket.erase(it);
-                size_--;
-                return 1;
-            }
+        auto it = find_for_update(bucket, key, hash_value);
+        if (it == bucket.end()) {
+            return 0;
+        }
+        filter_remove(hash_value);
+        size_t tree_before = tree_nodes_in(bucket);
+        note_payload_removed(*it);
+        bucket.erase(it);
+        note_tree_nodes(bucket, tree_before);
+        if (bucket.empty()) {
+            occupied_.reset(index);
         }
-        return 0;
+        size_--;
+        return 1;
     }
 
-    // Erase an element by iterator
+    // Erase an element by iterator, returning an iterator to the next element.
     iterator erase(iterator &it) {
         if (it.end_) {
             throw std::out_of_range("Iterator is at end");
         }
 
-        auto next_it = it;
-        ++next_it;
-        auto bucket_it = it.bucket_it_;
         auto bucket_index = it.index_;
-        // Erase the element from the linked list
-        bucket_it = table_[bucket_index].erase(bucket_it);
+        auto &bucket = table_[bucket_index];
+        if (filter_) {
+            filter_->remove(hash_of(it->first));
+        }
+        // The bucket knows where its next element ends up; advancing first
+        // could leave us pointing at a tree node erase() frees.
+        size_t tree_before = tree_nodes_in(bucket);
+        note_payload_removed(*it);
+        auto bucket_it = bucket.erase(it.bucket_it_);
+        note_tree_nodes(bucket, tree_before);
         size_--;
-        return next_it;
+        if (bucket_it != bucket.end()) {
+            return iterator(&table_, &occupied_, bucket_it, bucket_index, false);
+        }
+        if (bucket.empty()) {
+            occupied_.reset(bucket_index);
+        }
+        size_t next_index = occupied_.find_next(bucket_index + 1);
+        if (next_index < table_.size()) {
+            return iterator(&table_, &occupied_, table_[next_index].begin(), next_index, false);
+        }
+        return end();
     }
 
     template<class K>
     size_t erase(K &&key) {
-        int index = hash(key);
+        size_t hash_value = hash_function_(key);
+        if (filtered_out(hash_value)) {
+            return 0;
+        }
+        size_t index = bucket_index(hash_value);
         auto &bucket = table_[index];
-        for (auto it = bucket.begin(); it != bucket.end(); ++it) {
-            if (it->first == key) {
-                bucket.erase(it);
-                size_--;
-                return 1;
-            }
+        auto it = find_for_update(bucket, key, hash_value);
+        if (it == bucket.end()) {
+            return 0;
+        }
+        filter_remove(hash_value);
+        size_t tree_before = tree_nodes_in(bucket);
+        note_payload_removed(*it);
+        bucket.erase(it);
+        note_tree_nodes(bucket, tree_before);
+        if (bucket.empty()) {
+            occupied_.reset(index);
         }
-        return 0;
+        size_--;
+        return 1;
     }
 
     // Check if the hashmap contains a key
     bool contains(const Key &key) const {
-        int index = hash(key);
-        auto &bucket = table_[index];
-        for (auto it = bucket.cbegin(); it != bucket.cend(); ++it) {
-            if (it->first == key) {
-                return true;
-            }
-
+        size_t hash_value = hash_of(key);
+        if (filtered_out(hash_value)) {
+            return false;
         }
-        return false;
+        auto &bucket = table_[bucket_index(hash_value)];
+        typename bucket_type::const_iterator it(find_in_bucket(bucket, key, hash_value));
+        return it != bucket.end();
     }
 
     template<typename P>
     bool contains(P &&key) const {
-        int index = hash(key);
-        auto &bucket = table_[index];
-        for (auto it = bucket.cbegin(); it != bucket.cend(); ++it) {
-            if (it->first == key) {
-                return true;
-            }
+        size_t hash_value = hash_function_(key);
+        if (filtered_out(hash_value)) {
+            return false;
         }
-        return false;
+        auto &bucket = table_[bucket_index(hash_value)];
+        typename bucket_type::const_iterator it(find_in_bucket(bucket, key, hash_value));
+        return it != bucket.end();
     }
 
     std::vector<std::pair<Key, Mapped>> steal_elements(int64_t num_to_steal) {
@@ -350,12 +459,23 @@ public:
                     stolen_elements.reserve(num_to_steal);
                 }
                 auto it = bucket.begin();
+                if (filter_) {
+                    filter_->remove(hash_of(it->first));
+                }
+                size_t tree_before = tree_nodes_in(bucket);
+                note_payload_removed(*it);
                 stolen_elements.emplace_back(std::move(*it));
                 bucket.erase(it);
+                note_tree_nodes(bucket, tree_before);
+                SMOOTH_COUNT(k_counter_elements_stolen);
                 num_to_steal--;
                 size_--;
             }
 
+            if (bucket.empty()) {
+                occupied_.reset(stolen_bucket_);
+            }
+
             if (stolen_bucket_ == 0) {
                 // Reached the end of the table, but bucket may be non-empty.
                 if (bucket.empty()) {
@@ -368,54 +488,63 @@ public:
                 stolen_bucket_--;
             }
         }
+        SMOOTH_PROBE3(steal__elements, stolen_elements.size(), stolen_bucket_, size_);
         return stolen_elements;
     }
 
     // Search for a key and return an iterator to the element
     iterator find(const Key &key) {
-        size_t index = hash(key);
-        auto &bucket = table_[index];
-        for (auto it = bucket.begin(); it != bucket.end(); ++it) {
-            if (it->first == key) {
-                return iterator(&table_, it, index, false);
-            }
+        return find_with_hash(key, hash_of(key));
+    }
+
+    iterator find_with_hash(const Key &key, size_t hash_value) {
+        if (filtered_out(hash_value)) {
+            return end();
         }
-        return iterator(&table_, bucket.end(), index, true);
+        size_t index = bucket_index(hash_value);
+        auto &bucket = table_[index];
+        auto it = find_in_bucket(bucket, key, hash_value);
+        return iterator(&table_, &occupied_, it, index, it == bucket.end());
     }
 
     // Search for a key and return an iterator to the element
     const_iterator find(const Key &key) const {
-        size_t index = hash(key);
-        auto &bucket = table_[index];
-        for (auto it = bucket.cbegin(); it != bucket.cend(); ++it) {
-            if (it->first == key) {
-                return const_iterator(&table_, it, index, false);
-            }
+        return find_with_hash(key, hash_of(key));
+    }
+
+    const_iterator find_with_hash(const Key &key, size_t hash_value) const {
+        if (filtered_out(hash_value)) {
+            return end();
         }
-        return const_iterator(&table_, bucket.end(), index, true);
+        size_t index = bucket_index(hash_value);
+        auto &bucket = table_[index];
+        typename bucket_type::const_iterator it(find_in_bucket(bucket, key, hash_value));
+        return const_iterator(&table_, &occupied_, it, index, it == bucket.end());
     }
 
     template<class K>
     iterator find(const K &key) {
-        size_t index = hash(key);
+        size_t hash_value = hash_function_(key);
+        size_t index = bucket_index(hash_value);
         auto &bucket = table_[index];
-        for (auto it = bucket.begin(); it != bucket.end(); ++it) {
-            if (it->first == key) {
-                return iterator(&table_, it, index, false);
-            }
-        }
-        return iterator(&table_, bucket.end(), index, true);
+        auto it = find_in_bucket(bucket, key, hash_value);
+        return iterator(&table_, &occupied_, it, index, it == bucket.end());
     }
 
     Mapped &at(const Key &key) {
-        size_t index = hash(key);
+        size_t hash_value = hash_of(key);
+        size_t index = bucket_index(hash_value);
         auto &bucket = table_[index];
-        for (auto it = bucket.begin(); it != bucket.end(); ++it) {
-            if (it->first == key) {
-                return it->second;
-            }
+        auto found = find_for_update(bucket, key, hash_value);
+        if (found != bucket.end()) {
+            return found->second;
         }
-        auto it = bucket.emplace(key, Mapped());
+        size_t tree_before = tree_nodes_in(bucket);
+        auto it = bucket.emplace_tagged(tag_of(hash_value), key, Mapped());
+        note_inserted(bucket, tree_before, *it);
+        occupied_.set(index);
+        filter_add(hash_value);
+        note_chain_length(bucket.size());
         size_++;
         return it->second;
     }
@@ -426,14 +555,16 @@ public:
     }
 
     const Mapped &at(const Key &key) const {
-        size_t index = hash(key);
-        auto &bucket = table_[index];
-        for (auto it = bucket.begin(); it != bucket.end(); ++it) {
-            if (it->first == key) {
-                return it->second;
-            }
+        size_t hash_value = hash_of(key);
+        if (filtered_out(hash_value)) {
+            throw std::out_of_range("Key not found");
+        }
+        auto &bucket = table_[bucket_index(hash_value)];
+        typename bucket_type::const_iterator it(find_in_bucket(bucket, key, hash_value));
+        if (it == bucket.end()) {
+            throw std::out_of_range("Key not found");
         }
-        throw std::out_of_range("Key not found");
+        return it->second;
     }
 
     const Mapped &operator[](const Key &key) const {
@@ -446,20 +577,242 @@ public:
     // get bucket size_
     size_t get_bucket_count() const { return table_.size(); }
 
+    const Hash &hash_function() const { return hash_function_; }
+
+    // Full hash of key, before it is reduced to a bucket index.
+    size_t hash_of(const Key &key) const { return hash_function_(key); }
+
+    // Changes whenever the table is modified in a way that may invalidate
+    // iterators, like Redis dictFingerprint().
+    uint64_t fingerprint() const {
+        uint64_t parts[] = {static_cast<uint64_t>(reinterpret_cast<uintptr_t>(table_.data())),
+                            static_cast<uint64_t>(table_.size()),
+                            static_cast<uint64_t>(size_)};
+        uint64_t hash = 0;
+        for (uint64_t part : parts) {
+            hash = (hash + part) * 0x9E3779B97F4A7C15ULL;
+            hash ^= hash >> 32;
+        }
+        return hash;
+    }
+
+    // Longest chain any insert has produced since construction or clear().
+    // Erases do not lower it.
+    size_t longest_chain() const { return longest_chain_; }
+
+    // Report buckets turning into trees and back to listener, or stop
+    // reporting if it is null. The listener is not owned.
+    void set_event_listener(map_event_listener *listener) { listener_ = listener; }
+
+    map_event_listener *event_listener() const { return listener_; }
+
+    // Bytes held by this table, by component, from counts kept up to date
+    // on every insert and erase rather than a walk of the table. The
+    // payload is heap_usage<> of each element when it was inserted; if
+    // values grow or shrink in place afterwards, recount_payload() brings
+    // it up to date.
+    memory_breakdown memory_usage() const {
+        memory_breakdown usage;
+        usage.object_bytes = sizeof(*this);
+        count_array(usage, table_.mapped(), table_.reserved_bytes());
+        count_array(usage, occupied_.mapped(), occupied_.memory_bytes());
+        usage.tree_nodes = tree_nodes_;
+        usage.list_nodes = size_ - tree_nodes_;
+        usage.list_node_bytes = usage.list_nodes * sizeof(typename bucket_type::list_node_type);
+        usage.tree_node_bytes = usage.tree_nodes * sizeof(typename bucket_type::rb_node_type);
+        usage.payload_bytes = payload_bytes_;
+        usage.filter_bytes = filter_ ? sizeof(counting_bloom_filter) + filter_->memory_bytes() : 0;
+        return usage;
+    }
+
+    // Recompute the payload by walking every element.
+    void recount_payload() {
+        payload_bytes_ = 0;
+        for (size_t i = occupied_.find_next(0); i < table_.size(); i = occupied_.find_next(i + 1)) {
+            for (auto it = table_[i].begin(); it != table_[i].end(); ++it) {
+                payload_bytes_ += heap_usage<value_type>()(*it);
+            }
+        }
+    }
+
+    // Chain statistics, from at most max_buckets buckets spread evenly over
+    // the table (see k_stats_sample_buckets); used_buckets covers them all.
+    table_stats stats(size_t max_buckets = k_stats_sample_buckets) const {
+        table_stats stats;
+        stats.bucket_count = table_.size();
+        stats.size = size_;
+        size_t stride = 1;
+        if (max_buckets > 0 && table_.size() > max_buckets) {
+            stride = ((table_.size() + max_buckets - 1) / max_buckets) | 1;
+        }
+        for (size_t i = 0; i < table_.size(); i += stride) {
+            auto &bucket = table_[i];
+            stats.add_bucket(bucket.size(), bucket.is_tree(), bucket.is_tree() ? bucket.depth() : 0);
+        }
+        stats.used_buckets = occupied_.count();
+        return stats;
+    }
+
+    // Number of elements in one bucket.
+    size_t bucket_size(size_t index) const { return table_[index].size(); }
+
+    // Iterator to the element at position in the chain of bucket index.
+    iterator bucket_iterator(size_t index, size_t position) {
+        auto it = table_[index].begin();
+        while (position-- > 0) {
+            ++it;
+        }
+        return iterator(&table_, &occupied_, it, index, false);
+    }
+
+    // steal_elements() works downwards from the last bucket; buckets above
+    // this index are already empty.
+    int64_t steal_position() const { return stolen_bucket_; }
+
+    // Index of the first non-empty bucket at or after index, or the bucket
+    // count if there is none.
+    size_t next_occupied_bucket(size_t index) const { return occupied_.find_next(index); }
+
+    // Visit every element of one bucket, in chain order.
+    template<typename Fn>
+    void for_each_in_bucket(size_t index, Fn &&fn) const {
+        auto &bucket = table_[index];
+        for (auto it = bucket.cbegin(); it != bucket.cend(); ++it) {
+            fn(*it);
+        }
+    }
+
+    template<typename Fn>
+    void for_each_in_bucket(size_t index, Fn &&fn) {
+        auto &bucket = table_[index];
+        for (auto it = bucket.begin(); it != bucket.end(); ++it) {
+            fn(*it);
+        }
+    }
+
 private:
     mmap_array<bucket_type> table_;
+    occupancy_bitmap occupied_;
     size_t size_;
     Hash hash_function_;  // Hash
     int64_t stolen_bucket_;
+    std::unique_ptr<counting_bloom_filter> filter_;  // Null unless enabled
+    size_t longest_chain_;
+
+    size_t tree_nodes_;     // Elements in tree buckets; the rest are list nodes
+    size_t payload_bytes_;  // heap_usage<> of the elements
+    map_event_listener *listener_;  // Not owned; null unless set
+
+    static void count_array(memory_breakdown &usage, bool mapped, size_t bytes) {
+        if (mapped) {
+            usage.bucket_mmap_bytes += bytes;
+        } else {
+            usage.bucket_heap_bytes += bytes;
+        }
+    }
+
+    static size_t tree_nodes_in(const bucket_type &bucket) {
+        return bucket.is_tree() ? bucket.size() : 0;
+    }
+
+    // A bucket may treefy or un-treefy on any insert or erase, so compare
+    // its tree nodes before and after. Unsigned wraparound makes the
+    // difference right when it is negative.
+    void note_tree_nodes(const bucket_type &bucket, size_t tree_before) {
+        size_t tree_after = tree_nodes_in(bucket);
+        tree_nodes_ += tree_after - tree_before;
+        // Erases never un-treefy a bucket, except the one that removes a
+        // tree's last node: tree_list then turns the empty bucket back into
+        // a list. That is reported as an un-treefy with chain_length 0, so
+        // treefies minus un-treefies is always the number of tree buckets.
+        if (listener_ && (tree_before != 0) != bucket.is_tree()) {
+            treefy_event event;
+            event.time = std::chrono::steady_clock::now();
+            event.bucket = static_cast<size_t>(&bucket - table_.data());
+            event.bucket_count = table_.size();
+            event.chain_length = bucket.size();
+            if (bucket.is_tree()) {
+                listener_->on_treefy(event);
+            } else {
+                listener_->on_un_treefy(event);
+            }
+        }
+    }
+
+    void note_inserted(const bucket_type &bucket, size_t tree_before, const value_type &kv) {
+        note_tree_nodes(bucket, tree_before);
+        payload_bytes_ += heap_usage<value_type>()(kv);
+    }
+
+    void note_payload_removed(const value_type &kv) {
+        size_t bytes = heap_usage<value_type>()(kv);
+        payload_bytes_ -= bytes < payload_bytes_ ? bytes : payload_bytes_;
+    }
+
+    void note_chain_length(size_t length) {
+        if (length > longest_chain_) {
+            longest_chain_ = length;
+        }
+    }
+
+    void filter_add(size_t hash_value) {
+        if (filter_) {
+            filter_->add(hash_value);
+        }
+    }
+
+    void filter_remove(size_t hash_value) {
+        if (filter_) {
+            filter_->remove(hash_value);
+        }
+    }
+
+    // True when the filter proves no key with this hash is present.
+    bool filtered_out(size_t hash_value) const {
+        return filter_ && !filter_->may_contain(hash_value);
+    }
+
+    // Eight bits of the hash stored with each chain entry. Taken from the
+    // top of a multiplicative remix, so they are independent of the low
+    // bits that pick the bucket.
+    static uint8_t tag_of(size_t hash_value) {
+        return static_cast<uint8_t>((static_cast<uint64_t>(hash_value) * 0x9E3779B97F4A7C15ULL) >> 56);
+    }
+
+    // The entry for key in bucket, or bucket.end(). Entries whose tag
+    // differs are skipped without comparing keys. Lookups count the entries
+    // they walk in k_counter_nodes_visited; inserts and erases, which use
+    // find_for_update(), do not.
+    template<bool Lookup = true, typename K>
+    typename bucket_type::iterator find_in_bucket(const bucket_type &bucket, const K &key, size_t hash_value) const {
+        return bucket.template find_tagged<Lookup>(tag_of(hash_value), [&key](const value_type &kv) {
+            SMOOTH_COUNT(k_counter_keys_compared);
+            return kv.first == key;
+        });
+    }
+
+    template<typename K>
+    typename bucket_type::iterator find_for_update(const bucket_type &bucket, const K &key, size_t hash_value) const {
+        return find_in_bucket<false>(bucket, key, hash_value);
+    }
 
     // Hash function
     size_t hash(const Key &key) const {
-        return hash_function_(key) % table_.size();
+        return bucket_index(hash_function_(key));
     }
 
     template<typename P>
     size_t hash(const P &key) const {
-        return hash_function_(key) % table_.size();
+        return bucket_index(hash_function_(key));
+    }
+
+    // Power-of-two tables, which is all hashmap creates, avoid the division.
+    size_t bucket_index(size_t hash_value) const {
+        size_t bucket_count = table_.size();
+        if ((bucket_count & (bucket_count - 1)) == 0) {
+            return hash_value & (bucket_count - 1);
+        }
+        return hash_value % bucket_count;
     }
 };
 };  // namespace smooth
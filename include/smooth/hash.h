@@ -0,0 +1,521 @@
+// Copyright (c) 2024 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SMOOTH_HASH_AVX2 1
+#endif
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+namespace smooth {
+
+// Secrets for hash_bytes(). Lanes of a stripe use a window into the array
+// that slides with the stripe's position in its block, so reordering
+// stripes changes the result.
+const static uint64_t k_hash_secret[24] = {
+        0x2cb0f69f4abea221ull, 0x9417034723148989ull, 0xdd555950609dfe03ull,
+        0xdbafb150deb12801ull, 0x7e789b2e6c442cb7ull, 0xf41e5636c7e4f8c5ull,
+        0x0959d150f8fba7e5ull, 0xa97316f13cdb9eebull, 0x74cd8258f9520069ull,
+        0x55c74a62e116868bull, 0xd2f4c799a2023cbdull, 0xdf98cb79a37b51b9ull,
+        0x396f5885524f3905ull, 0xaf1d56386ca3b277ull, 0xa9ffbe6b5104e85bull,
+        0x6bd0c51b9fd533b3ull, 0x980ce91c50ab4b57ull, 0x28ac395780fe62c5ull,
+        0x768912e3a6bcedc7ull, 0x50b3e8c9332c7c89ull, 0xce3bbfe520bd47dbull,
+        0xcba6c8e8e0bb7c4full, 0xbf194db8434a346dull, 0x7d8f2a7b60416d7full,
+};
+
+// Inputs longer than this are hashed in 64-byte stripes (see hash_bytes()).
+const static size_t k_hash_stripe_threshold = 256;
+const static size_t k_hash_stripe_size = 64;
+const static size_t k_hash_stripes_per_block = 16;
+
+// Full 64x64 -> 128 bit multiply; a receives the low half, b the high half.
+inline void hash_mum128(uint64_t &a, uint64_t &b) {
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 r = static_cast<unsigned __int128>(a) * b;
+    a = static_cast<uint64_t>(r);
+    b = static_cast<uint64_t>(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    a = _umul128(a, b, &b);
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = static_cast<uint32_t>(a), lb = static_cast<uint32_t>(b);
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t carry = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    carry += lo < t;
+    b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+    a = lo;
+#endif
+}
+
+// Multiply and fold the 128-bit product, as wyhash's _wymix().
+inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+    hash_mum128(a, b);
+    return a ^ b;
+}
+
+// Strong 64-bit integer mixer (splitmix64 finalizer). Every input bit
+// affects every output bit, so sequential keys spread over all buckets
+// even under power-of-two masking.
+inline uint64_t hash_mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+inline uint64_t hash_read64(const uint8_t *p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t hash_read32(const uint8_t *p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline void hash_accumulate_scalar(uint64_t *acc, const uint8_t *p, size_t stripes) {
+    for (size_t s = 0; s < stripes; s++) {
+        const uint8_t *stripe = p + s * k_hash_stripe_size;
+        const uint64_t *secret = k_hash_secret + s;
+        for (size_t i = 0; i < 8; i++) {
+            uint64_t data = hash_read64(stripe + i * 8);
+            uint64_t key = data ^ secret[i];
+            acc[i ^ 1] += data;
+            acc[i] += (key & 0xffffffffull) * (key >> 32);
+        }
+    }
+}
+
+#ifdef SMOOTH_HASH_AVX2
+// Same arithmetic as hash_accumulate_scalar(), four lanes at a time.
+__attribute__((target("avx2")))
+inline void hash_accumulate_avx2(uint64_t *acc, const uint8_t *p, size_t stripes) {
+    __m256i acc0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc));
+    __m256i acc1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc + 4));
+    for (size_t s = 0; s < stripes; s++) {
+        const uint8_t *stripe = p + s * k_hash_stripe_size;
+        const uint64_t *secret = k_hash_secret + s;
+        __m256i data0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(stripe));
+        __m256i data1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(stripe + 32));
+        __m256i key0 = _mm256_xor_si256(data0, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(secret)));
+        __m256i key1 = _mm256_xor_si256(data1, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(secret + 4)));
+        __m256i product0 = _mm256_mul_epu32(key0, _mm256_srli_epi64(key0, 32));
+        __m256i product1 = _mm256_mul_epu32(key1, _mm256_srli_epi64(key1, 32));
+        // Swap neighbouring 64-bit lanes for acc[i ^ 1] += data[i].
+        __m256i swapped0 = _mm256_shuffle_epi32(data0, _MM_SHUFFLE(1, 0, 3, 2));
+        __m256i swapped1 = _mm256_shuffle_epi32(data1, _MM_SHUFFLE(1, 0, 3, 2));
+        acc0 = _mm256_add_epi64(acc0, _mm256_add_epi64(product0, swapped0));
+        acc1 = _mm256_add_epi64(acc1, _mm256_add_epi64(product1, swapped1));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc), acc0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc + 4), acc1);
+}
+#endif
+
+// Whether hash_bytes() takes the AVX2 path on this CPU.
+inline bool hash_has_avx2() {
+#ifdef SMOOTH_HASH_AVX2
+    static const bool has_avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") != 0);
+    return has_avx2;
+#else
+    return false;
+#endif
+}
+
+typedef void (*hash_accumulate_fn)(uint64_t *acc, const uint8_t *p, size_t stripes);
+
+// xxh3-style long input path: eight accumulators take 64-byte stripes and
+// are scrambled after every block of 16 stripes, then folded.
+inline uint64_t hash_stripes(const uint8_t *p, size_t len, uint64_t seed, hash_accumulate_fn accumulate) {
+    uint64_t acc[8];
+    for (size_t i = 0; i < 8; i++) {
+        acc[i] = k_hash_secret[i] ^ seed;
+    }
+    size_t stripes = (len - 1) / k_hash_stripe_size;
+    size_t blocks = stripes / k_hash_stripes_per_block;
+    size_t block_bytes = k_hash_stripe_size * k_hash_stripes_per_block;
+    for (size_t b = 0; b < blocks; b++) {
+        accumulate(acc, p + b * block_bytes, k_hash_stripes_per_block);
+        for (size_t i = 0; i < 8; i++) {
+            acc[i] ^= acc[i] >> 47;
+            acc[i] ^= k_hash_secret[16 + i];
+            acc[i] *= 0x9e3779b1ull;
+        }
+    }
+    accumulate(acc, p + blocks * block_bytes, stripes % k_hash_stripes_per_block);
+    // The last stripe always ends at the last byte and may overlap.
+    uint64_t last[8];
+    std::memcpy(last, acc, sizeof(last));
+    accumulate(last, p + len - k_hash_stripe_size, 1);
+
+    uint64_t h = len * 0x9e3779b97f4a7c15ull ^ seed;
+    for (size_t i = 0; i < 8; i += 2) {
+        h += hash_mix(last[i] ^ k_hash_secret[9 + i], last[i + 1] ^ k_hash_secret[10 + i]);
+    }
+    return hash_mix64(h);
+}
+
+// wyhash-style hash of a byte string. Inputs up to k_hash_stripe_threshold
+// bytes use wyhash's multiply-fold rounds; longer ones the striped path,
+// vectorized with AVX2 when the CPU has it. Both paths return the same
+// value.
+inline uint64_t hash_bytes(const void *key, size_t len, uint64_t seed, hash_accumulate_fn accumulate) {
+    const uint8_t *p = static_cast<const uint8_t *>(key);
+    const uint64_t *s = k_hash_secret;
+    seed ^= hash_mix(seed ^ s[0], s[1]);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t mid = (len >> 3) << 2;
+            a = (hash_read32(p) << 32) | hash_read32(p + mid);
+            b = (hash_read32(p + len - 4) << 32) | hash_read32(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = (uint64_t(p[0]) << 16) | (uint64_t(p[len >> 1]) << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else if (len <= k_hash_stripe_threshold) {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = hash_mix(hash_read64(p) ^ s[1], hash_read64(p + 8) ^ seed);
+                see1 = hash_mix(hash_read64(p + 16) ^ s[2], hash_read64(p + 24) ^ see1);
+                see2 = hash_mix(hash_read64(p + 32) ^ s[3], hash_read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = hash_mix(hash_read64(p) ^ s[1], hash_read64(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = hash_read64(p + i - 16);
+        b = hash_read64(p + i - 8);
+    } else {
+        seed = hash_stripes(p, len, seed, accumulate);
+        a = hash_read64(p + len - 16);
+        b = hash_read64(p + len - 8);
+    }
+    a ^= s[1];
+    b ^= seed;
+    hash_mum128(a, b);
+    return hash_mix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+// Portable build of hash_bytes(), for tests and benchmarks.
+inline uint64_t hash_bytes_scalar(const void *key, size_t len, uint64_t seed = 0) {
+    return hash_bytes(key, len, seed, hash_accumulate_scalar);
+}
+
+inline uint64_t hash_bytes(const void *key, size_t len, uint64_t seed = 0) {
+#ifdef SMOOTH_HASH_AVX2
+    if (len > k_hash_stripe_threshold && hash_has_avx2()) {
+        return hash_bytes(key, len, seed, hash_accumulate_avx2);
+    }
+#endif
+    return hash_bytes(key, len, seed, hash_accumulate_scalar);
+}
+
+// Types whose object representation is their value, so they can be hashed
+// as raw bytes. Integers, enums and pointers are included; specialize to
+// true for aggregates without padding bytes:
+//
+//   namespace smooth {
+//   template<> struct is_trivially_hashable<point> : std::true_type {};
+//   }
+template<typename T>
+struct is_trivially_hashable
+        : std::integral_constant<bool, std::is_integral<T>::value || std::is_enum<T>::value ||
+                                       std::is_pointer<T>::value> {};
+
+template<typename T, typename Enable = void>
+struct hash_select {
+    // Anything else: remix std::hash, which is the identity for integers
+    // in libstdc++ and libc++.
+    static uint64_t apply(const T &value) {
+        return hash_mix64(static_cast<uint64_t>(std::hash<T>()(value)));
+    }
+};
+
+template<typename T>
+struct hash_select<T, typename std::enable_if<std::is_integral<T>::value && sizeof(T) <= sizeof(uint64_t)>::type> {
+    static uint64_t apply(const T &value) {
+        return hash_mix64(static_cast<uint64_t>(value));
+    }
+};
+
+template<typename T>
+struct hash_select<T, typename std::enable_if<std::is_pointer<T>::value>::type> {
+    static uint64_t apply(const T &value) {
+        return hash_mix64(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(value)));
+    }
+};
+
+template<typename T>
+struct hash_select<T, typename std::enable_if<std::is_enum<T>::value>::type> {
+    static uint64_t apply(const T &value) {
+        return hash_select<typename std::underlying_type<T>::type>::apply(
+                static_cast<typename std::underlying_type<T>::type>(value));
+    }
+};
+
+// Bytes that hold the value of a floating-point type. The x87 extended
+// format of long double on x86, 64 mantissa digits, takes the first 10
+// bytes of its 12 or 16; the rest is padding whose contents are arbitrary,
+// even in a copy, so it must not be hashed.
+template<typename T>
+constexpr size_t float_value_bytes() {
+    return std::numeric_limits<T>::digits == 64 && sizeof(T) > 10 ? 10 : sizeof(T);
+}
+
+template<typename T>
+struct hash_select<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+    static uint64_t apply(const T &value) {
+        // -0.0 == 0.0, so both must hash alike.
+        T normalized = value == T(0) ? T(0) : value;
+        return hash_bytes(&normalized, float_value_bytes<T>());
+    }
+};
+
+template<typename T>
+struct hash_select<T, typename std::enable_if<is_trivially_hashable<T>::value && !std::is_integral<T>::value &&
+                                              !std::is_pointer<T>::value && !std::is_enum<T>::value &&
+                                              !std::is_floating_point<T>::value>::type> {
+    static uint64_t apply(const T &value) {
+        return hash_bytes(&value, sizeof(T));
+    }
+};
+
+// Integers wider than 64 bits.
+template<typename T>
+struct hash_select<T, typename std::enable_if<std::is_integral<T>::value && (sizeof(T) > sizeof(uint64_t))>::type> {
+    static uint64_t apply(const T &value) {
+        return hash_bytes(&value, sizeof(T));
+    }
+};
+
+template<typename CharT, typename Traits, typename Alloc>
+struct hash_select<std::basic_string<CharT, Traits, Alloc>> {
+    static uint64_t apply(const std::basic_string<CharT, Traits, Alloc> &value) {
+        return hash_bytes(value.data(), value.size() * sizeof(CharT));
+    }
+};
+
+// Fast unkeyed hash: a strong mixer for integers, hash_bytes() for strings
+// and trivially hashable types, and a remixed std::hash for everything
+// else. See keyed_hash for untrusted keys.
+template<typename T>
+struct hash {
+    size_t operator()(const T &value) const {
+        return static_cast<size_t>(hash_select<T>::apply(value));
+    }
+};
+
+inline uint64_t hash_rotl(uint64_t x, int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+inline void siphash_round(uint64_t &v0, uint64_t &v1, uint64_t &v2, uint64_t &v3) {
+    v0 += v1; v1 = hash_rotl(v1, 13); v1 ^= v0; v0 = hash_rotl(v0, 32);
+    v2 += v3; v3 = hash_rotl(v3, 16); v3 ^= v2;
+    v0 += v3; v3 = hash_rotl(v3, 21); v3 ^= v0;
+    v2 += v1; v1 = hash_rotl(v1, 17); v1 ^= v2; v2 = hash_rotl(v2, 32);
+}
+
+// SipHash-c-d with a 128-bit key (k0, k1), as in the reference
+// implementation. Redis uses SipHash-1-3 for its dictionaries.
+template<int CompressionRounds, int FinalizationRounds>
+inline uint64_t siphash(const void *key, size_t len, uint64_t k0, uint64_t k1) {
+    const uint8_t *p = static_cast<const uint8_t *>(key);
+    uint64_t v0 = 0x736f6d6570736575ull ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dull ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ull ^ k0;
+    uint64_t v3 = 0x7465646279746573ull ^ k1;
+    const uint8_t *end = p + len - (len % 8);
+    for (; p != end; p += 8) {
+        uint64_t m = hash_read64(p);
+        v3 ^= m;
+        for (int i = 0; i < CompressionRounds; i++) {
+            siphash_round(v0, v1, v2, v3);
+        }
+        v0 ^= m;
+    }
+    uint64_t b = static_cast<uint64_t>(len) << 56;
+    for (size_t i = 0; i < len % 8; i++) {
+        b |= static_cast<uint64_t>(p[i]) << (8 * i);
+    }
+    v3 ^= b;
+    for (int i = 0; i < CompressionRounds; i++) {
+        siphash_round(v0, v1, v2, v3);
+    }
+    v0 ^= b;
+    v2 ^= 0xff;
+    for (int i = 0; i < FinalizationRounds; i++) {
+        siphash_round(v0, v1, v2, v3);
+    }
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+inline uint64_t siphash13(const void *key, size_t len, uint64_t k0, uint64_t k1) {
+    return siphash<1, 3>(key, len, k0, k1);
+}
+
+// Keyed integer mixer: without the key, which inputs share a bucket cannot
+// be predicted. The high half of the mum product moves almost linearly with
+// sequential inputs, which for some keys crowds them into a few buckets;
+// the finalizer breaks that up.
+inline uint64_t keyed_mix64(uint64_t x, uint64_t k0, uint64_t k1) {
+    return hash_mix64(hash_mix(x ^ k0, k1));
+}
+
+// A fresh key for each keyed_hash. Keys come from a process-wide random
+// key and a counter, so std::random_device is read once per process.
+inline void keyed_hash_random_key(uint64_t &k0, uint64_t &k1) {
+    struct process_key {
+        uint64_t k0, k1;
+        process_key() {
+            std::random_device device;
+            k0 = (static_cast<uint64_t>(device()) << 32) ^ device();
+            k1 = (static_cast<uint64_t>(device()) << 32) ^ device();
+        }
+    };
+    static const process_key base;
+    static std::atomic<uint64_t> counter(0);
+    uint64_t n = counter.fetch_add(1, std::memory_order_relaxed);
+    k0 = hash_mix64(base.k0 + n);
+    k1 = hash_mix64(base.k1 ^ hash_mix64(n)) | 1;
+}
+
+template<typename T, typename Enable = void>
+struct keyed_hash_select {
+    // Anything else: key a remixed std::hash. Only as strong as std::hash
+    // itself against collisions.
+    static uint64_t apply(const T &value, uint64_t k0, uint64_t k1) {
+        return keyed_mix64(static_cast<uint64_t>(std::hash<T>()(value)), k0, k1);
+    }
+};
+
+template<typename T>
+struct keyed_hash_select<T, typename std::enable_if<std::is_integral<T>::value &&
+                                                    sizeof(T) <= sizeof(uint64_t)>::type> {
+    static uint64_t apply(const T &value, uint64_t k0, uint64_t k1) {
+        return keyed_mix64(static_cast<uint64_t>(value), k0, k1);
+    }
+};
+
+template<typename T>
+struct keyed_hash_select<T, typename std::enable_if<std::is_pointer<T>::value>::type> {
+    static uint64_t apply(const T &value, uint64_t k0, uint64_t k1) {
+        return keyed_mix64(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(value)), k0, k1);
+    }
+};
+
+template<typename T>
+struct keyed_hash_select<T, typename std::enable_if<std::is_enum<T>::value>::type> {
+    static uint64_t apply(const T &value, uint64_t k0, uint64_t k1) {
+        return keyed_hash_select<typename std::underlying_type<T>::type>::apply(
+                static_cast<typename std::underlying_type<T>::type>(value), k0, k1);
+    }
+};
+
+template<typename T>
+struct keyed_hash_select<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+    static uint64_t apply(const T &value, uint64_t k0, uint64_t k1) {
+        T normalized = value == T(0) ? T(0) : value;
+        return siphash13(&normalized, float_value_bytes<T>(), k0, k1);
+    }
+};
+
+template<typename T>
+struct keyed_hash_select<T, typename std::enable_if<
+        (is_trivially_hashable<T>::value && !std::is_integral<T>::value && !std::is_pointer<T>::value &&
+         !std::is_enum<T>::value && !std::is_floating_point<T>::value) ||
+        (std::is_integral<T>::value && (sizeof(T) > sizeof(uint64_t)))>::type> {
+    static uint64_t apply(const T &value, uint64_t k0, uint64_t k1) {
+        return siphash13(&value, sizeof(T), k0, k1);
+    }
+};
+
+template<typename CharT, typename Traits, typename Alloc>
+struct keyed_hash_select<std::basic_string<CharT, Traits, Alloc>> {
+    static uint64_t apply(const std::basic_string<CharT, Traits, Alloc> &value, uint64_t k0, uint64_t k1) {
+        return siphash13(value.data(), value.size() * sizeof(CharT), k0, k1);
+    }
+};
+
+// Default hash function of hashmap and fixed_hashmap. Each instance draws a
+// random 128-bit key, so keys chosen to collide in one map, or in one
+// process, do not collide in another: SipHash-1-3 for strings and other
+// byte-hashed types, keyed_mix64() for integers. Copies share the key, so
+// a map's tables stay consistent. Use smooth::hash where keys are trusted
+// and speed matters more.
+template<typename T>
+class keyed_hash {
+public:
+    keyed_hash() {
+        keyed_hash_random_key(k0_, k1_);
+    }
+
+    keyed_hash(uint64_t k0, uint64_t k1) : k0_(k0), k1_(k1) {}
+
+    size_t operator()(const T &value) const {
+        return static_cast<size_t>(keyed_hash_select<T>::apply(value, k0_, k1_));
+    }
+
+    uint64_t key0() const { return k0_; }
+    uint64_t key1() const { return k1_; }
+
+    // Draw a fresh key. Values hashed before no longer match.
+    void reseed() {
+        keyed_hash_random_key(k0_, k1_);
+    }
+
+private:
+    uint64_t k0_;
+    uint64_t k1_;
+};
+
+// Whether Hash has a reseed() member, like keyed_hash. hashmap reseeds such
+// hash functions when it detects a collision attack.
+template<typename Hash, typename Enable = void>
+struct is_reseedable_hash : std::false_type {};
+
+template<typename Hash>
+struct is_reseedable_hash<Hash, decltype(std::declval<Hash &>().reseed(), void())> : std::true_type {};
+
+// Reseed hash if it supports it and return whether it did.
+template<typename Hash>
+typename std::enable_if<is_reseedable_hash<Hash>::value, bool>::type reseed_hash(Hash &hash) {
+    hash.reseed();
+    return true;
+}
+
+template<typename Hash>
+typename std::enable_if<!is_reseedable_hash<Hash>::value, bool>::type reseed_hash(Hash &) {
+    return false;
+}
+
+}  // namespace smooth
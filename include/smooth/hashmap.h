@@ -6,8 +6,12 @@
 
 #include <functional>
 #include <initializer_list>
+#include <algorithm>
+#include <random>
 #include <cassert>
 #include "fixed_hashmap.h"
+#include "probes.h"
+#include "scan_cursor.h"
 
 namespace smooth {
 
@@ -19,15 +23,73 @@ const static bool k_item_not_found = false;
 
 const static int64_t k_num_items_to_steal = 1;
 
-// Iterator base class
+const static size_t k_min_bucket_count = 16;
+
+// Elements sampled by fair_random_element(), as GETFAIR_NUM_ENTRIES in Redis.
+const static size_t k_fair_random_samples = 15;
+
+// A chain this long means the hash function is being attacked. Tables are
+// rehashed before the load factor passes 3/4, where a good hash makes even a
+// chain of 16 about a 1e-16 event per bucket.
+const static size_t k_collision_chain_length = 16;
+
+// Bucket counts are kept at powers of two so scan() cursors stay valid while
+// the table grows or shrinks.
+inline size_t round_up_to_power_of_two(size_t n) {
+    size_t result = 1;
+    while (result < n) {
+        result <<= 1;
+    }
+    return result;
+}
+
+// Iterator base class.
+//
+// Plain iterators are invalidated by any insert or erase, since either may
+// run a step of incremental rehashing. Debug builds check this with a
+// fingerprint of both tables, like Redis unsafe iterators. Use
+// hashmap::safe_begin() to modify the map while iterating.
 template<typename IteratorType, typename ValueType, typename TableType>
 class hashmap_iterator_base {
 public:
     hashmap_iterator_base(TableType* current, TableType* old, int which, IteratorType it, bool end)
-            : table_current_(current), table_old_(old), it_(it),  end_(end), which_(0) {}
+            : table_current_(current), table_old_(old), it_(it),  end_(end), which_(which), safe_(false) {
+#ifndef NDEBUG
+        fingerprint_ = fingerprint();
+#endif
+    }
 
     hashmap_iterator_base(TableType* current, TableType* old, bool end)
-            : table_current_(current), table_old_(old), it_(current->end()),  end_(end), which_(0) {}
+            : table_current_(current), table_old_(old), it_(current->end()),  end_(end), which_(0), safe_(false) {
+#ifndef NDEBUG
+        fingerprint_ = fingerprint();
+#endif
+    }
+
+    // safe_ belongs to the object, not to the position it holds: a copy is a
+    // plain iterator (safe_iterator sets it again), and assignment keeps the
+    // target's own. Otherwise slicing a safe_iterator into an iterator would
+    // skip the modification check without holding off rehashing.
+    hashmap_iterator_base(const hashmap_iterator_base& other)
+            : it_(other.it_), table_current_(other.table_current_), table_old_(other.table_old_),
+              end_(other.end_), which_(other.which_), safe_(false)
+#ifndef NDEBUG
+              , fingerprint_(other.fingerprint_)
+#endif
+    {
+    }
+
+    hashmap_iterator_base& operator=(const hashmap_iterator_base& other) {
+        it_ = other.it_;
+        table_current_ = other.table_current_;
+        table_old_ = other.table_old_;
+        end_ = other.end_;
+        which_ = other.which_;
+#ifndef NDEBUG
+        fingerprint_ = other.fingerprint_;
+#endif
+        return *this;
+    }
 
     // Prefix increment
     hashmap_iterator_base& operator++() {
@@ -57,7 +119,7 @@ public:
             return false;
         }
 
-        return it_ != other.it_;
+        return it_ == other.it_;
     }
 
     bool operator!=(const hashmap_iterator_base& other) const {
@@ -69,6 +131,8 @@ protected:
         if (end_) {
             throw std::out_of_range("Iterator is at end");
         }
+        // The map was modified during an unsafe iteration.
+        assert(safe_ || fingerprint_ == fingerprint());
 
         if (which_ == 0) {
             // Advance the iterator in the current fixed_map.
@@ -108,14 +172,22 @@ protected:
         return *table_old_;
     }
 
+    uint64_t fingerprint() const {
+        return table_current_->fingerprint() * 31 + table_old_->fingerprint();
+    }
+
     IteratorType it_;
     TableType* table_current_;
     TableType* table_old_;
     bool end_;
     int which_; // 0 for current, 1 for old
+    bool safe_; // set for hashmap::safe_iterator, which may outlive modifications
+#ifndef NDEBUG
+    uint64_t fingerprint_;
+#endif
 };
 
-template <typename Key, typename Mapped, typename Hash = std::hash<Key>>
+template <typename Key, typename Mapped, typename Hash = keyed_hash<Key>>
 class hashmap {
 public:
     using value_type =  std::pair<Key, Mapped>;
@@ -137,10 +209,81 @@ public:
         using Base = hashmap_iterator_base<typename fixed_map_type::const_iterator, const value_type, const fixed_map_type>;
     public:
         using Base::Base; // Inherit constructors
-        explicit const_iterator(const iterator& it) : Base(it.table_current_, it.table_old_, it.end_) {}
+        explicit const_iterator(const iterator& it)
+                : Base(it.table_current_, it.table_old_, it.which_,
+                       typename fixed_map_type::const_iterator(it.it_), it.end_) {}
         friend class fixed_hashmap<Key, Mapped, Hash>;
     };
 
+    // Iterator that pauses incremental rehashing, including starting a new
+    // one, for as long as any copy of it is alive. Values may be updated and
+    // the current element erased with erase(it) while iterating. Inserting
+    // new keys is allowed as well, though they may or may not be visited.
+    class safe_iterator : public iterator {
+    public:
+        safe_iterator(const safe_iterator& other) : iterator(other), map_(other.map_) {
+            this->safe_ = true;
+            map_->pause_rehash_++;
+        }
+
+        safe_iterator& operator=(const safe_iterator& other) {
+            if (this != &other) {
+                other.map_->pause_rehash_++;
+                map_->pause_rehash_--;
+                iterator::operator=(other);
+                map_ = other.map_;
+            }
+            return *this;
+        }
+
+        ~safe_iterator() {
+            map_->pause_rehash_--;
+        }
+
+        safe_iterator& operator++() {
+            iterator::operator++();
+            return *this;
+        }
+
+        safe_iterator operator++(int) {
+            safe_iterator temp = *this;
+            iterator::operator++();
+            return temp;
+        }
+
+    private:
+        friend class hashmap<Key, Mapped, Hash>;
+
+        safe_iterator(const iterator& it, hashmap* map) : iterator(it), map_(map) {
+            this->safe_ = true;
+            map_->pause_rehash_++;
+        }
+
+        hashmap* map_;
+    };
+
+    // Holds off reseeds (see reseed_count()) for as long as it is alive, so
+    // scan() and scan_range() keep their guarantees while the map is
+    // modified between calls. A reseed already under way stops migrating
+    // until the last guard is gone, which also delays resizes; otherwise
+    // the map keeps growing and shrinking as usual.
+    class scan_guard {
+    public:
+        explicit scan_guard(hashmap& map) : map_(&map) {
+            map_->scan_guards_++;
+        }
+
+        ~scan_guard() {
+            map_->scan_guards_--;
+        }
+
+        scan_guard(const scan_guard&) = delete;
+        scan_guard& operator=(const scan_guard&) = delete;
+
+    private:
+        hashmap* map_;
+    };
+
     iterator begin() noexcept {
         // Start by assuming the iterator is pointing to the current set.
         auto it = current_.begin();
@@ -187,21 +330,43 @@ public:
         return begin();
     }
 
+    safe_iterator safe_begin() {
+        return safe_iterator(begin(), this);
+    }
+
     const_iterator cend() const {
         return end();
     }
 
     // Constructor
     explicit hashmap(int initial_size = 10, const Hash& hash = Hash())
-            : rehashing_(false),
-              current_(initial_size, hash),
-              old_(initial_size, hash) {}
+            : current_(round_up_to_power_of_two(initial_size), hash),
+              old_(1, hash),
+              rehashing_(false),
+              pause_rehash_(0),
+              scan_guards_(0),
+              lookup_filter_(false),
+              reseeding_(false),
+              reseed_count_(0),
+              next_reseed_size_(0),
+              listener_(nullptr),
+              rehash_kind_(k_rehash_grow),
+              rehash_steps_(0) {}
 
     explicit hashmap(std::initializer_list<typename fixed_map_type::value_type> pairs,
                      int initial_size = 10, const Hash& hash = Hash())
-            : rehashing_(false),
-              current_(initial_size, hash),
-              old_(initial_size, hash) {
+            : current_(round_up_to_power_of_two(initial_size), hash),
+              old_(1, hash),
+              rehashing_(false),
+              pause_rehash_(0),
+              scan_guards_(0),
+              lookup_filter_(false),
+              reseeding_(false),
+              reseed_count_(0),
+              next_reseed_size_(0),
+              listener_(nullptr),
+              rehash_kind_(k_rehash_grow),
+              rehash_steps_(0) {
         for(auto& pair : pairs) {
             insert(pair);
         }
@@ -328,10 +493,335 @@ public:
         return std::max(num1, num2);
     }
 
+    // Erase the element at it and return an iterator to the next element.
+    // Does not run a rehashing step, so the returned iterator stays usable.
+    iterator erase(iterator it) {
+        if (it.end_) {
+            throw std::out_of_range("Iterator is at end");
+        }
+        if (it.which_ == 0) {
+            auto next = current_.erase(it.it_);
+            if (next != current_.end()) {
+                return new_iterator(0, next, k_iter_valid);
+            }
+            auto old_it = old_.begin();
+            if (old_it == old_.end()) {
+                return end();
+            }
+            return new_iterator(1, old_it, k_iter_valid);
+        }
+        auto next = old_.erase(it.it_);
+        if (next == old_.end()) {
+            return end();
+        }
+        return new_iterator(1, next, k_iter_valid);
+    }
+
+    safe_iterator erase(const safe_iterator& it) {
+        return safe_iterator(erase(static_cast<const iterator&>(it)), this);
+    }
+
     iterator find(const Key& key) {
+        iterator it = find_in_tables(key);
+        SMOOTH_COUNT_LOOKUP(it != end());
+        return it;
+    }
+
+    const_iterator find(const Key& key) const {
+        const_iterator it = find_in_tables(key);
+        SMOOTH_COUNT_LOOKUP(it != end());
+        return it;
+    }
+
+    template <class K>
+    iterator find( const K& key ) {
+        iterator it = find_in_tables(key);
+        SMOOTH_COUNT_LOOKUP(it != end());
+        return it;
+    }
+
+    // Hash of key under this map's hash function. Callers that already
+    // have it, e.g. from parsing, can pass it to the *_with_hash functions
+    // below to skip hashing the key again; during rehashing the bucket in
+    // each table is derived from the same value, except while a reseed is
+    // in progress, when the old table hashes the key itself. The hash must
+    // equal hash_of(key), which debug builds assert, or lookups will miss.
+    // A reseed (see reseed_count()) changes hash_of() for every key and so
+    // invalidates hashes computed before it; any insert may reseed the map,
+    // so do not keep hashes across inserts.
+    size_t hash_of(const Key& key) const { return current_.hash_of(key); }
+
+    iterator find_with_hash(const Key& key, size_t hash_value) {
+        assert(hash_value == hash_of(key));
+        auto it = current_.find_with_hash(key, hash_value);
+        if (it != current_.end()) {
+            SMOOTH_COUNT_LOOKUP(true);
+            return new_iterator(0, it, k_iter_valid);
+        }
+        if (rehashing_) {
+            it = old_.find_with_hash(key, old_hash(key, hash_value));
+            if (it != old_.end()) {
+                SMOOTH_COUNT_LOOKUP(true);
+                return new_iterator(1, it, k_iter_valid);
+            }
+        }
+        SMOOTH_COUNT_LOOKUP(false);
+        return end();
+    }
+
+    const_iterator find_with_hash(const Key& key, size_t hash_value) const {
+        assert(hash_value == hash_of(key));
+        auto it = current_.find_with_hash(key, hash_value);
+        if (it != current_.end()) {
+            SMOOTH_COUNT_LOOKUP(true);
+            return new_iterator(0, it, k_iter_valid);
+        }
+        if (rehashing_) {
+            it = old_.find_with_hash(key, old_hash(key, hash_value));
+            if (it != old_.end()) {
+                SMOOTH_COUNT_LOOKUP(true);
+                return new_iterator(1, it, k_iter_valid);
+            }
+        }
+        SMOOTH_COUNT_LOOKUP(false);
+        return end();
+    }
+
+    template<typename P>
+    std::pair<iterator, bool> insert_with_hash(P&& kv, size_t hash_value) {
+        assert(hash_value == hash_of(kv.first));
+        move_progressively();
+        maybe_rehash_guard guard(*this);
+        if(!rehashing_) {
+            auto result = current_.insert_with_hash(std::forward<P>(kv), hash_value);
+            return std::make_pair(new_iterator(0, result.first, k_iter_valid), result.second);
+        }
+
+        auto it_old = old_.find_with_hash(kv.first, old_hash(kv.first, hash_value));
+        if (it_old != old_.end()) {
+            return std::make_pair(new_iterator(1, it_old, k_iter_valid), k_item_not_found);
+        }
+
+        auto result = current_.insert_with_hash(std::forward<P>(kv), hash_value);
+        return std::make_pair(new_iterator(0, result.first, k_iter_valid), result.second);
+    }
+
+    size_type erase_with_hash(const Key& key, size_t hash_value) {
+        assert(hash_value == hash_of(key));
+        move_progressively();
+        maybe_rehash_guard guard(*this);
+        if(!rehashing_) {
+            return current_.erase_with_hash(key, hash_value);
+        }
+        size_type num1 = current_.erase_with_hash(key, hash_value);
+        size_type num2 = old_.erase_with_hash(key, old_hash(key, hash_value));
+        return std::max(num1, num2);
+    }
+
+    // Check if the hashmap contains a key
+    bool contains(const Key& key) const {
+        bool found = current_.contains(key) || old_.contains(key);
+        SMOOTH_COUNT_LOOKUP(found);
+        return found;
+    }
+
+    template<class P>
+    bool contains(const P& key) const {
+        bool found = current_.contains(key) || old_.contains(key);
+        SMOOTH_COUNT_LOOKUP(found);
+        return found;
+    }
+
+    // Get the number of key-value pairs in the hashmap
+    size_type size() const { return current_.size() + old_.size(); }
+
+    bool is_rehashing() const { return rehashing_; }
+
+    // Return a random element, or end() if the map is empty. Picks a random
+    // non-empty bucket over both tables, then a random position in its chain,
+    // like Redis dictGetRandomKey(). Elements in long chains are less likely
+    // to be returned; see fair_random_element().
+    template<typename Rng>
+    iterator random_element(Rng& rng) {
+        if (size() == 0) {
+            return end();
+        }
+        size_type current_buckets = current_.get_bucket_count();
+        std::uniform_int_distribution<size_type> pick_bucket(0, current_buckets + old_live_buckets() - 1);
+        for (;;) {
+            size_type index = pick_bucket(rng);
+            int which = 0;
+            auto* table = &current_;
+            if (index >= current_buckets) {
+                index -= current_buckets;
+                which = 1;
+                table = &old_;
+            }
+            size_type chain = table->bucket_size(index);
+            if (chain == 0) {
+                continue;
+            }
+            std::uniform_int_distribution<size_type> pick_position(0, chain - 1);
+            return new_iterator(which, table->bucket_iterator(index, pick_position(rng)), k_iter_valid);
+        }
+    }
+
+    // Write iterators to up to n elements to out and return how many were
+    // written. Like Redis dictGetSomeKeys(), elements come from consecutive
+    // buckets of both tables starting at a random one, which is much cheaper
+    // than n calls to random_element() but not uniformly distributed. It may
+    // return fewer than n elements, and the same element more than once.
+    template<typename OutputIt, typename Rng>
+    size_type sample_some(size_type n, OutputIt out, Rng& rng) {
+        return sample_buckets(n, rng, [&out](const iterator& it) { *out++ = it; });
+    }
+
+    // Return a random element, or end() if the map is empty. Picks one of a
+    // sample_some() batch, which is fairer to elements in long chains than
+    // random_element(), as Redis dictGetFairRandomKey().
+    template<typename Rng>
+    iterator fair_random_element(Rng& rng) {
+        iterator chosen = end();
+        size_type seen = 0;
+        // Reservoir sampling over the batch avoids storing it.
+        sample_buckets(k_fair_random_samples, rng, [&](const iterator& it) {
+            seen++;
+            if (std::uniform_int_distribution<size_type>(0, seen - 1)(rng) == 0) {
+                chosen = it;
+            }
+        });
+        if (seen == 0) {
+            return random_element(rng);
+        }
+        return chosen;
+    }
+
+    // Incrementally iterate the map, like Redis SCAN. Start with cursor 0 and
+    // pass the returned cursor back in until 0 is returned again. Roughly
+    // count elements are visited per call. Every element present for the
+    // whole iteration is passed to fn at least once, even if the map grows,
+    // shrinks or migrates between calls; some may be passed more than once.
+    // A reseed (see reseed_count()) moves elements to unrelated buckets, so
+    // when the map may be modified between calls, hold a scan_guard from
+    // the first call to the last; a scan running across a reseed may miss
+    // elements. fn must not insert or erase.
+    template<typename Fn>
+    size_type scan(size_type cursor, Fn&& fn, size_type count = 10) {
+        return scan_impl(*this, cursor, fn, count);
+    }
+
+    template<typename Fn>
+    size_type scan(size_type cursor, Fn&& fn, size_type count = 10) const {
+        return scan_impl(*this, cursor, fn, count);
+    }
+
+    // Continue the slice of a scan described by cursor, visiting roughly
+    // count elements, and return true once the slice is finished. Cursors
+    // from split_range_cursors() cover the map between them with no element
+    // in two slices, so they can be consumed by independent threads (each
+    // with its own lock held) or, after serialize(), by other processes.
+    // The scan() guarantees hold within each slice, under the same
+    // scan_guard for all of them.
+    template<typename Fn>
+    bool scan_range(range_cursor& cursor, Fn&& fn, size_type count = 10) {
+        return scan_range_impl(*this, cursor, fn, count);
+    }
+
+    template<typename Fn>
+    bool scan_range(range_cursor& cursor, Fn&& fn, size_type count = 10) const {
+        return scan_range_impl(*this, cursor, fn, count);
+    }
+
+    void clear() {
+        // Start over with fresh tables; clearing in place would keep the bucket array.
+        current_ = new_table(k_min_bucket_count, current_.hash_function());
+        old_ = fixed_map_type(1, current_.hash_function());
+        rehashing_ = false;
+        reseeding_ = false;
+    }
+
+    // Bytes held by the map, by component; see fixed_hashmap::memory_usage().
+    // Computed from counts the tables keep up to date, so it is cheap.
+    memory_breakdown memory_usage() const {
+        memory_breakdown usage = current_.memory_usage();
+        usage += old_.memory_usage();
+        // The tables are members, counted in sizeof(*this).
+        usage.object_bytes = sizeof(*this);
+        return usage;
+    }
+
+    // Walk every element to bring the key/value payload up to date after
+    // values changed size in place.
+    void recount_payload() {
+        current_.recount_payload();
+        old_.recount_payload();
+    }
+
+    // Chain statistics of both tables and rehashing progress, like Redis
+    // DEBUG HTSTATS; hashmap_stats::dump() formats them. Tables of more than
+    // max_buckets buckets are sampled, so this is cheap enough to call
+    // periodically on a large map.
+    hashmap_stats stats(size_type max_buckets = k_stats_sample_buckets) const {
+        hashmap_stats stats;
+        stats.main = current_.stats(max_buckets);
+        stats.rehashing = rehashing_;
+        stats.reseeding = reseeding_;
+        stats.reseed_count = reseed_count_;
+        if (rehashing_) {
+            stats.old = old_.stats(max_buckets);
+            stats.buckets_to_migrate = old_live_buckets();
+        }
+        return stats;
+    }
+
+    // Number of times the map has detected a collision attack and moved to
+    // a new hash key. When an insert leaves a chain of
+    // k_collision_chain_length elements and the hash function has a
+    // reseed() member, like the default keyed_hash, the map reseeds a copy
+    // of it and rehashes incrementally into a table of the same size.
+    // Reseeds are spaced by doublings of the map size, so a hash that
+    // collides under every key costs amortised O(1) per insert.
+    size_type reseed_count() const { return reseed_count_; }
+
+    // Put a counting Bloom filter in front of each table, so lookups of
+    // absent keys (find, contains, erase) usually cost one cache line per
+    // table instead of a bucket walk. Tables created by later rehashes get
+    // one too; elements carry over as they migrate.
+    void enable_lookup_filter() {
+        lookup_filter_ = true;
+        current_.enable_lookup_filter();
+        if (rehashing_) {
+            old_.enable_lookup_filter();
+        }
+    }
+
+    void disable_lookup_filter() {
+        lookup_filter_ = false;
+        current_.disable_lookup_filter();
+        old_.disable_lookup_filter();
+    }
+
+    bool has_lookup_filter() const { return lookup_filter_; }
+
+    // Report rehashes (start, each migration step, finish) and buckets
+    // turning into trees and back to listener, or stop reporting if it is
+    // null. The listener is not owned and must outlive the map or be
+    // removed first. Without one, the only cost is a null check on the
+    // paths that would report.
+    void set_event_listener(map_event_listener* listener) {
+        listener_ = listener;
+        current_.set_event_listener(listener);
+        old_.set_event_listener(listener);
+    }
+
+    map_event_listener* event_listener() const { return listener_; }
+
+private:
+    // find() without the lookup counters.
+    iterator find_in_tables(const Key& key) {
         if(!rehashing_) {
             auto it = current_.find(key);
-            new_iterator(0, it, it == current_.end());
+            return new_iterator(0, it, it == current_.end());
         }
         bool current_is_larger = current_.size() > old_.size();
         auto& larger = current_is_larger ? current_ : old_;
@@ -352,10 +842,10 @@ public:
         return new_iterator(0, current_.end(), k_iter_end);
     }
 
-    const_iterator find(const Key& key ) const {
+    const_iterator find_in_tables(const Key& key) const {
         if(!rehashing_) {
             auto it = current_.find(key);
-            new_iterator(0, it, it == current_.end());
+            return new_iterator(0, it, it == current_.end());
         }
         bool current_is_larger = current_.size() > old_.size();
         const auto& larger = current_is_larger ? current_ : old_;
@@ -377,7 +867,7 @@ public:
     }
 
     template <class K>
-    iterator find( const K& key ) {
+    iterator find_in_tables(const K& key) {
         auto it = current_.find(key);
         if (it == current_.end()) {
             if(!rehashing_) {
@@ -392,27 +882,6 @@ public:
         return  new_iterator(  0, it, k_iter_valid);
     }
 
-
-    // Check if the hashmap contains a key
-    bool contains(const Key& key) const {
-        return current_.contains(key) || old_.contains(key);
-    }
-
-    template<class P>
-    bool contains(const P& key) const {
-        return current_.contains(key) || old_.contains(key);
-    }
-
-    // Get the number of key-value pairs in the hashmap
-    size_type size() const { return current_.size() + old_.size(); }
-
-    void clear() {
-        current_.clear();
-        old_.clear();
-        rehashing_ = false;
-    }
-
-private:
     class maybe_rehash_guard {
     public:
         explicit maybe_rehash_guard(hashmap& map) : map_(map) {}
@@ -424,7 +893,13 @@ private:
     };
 
     void maybe_rehash() {
-        if(rehashing_) {
+        if(rehashing_ || pause_rehash_ > 0) {
+            return;
+        }
+
+        if (is_reseedable_hash<Hash>::value && scan_guards_ == 0 &&
+            current_.longest_chain() >= k_collision_chain_length && current_.size() >= next_reseed_size_ &&
+            reseed()) {
             return;
         }
 
@@ -433,37 +908,271 @@ private:
         // of element count is more than 3/4 of the bucket count
         if(map_size * 4 >= bucket_size * 3 ) {
             rehash(bucket_size * 2);
-        } else if(bucket_size > map_size*4 && bucket_size > 16) {
-            // When bucket_size = 12 and map_size = 9, the map's bucket_size will be expanded to 24.
-            // This means that the single bucket_size is 2.66 times the map_size. This is considered ok.
-            // Therefore, we can perform a shrink operation when the multiplier is 4.
-            // This will reduce the bucket_size to 3 times the map_size.
-            shrink(map_size*3);
+        } else if(bucket_size > map_size*8 && bucket_size > k_min_bucket_count) {
+            // Bucket counts are powers of two, so shrink to the smallest one that
+            // keeps the load factor above 1/4. That leaves room on both sides:
+            // the result neither grows again nor shrinks again right away.
+            shrink(std::max(map_size*2, k_min_bucket_count));
         }
     }
 
     void shrink(size_type new_size) {
-        rehash(new_size);
+        rehash(new_size, k_rehash_shrink);
     }
 
     // Rehash the hashmap
-    void rehash(size_type new_size) {
+    void rehash(size_type new_size, rehash_kind kind = k_rehash_grow) {
         assert(old_.empty());
-        old_ = fixed_hashmap<Key, Mapped, Hash>(new_size);
+        // Both tables must share the hash function for scan() to work.
+        old_ = new_table(round_up_to_power_of_two(new_size), current_.hash_function());
         old_.swap(current_);
         rehashing_ = true;
+        on_rehashing_started(kind);
+    }
+
+    // Rehash into a table of the same size under a new hash key. Unlike a
+    // resize, old_ and current_ then hash differently until rehashing ends.
+    bool reseed() {
+        Hash hash = current_.hash_function();
+        if (!reseed_hash(hash)) {
+            return false;
+        }
+        old_ = new_table(current_.get_bucket_count(), hash);
+        old_.swap(current_);
+        rehashing_ = true;
+        reseeding_ = true;
+        reseed_count_++;
+        next_reseed_size_ = size() * 2;
+        on_rehashing_started(k_rehash_reseed);
+        return true;
+    }
+
+    // An empty table with the map's lookup filter and listener settings.
+    fixed_map_type new_table(size_type bucket_count, const Hash& hash) const {
+        fixed_map_type table(bucket_count, hash);
+        if (lookup_filter_) {
+            table.enable_lookup_filter();
+        }
+        table.set_event_listener(listener_);
+        return table;
+    }
+
+    void on_rehashing_started(rehash_kind kind) {
+        rehash_kind_ = kind;
+        rehash_steps_ = 0;
+        rehash_started_ = std::chrono::steady_clock::now();
+        SMOOTH_PROBE4(rehash__start, static_cast<int>(kind), size(), old_.get_bucket_count(),
+                      current_.get_bucket_count());
+        if (listener_) {
+            rehash_start_event event;
+            event.kind = kind;
+            event.time = rehash_started_;
+            event.size = size();
+            event.old_bucket_count = old_.get_bucket_count();
+            event.new_bucket_count = current_.get_bucket_count();
+            listener_->on_rehash_start(event);
+        }
     }
 
     void on_rehashing_finished() {
         // release the old memory
-        old_ = fixed_hashmap<Key, Mapped, Hash>(1);
+        old_ = fixed_map_type(1, current_.hash_function());
+        reseeding_ = false;
+        SMOOTH_PROBE3(rehash__finish, static_cast<int>(rehash_kind_), size(), current_.get_bucket_count());
+        if (listener_) {
+            rehash_finish_event event;
+            event.kind = rehash_kind_;
+            event.time = std::chrono::steady_clock::now();
+            event.size = size();
+            event.bucket_count = current_.get_bucket_count();
+            event.steps = rehash_steps_;
+            event.duration_ns = nanos_between(rehash_started_, event.time);
+            listener_->on_rehash_finish(event);
+        }
+    }
+
+    // The hash of key in old_, given its hash in current_.
+    size_t old_hash(const Key& key, size_t hash_value) const {
+        return reseeding_ ? old_.hash_of(key) : hash_value;
+    }
+
+    // Buckets of old_ that may still hold elements.
+    size_type old_live_buckets() const {
+        if (!rehashing_ || old_.empty()) {
+            return 0;
+        }
+        return static_cast<size_type>(old_.steal_position()) + 1;
+    }
+
+    template<typename Rng, typename Fn>
+    size_type sample_buckets(size_type n, Rng& rng, Fn&& fn) {
+        size_type count = std::min(n, size());
+        if (count == 0) {
+            return 0;
+        }
+        fixed_map_type* tables[2] = {&current_, &old_};
+        size_type bucket_counts[2] = {current_.get_bucket_count(), old_live_buckets()};
+        size_type num_tables = bucket_counts[1] > 0 ? 2 : 1;
+        size_type mask = round_up_to_power_of_two(std::max(bucket_counts[0], bucket_counts[1])) - 1;
+        std::uniform_int_distribution<size_type> pick_bucket(0, mask);
+
+        size_type index = pick_bucket(rng);
+        size_type stored = 0;
+        size_type empty_run = 0;
+        size_type max_steps = count * 10;
+        while (stored < count && max_steps-- > 0) {
+            for (size_type which = 0; which < num_tables; which++) {
+                if (index >= bucket_counts[which]) {
+                    continue;
+                }
+                size_type chain = tables[which]->bucket_size(index);
+                if (chain == 0) {
+                    // Jump elsewhere after a run of empty buckets.
+                    empty_run++;
+                    if (empty_run >= 5 && empty_run > count) {
+                        index = pick_bucket(rng);
+                        empty_run = 0;
+                    }
+                    continue;
+                }
+                empty_run = 0;
+                auto it = tables[which]->bucket_iterator(index, 0);
+                for (size_type i = 0; i < chain; i++, ++it) {
+                    fn(new_iterator(static_cast<int>(which), it, k_iter_valid));
+                    if (++stored == count) {
+                        return stored;
+                    }
+                }
+            }
+            index = (index + 1) & mask;
+        }
+        return stored;
+    }
+
+    template<typename Self, typename Fn>
+    static size_type scan_impl(Self& self, size_type cursor, Fn& fn, size_type count) {
+        size_type visited = 0;
+        size_type max_buckets = count * 10;
+        scan_all<Fn> all{fn};
+        do {
+            cursor = scan_step(self, cursor, all, visited);
+        } while (cursor != 0 && visited < count && --max_buckets > 0);
+        return cursor;
+    }
+
+    template<typename Self, typename Fn>
+    static bool scan_range_impl(Self& self, range_cursor& cursor, Fn& fn, size_type count) {
+        size_type visited = 0;
+        size_type max_buckets = count * 10;
+        while (!cursor.finished() && visited < count && max_buckets-- > 0) {
+            size_type v = cursor.position();
+            // The smaller table's bucket spans every bucket visited by this
+            // step; only filter by hash if that span crosses a range boundary.
+            size_type mask = self.current_.get_bucket_count() - 1;
+            if (self.rehashing_) {
+                mask = std::min(mask, self.old_.get_bucket_count() - 1);
+            }
+            size_type span_first = reverse_bits(v & mask);
+            size_type span_last = span_first | ~reverse_bits(mask);
+            if (span_first >= cursor.first() && span_last <= cursor.last()) {
+                scan_all<Fn> all{fn};
+                cursor.advance(scan_step(self, v, all, visited));
+            } else {
+                range_filter<Fn> filtered{cursor, fn};
+                cursor.advance(scan_step(self, v, filtered, visited));
+            }
+        }
+        return cursor.finished();
+    }
+
+    // Passes every element a scan step visits to fn.
+    template<typename Fn>
+    struct scan_all {
+        Fn& fn;
+
+        template<typename V>
+        void operator()(const fixed_map_type&, V& kv) {
+            fn(kv);
+        }
+    };
+
+    // Passes the elements of a range cursor's slice to fn. An element's
+    // slice follows its hash in the table that holds it, which is also what
+    // placed it in the buckets the cursor walks: while a reseed is under
+    // way old_ still hashes with the previous key.
+    template<typename Fn>
+    struct range_filter {
+        const range_cursor& cursor;
+        Fn& fn;
+
+        template<typename V>
+        void operator()(const fixed_map_type& table, V& kv) {
+            if (cursor.contains_hash(table.hash_of(kv.first))) {
+                fn(kv);
+            }
+        }
+    };
+
+    // Visit the buckets of one cursor position and return the next cursor.
+    // The cursor is incremented in reverse bit order, so buckets that share
+    // the low bits of a smaller table are visited together, and positions
+    // already returned stay covered whatever table size comes next (see
+    // Redis dictScan()).
+    template<typename Fn>
+    struct scan_visitor {
+        Fn& fn;
+        const fixed_map_type& table;
+        size_type& visited;
+
+        template<typename V>
+        void operator()(V& kv) {
+            fn(table, kv);
+            visited++;
+        }
+    };
+
+    template<typename Self, typename Fn>
+    static size_type scan_step(Self& self, size_type v, Fn& fn, size_type& visited) {
+        if (!self.rehashing_) {
+            size_type m0 = self.current_.get_bucket_count() - 1;
+            scan_visitor<Fn> visit{fn, self.current_, visited};
+            self.current_.for_each_in_bucket(v & m0, visit);
+            v |= ~m0;
+            v = reverse_bits(v);
+            v++;
+            return reverse_bits(v);
+        }
+
+        bool current_is_smaller = self.current_.get_bucket_count() <= self.old_.get_bucket_count();
+        auto& t0 = current_is_smaller ? self.current_ : self.old_;
+        auto& t1 = current_is_smaller ? self.old_ : self.current_;
+        size_type m0 = t0.get_bucket_count() - 1;
+        size_type m1 = t1.get_bucket_count() - 1;
+
+        scan_visitor<Fn> visit0{fn, t0, visited};
+        scan_visitor<Fn> visit1{fn, t1, visited};
+
+        t0.for_each_in_bucket(v & m0, visit0);
+        // Visit every bucket of the larger table that expands the smaller one's bucket.
+        do {
+            t1.for_each_in_bucket(v & m1, visit1);
+            v |= ~m1;
+            v = reverse_bits(v);
+            v++;
+            v = reverse_bits(v);
+        } while (v & (m0 ^ m1));
+        return v;
     }
 
     void move_progressively() {
-        if (!rehashing_) {
+        if (!rehashing_ || pause_rehash_ > 0 || (reseeding_ && scan_guards_ > 0)) {
             return;
         }
 
+        event_time start;
+        if (listener_) {
+            start = std::chrono::steady_clock::now();
+        }
         auto elements = old_.steal_elements(k_num_items_to_steal);
         if (elements.empty() && old_.empty()) {
             rehashing_ = false;
@@ -471,9 +1180,20 @@ private:
             return;
         }
 
+        SMOOTH_COUNT(k_counter_migration_steps);
         for (auto& element : elements) {
            current_.insert(std::move(element));
         }
+        SMOOTH_PROBE2(rehash__step, elements.size(), old_live_buckets());
+        if (listener_ && !elements.empty()) {
+            rehash_step_event event;
+            event.time = std::chrono::steady_clock::now();
+            event.moved = elements.size();
+            event.buckets_left = old_live_buckets();
+            event.duration_ns = nanos_between(start, event.time);
+            rehash_steps_++;
+            listener_->on_rehash_step(event);
+        }
     }
 
     iterator new_iterator(int which, typename fixed_map_type::iterator it, bool end)  {
@@ -488,6 +1208,16 @@ private:
     fixed_hashmap<Key, Mapped, Hash> current_;  // Current container
     fixed_hashmap<Key, Mapped, Hash> old_;     // Old container
     bool rehashing_;
+    size_type pause_rehash_;  // Number of live safe iterators
+    size_type scan_guards_;   // Number of live scan_guards
+    bool lookup_filter_;      // Tables get a lookup filter
+    bool reseeding_;          // old_ still uses the previous hash key
+    size_type reseed_count_;
+    size_type next_reseed_size_;  // Size the map must reach before reseeding again
+    map_event_listener* listener_;  // Not owned; null unless set
+    rehash_kind rehash_kind_;       // Of the current or last rehash
+    event_time rehash_started_;
+    size_type rehash_steps_;        // Steps reported to listener_ since then
 };
 
 }; // namespace smooth
\ No newline at end of file
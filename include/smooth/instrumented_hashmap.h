@@ -0,0 +1,161 @@
+// Copyright (c) 2024 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <utility>
+#include "hashmap.h"
+#include "latency.h"
+
+namespace smooth {
+
+enum latency_op {
+    k_op_find,
+    k_op_contains,
+    k_op_insert,
+    k_op_erase,
+    k_op_at,
+    k_num_latency_ops
+};
+
+inline const char *latency_op_name(latency_op op) {
+    static const char *const names[k_num_latency_ops] = {"find", "contains", "insert", "erase", "at"};
+    return names[op];
+}
+
+// Operations between two tsc_clock::calibrate() calls.
+const uint64_t k_latency_calibration_ops = 1 << 16;
+
+// A hashmap that times each operation into a latency_histogram per
+// operation type and rehash state, to check what incremental rehashing
+// costs the tail. An operation is filed under the state it started in.
+// Timing adds two time stamp reads per operation; everything not wrapped
+// here is reachable through map().
+template<typename Key, typename Mapped, typename Hash = keyed_hash<Key>>
+class instrumented_hashmap {
+public:
+    using map_type = hashmap<Key, Mapped, Hash>;
+    using iterator = typename map_type::iterator;
+    using const_iterator = typename map_type::const_iterator;
+    using size_type = typename map_type::size_type;
+
+    explicit instrumented_hashmap(int initial_size = 10, const Hash &hash = Hash())
+            : map_(initial_size, hash), ops_(0) {}
+
+    template<typename P>
+    std::pair<iterator, bool> insert(P &&kv) {
+        timer t(*this, k_op_insert);
+        return map_.insert(std::forward<P>(kv));
+    }
+
+    template<typename P>
+    std::pair<iterator, bool> emplace(P &&kv) {
+        timer t(*this, k_op_insert);
+        return map_.emplace(std::forward<P>(kv));
+    }
+
+    iterator find(const Key &key) {
+        timer t(*this, k_op_find);
+        return map_.find(key);
+    }
+
+    bool contains(const Key &key) {
+        timer t(*this, k_op_contains);
+        return map_.contains(key);
+    }
+
+    size_type erase(const Key &key) {
+        timer t(*this, k_op_erase);
+        return map_.erase(key);
+    }
+
+    Mapped &at(const Key &key) {
+        timer t(*this, k_op_at);
+        return map_.at(key);
+    }
+
+    Mapped &operator[](const Key &key) { return at(key); }
+
+    iterator begin() { return map_.begin(); }
+    iterator end() { return map_.end(); }
+    size_type size() const { return map_.size(); }
+
+    map_type &map() { return map_; }
+    const map_type &map() const { return map_; }
+
+    // Latencies in clock ticks; convert with clock().to_nanos().
+    const latency_histogram &histogram(latency_op op, bool rehashing) const {
+        return histograms_[op][rehashing ? 1 : 0];
+    }
+
+    // Latency in nanoseconds that fraction p of the operations of this type
+    // and rehash state stayed within, e.g. 0.999 for p99.9.
+    uint64_t percentile_ns(latency_op op, bool rehashing, double p) const {
+        return clock_.to_nanos(histogram(op, rehashing).percentile(p));
+    }
+
+    const tsc_clock &clock() const { return clock_; }
+
+    void reset_latencies() {
+        for (size_t op = 0; op < k_num_latency_ops; op++) {
+            histograms_[op][0].reset();
+            histograms_[op][1].reset();
+        }
+    }
+
+    // One line per operation type and rehash state that has samples:
+    // count, mean, p50, p99, p99.9 and max, in nanoseconds.
+    std::string dump() const {
+        std::string out;
+        char buf[192];
+        for (size_t op = 0; op < k_num_latency_ops; op++) {
+            for (int rehashing = 0; rehashing < 2; rehashing++) {
+                const latency_histogram &h = histograms_[op][rehashing];
+                if (h.count() == 0) {
+                    continue;
+                }
+                std::snprintf(buf, sizeof(buf),
+                              "%s%s: count=%llu mean=%.1fns p50=%lluns p99=%lluns p99.9=%lluns max=%lluns\n",
+                              latency_op_name(static_cast<latency_op>(op)), rehashing ? " (rehashing)" : "",
+                              static_cast<unsigned long long>(h.count()), h.mean() * clock_.ns_per_tick(),
+                              static_cast<unsigned long long>(clock_.to_nanos(h.percentile(0.5))),
+                              static_cast<unsigned long long>(clock_.to_nanos(h.percentile(0.99))),
+                              static_cast<unsigned long long>(clock_.to_nanos(h.percentile(0.999))),
+                              static_cast<unsigned long long>(clock_.to_nanos(h.max())));
+                out += buf;
+            }
+        }
+        return out;
+    }
+
+private:
+    class timer {
+    public:
+        timer(instrumented_hashmap &owner, latency_op op)
+                : owner_(owner), op_(op), rehashing_(owner.map_.is_rehashing()), start_(tsc_clock::now()) {}
+
+        ~timer() {
+            uint64_t end = tsc_clock::now();
+            owner_.histograms_[op_][rehashing_ ? 1 : 0].record(end > start_ ? end - start_ : 0);
+            if (++owner_.ops_ % k_latency_calibration_ops == 0) {
+                owner_.clock_.calibrate();
+            }
+        }
+
+    private:
+        instrumented_hashmap &owner_;
+        latency_op op_;
+        bool rehashing_;
+        uint64_t start_;
+    };
+
+    map_type map_;
+    latency_histogram histograms_[k_num_latency_ops][2];
+    tsc_clock clock_;
+    uint64_t ops_;
+};
+
+}  // namespace smooth
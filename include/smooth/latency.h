@@ -0,0 +1,203 @@
+// Copyright (c) 2024 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define SMOOTH_HAVE_RDTSC 1
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#define SMOOTH_HAVE_RDTSC 1
+#endif
+
+namespace smooth {
+
+// Values below 2^k_latency_sub_bucket_bits get a bucket each; above that
+// every power of two is split into 2^(k_latency_sub_bucket_bits - 1)
+// buckets, so a recorded value is known to within about 6%.
+const size_t k_latency_sub_bucket_bits = 5;
+const size_t k_latency_half_count = size_t(1) << (k_latency_sub_bucket_bits - 1);
+const size_t k_latency_buckets = (64 - k_latency_sub_bucket_bits + 2) * k_latency_half_count;
+
+inline size_t floor_log2(uint64_t value) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return index;
+#else
+    return 63 - static_cast<size_t>(__builtin_clzll(value));
+#endif
+}
+
+// Log-linear histogram of non-negative values, as HdrHistogram. Fixed size
+// (about 8 KB), recording is a few instructions and never allocates.
+class latency_histogram {
+public:
+    latency_histogram() : counts_(k_latency_buckets, 0), total_(0), max_(0), sum_(0) {}
+
+    void record(uint64_t value) {
+        counts_[bucket_of(value)]++;
+        total_++;
+        sum_ += value;
+        if (value > max_) {
+            max_ = value;
+        }
+    }
+
+    uint64_t count() const { return total_; }
+
+    uint64_t max() const { return max_; }
+
+    double mean() const { return total_ == 0 ? 0.0 : static_cast<double>(sum_) / total_; }
+
+    // The value that fraction p (0 to 1) of the recorded values are at or
+    // below. Reports the top of its bucket, so it overstates by at most the
+    // bucket width, but never exceeds max().
+    uint64_t percentile(double p) const {
+        if (total_ == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(p * total_ + 0.5);
+        if (rank < 1) {
+            rank = 1;
+        }
+        if (rank > total_) {
+            rank = total_;
+        }
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); i++) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                uint64_t top = bucket_top(i);
+                return top < max_ ? top : max_;
+            }
+        }
+        return max_;
+    }
+
+    void merge(const latency_histogram &other) {
+        for (size_t i = 0; i < counts_.size(); i++) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        sum_ += other.sum_;
+        if (other.max_ > max_) {
+            max_ = other.max_;
+        }
+    }
+
+    void reset() {
+        std::fill(counts_.begin(), counts_.end(), 0);
+        total_ = 0;
+        max_ = 0;
+        sum_ = 0;
+    }
+
+    static size_t bucket_of(uint64_t value) {
+        if (value < (uint64_t(1) << k_latency_sub_bucket_bits)) {
+            return static_cast<size_t>(value);
+        }
+        size_t shift = floor_log2(value) - k_latency_sub_bucket_bits + 1;
+        return shift * k_latency_half_count + static_cast<size_t>(value >> shift);
+    }
+
+    // Largest value that falls in bucket index.
+    static uint64_t bucket_top(size_t index) {
+        if (index < (size_t(1) << k_latency_sub_bucket_bits)) {
+            return index;
+        }
+        size_t shift = index / k_latency_half_count - 1;
+        uint64_t mantissa = index % k_latency_half_count + k_latency_half_count;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+private:
+    std::vector<uint64_t> counts_;
+    uint64_t total_;
+    uint64_t max_;
+    uint64_t sum_;
+};
+
+// Shortest interval tsc_clock::calibrate() measures the tick rate over.
+const int64_t k_tsc_calibration_ms = 1000;
+
+// Cheap timestamps for per-operation timing: the time stamp counter where
+// there is one, else steady_clock nanoseconds. Ticks are converted to
+// nanoseconds with a rate measured against steady_clock and refreshed by
+// calibrate(), so it follows frequency changes on machines without an
+// invariant TSC.
+class tsc_clock {
+public:
+    tsc_clock() : anchor_ticks_(now()), anchor_time_(steady_now()), ns_per_tick_(1.0) {
+#ifdef SMOOTH_HAVE_RDTSC
+        // Measure an initial rate over about a millisecond.
+        uint64_t start_ticks = anchor_ticks_;
+        std::chrono::steady_clock::time_point start_time = anchor_time_;
+        std::chrono::steady_clock::time_point end_time;
+        do {
+            end_time = steady_now();
+        } while (end_time - start_time < std::chrono::milliseconds(1));
+        uint64_t end_ticks = now();
+        if (end_ticks > start_ticks) {
+            ns_per_tick_ = nanos_between(start_time, end_time) / static_cast<double>(end_ticks - start_ticks);
+        }
+        anchor_ticks_ = end_ticks;
+        anchor_time_ = end_time;
+#endif
+    }
+
+    static uint64_t now() {
+#ifdef SMOOTH_HAVE_RDTSC
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                steady_now().time_since_epoch()).count());
+#endif
+    }
+
+    // Re-measure the tick rate over the time since the last calibration,
+    // if that is long enough to be accurate. Cheap enough to call every few
+    // thousand operations.
+    void calibrate() {
+#ifdef SMOOTH_HAVE_RDTSC
+        std::chrono::steady_clock::time_point time = steady_now();
+        if (time - anchor_time_ < std::chrono::milliseconds(k_tsc_calibration_ms)) {
+            return;
+        }
+        uint64_t ticks = now();
+        if (ticks > anchor_ticks_) {
+            ns_per_tick_ = nanos_between(anchor_time_, time) / static_cast<double>(ticks - anchor_ticks_);
+        }
+        anchor_ticks_ = ticks;
+        anchor_time_ = time;
+#endif
+    }
+
+    double ns_per_tick() const { return ns_per_tick_; }
+
+    uint64_t to_nanos(uint64_t ticks) const {
+        return static_cast<uint64_t>(ticks * ns_per_tick_ + 0.5);
+    }
+
+private:
+    static std::chrono::steady_clock::time_point steady_now() {
+        return std::chrono::steady_clock::now();
+    }
+
+    static double nanos_between(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b) {
+        return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(b - a).count());
+    }
+
+    uint64_t anchor_ticks_;
+    std::chrono::steady_clock::time_point anchor_time_;
+    double ns_per_tick_;
+};
+
+}  // namespace smooth
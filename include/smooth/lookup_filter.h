@@ -0,0 +1,114 @@
+// Copyright (c) 2024 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include "hash.h"
+#include "mmap_array.h"
+
+namespace smooth {
+
+// A block is one 64-byte cache line of 128 four-bit counters.
+const size_t k_filter_block_words = 8;
+const size_t k_filter_counters_per_block = 128;
+const size_t k_filter_probes = 4;
+
+// Counters reserved per table bucket. At hashmap's maximum load factor of
+// 3/4 that is about 13 per element, a false positive rate near 1%.
+const size_t k_filter_counters_per_bucket = 10;
+
+const uint64_t k_filter_counter_max = 15;
+
+// Counting Bloom filter blocked to a cache line, so a lookup touches one
+// line. Counters make remove() possible; a counter that reaches 15 sticks
+// there, since its true count is no longer known, which can only cost
+// false positives. may_contain() never returns false for an added hash.
+class counting_bloom_filter {
+public:
+    // Sized for a table of bucket_count buckets.
+    explicit counting_bloom_filter(size_t bucket_count)
+            : num_blocks_(block_count(bucket_count)),
+              words_(num_blocks_ * k_filter_block_words) {}
+
+    void add(size_t hash_value) {
+        uint64_t h = remix(hash_value);
+        uint64_t *block = block_of(h);
+        for (size_t i = 0; i < k_filter_probes; i++) {
+            size_t counter = probe(h, i);
+            uint64_t &word = block[counter >> 4];
+            size_t shift = (counter & 15) * 4;
+            if (((word >> shift) & 15) != k_filter_counter_max) {
+                word += uint64_t(1) << shift;
+            }
+        }
+    }
+
+    void remove(size_t hash_value) {
+        uint64_t h = remix(hash_value);
+        uint64_t *block = block_of(h);
+        for (size_t i = 0; i < k_filter_probes; i++) {
+            size_t counter = probe(h, i);
+            uint64_t &word = block[counter >> 4];
+            size_t shift = (counter & 15) * 4;
+            uint64_t value = (word >> shift) & 15;
+            if (value != 0 && value != k_filter_counter_max) {
+                word -= uint64_t(1) << shift;
+            }
+        }
+    }
+
+    // False means no element with this hash was added.
+    bool may_contain(size_t hash_value) const {
+        uint64_t h = remix(hash_value);
+        const uint64_t *block = block_of(h);
+        for (size_t i = 0; i < k_filter_probes; i++) {
+            size_t counter = probe(h, i);
+            if (((block[counter >> 4] >> ((counter & 15) * 4)) & 15) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void clear() {
+        for (size_t i = 0; i < words_.size(); i++) {
+            words_[i] = 0;
+        }
+    }
+
+    size_t memory_bytes() const { return words_.size() * sizeof(uint64_t); }
+
+private:
+    static size_t block_count(size_t bucket_count) {
+        size_t blocks = (bucket_count * k_filter_counters_per_bucket + k_filter_counters_per_block - 1) /
+                        k_filter_counters_per_block;
+        return blocks > 0 ? blocks : 1;
+    }
+
+    // Bucket indexes use the low bits of the hash; remix so the filter's
+    // bits are independent of them.
+    static uint64_t remix(size_t hash_value) {
+        return hash_mix64(static_cast<uint64_t>(hash_value));
+    }
+
+    // The high half picks the block, seven-bit fields of the low half the
+    // counters in it.
+    static size_t probe(uint64_t h, size_t i) {
+        return static_cast<size_t>((h >> (7 * i)) & (k_filter_counters_per_block - 1));
+    }
+
+    uint64_t *block_of(uint64_t h) {
+        return words_.data() + ((h >> 32) * num_blocks_ >> 32) * k_filter_block_words;
+    }
+
+    const uint64_t *block_of(uint64_t h) const {
+        return words_.data() + ((h >> 32) * num_blocks_ >> 32) * k_filter_block_words;
+    }
+
+    size_t num_blocks_;
+    mmap_array<uint64_t> words_;
+};
+
+}  // namespace smooth
@@ -0,0 +1,81 @@
+// Copyright (c) 2024 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace smooth {
+
+enum rehash_kind {
+    k_rehash_grow,
+    k_rehash_shrink,
+    k_rehash_reseed,  // Same size, new hash key after a collision attack
+};
+
+inline const char *rehash_kind_name(rehash_kind kind) {
+    static const char *const names[] = {"grow", "shrink", "reseed"};
+    return names[kind];
+}
+
+typedef std::chrono::steady_clock::time_point event_time;
+
+// A hashmap started migrating into a new table.
+struct rehash_start_event {
+    rehash_kind kind;
+    event_time time;
+    size_t size;               // Elements in the map
+    size_t old_bucket_count;
+    size_t new_bucket_count;
+};
+
+// One move_progressively() call that migrated elements.
+struct rehash_step_event {
+    event_time time;
+    size_t moved;              // Elements moved by this step
+    size_t buckets_left;       // Old buckets that may still hold elements
+    uint64_t duration_ns;      // Time the step took
+};
+
+// The old table is empty and has been released.
+struct rehash_finish_event {
+    rehash_kind kind;
+    event_time time;
+    size_t size;
+    size_t bucket_count;
+    size_t steps;              // Steps reported since the start
+    uint64_t duration_ns;      // Time since the start, including time between steps
+};
+
+// A bucket turned into a tree or back into a list. Erasing the last node of
+// a tree bucket also turns it back, with a chain_length of 0.
+struct treefy_event {
+    event_time time;
+    size_t bucket;             // Index in its table
+    size_t bucket_count;       // Buckets in that table
+    size_t chain_length;       // Elements in the bucket afterwards
+};
+
+// Callbacks for the moments a hashmap changes shape, for tracing systems
+// that want to line request latency up with resizing. Override the events
+// of interest. Callbacks run synchronously inside the map operation that
+// caused them and must not modify the map.
+class map_event_listener {
+public:
+    virtual ~map_event_listener() = default;
+
+    virtual void on_rehash_start(const rehash_start_event &) {}
+    virtual void on_rehash_step(const rehash_step_event &) {}
+    virtual void on_rehash_finish(const rehash_finish_event &) {}
+    virtual void on_treefy(const treefy_event &) {}
+    virtual void on_un_treefy(const treefy_event &) {}
+};
+
+inline uint64_t nanos_between(event_time start, event_time end) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+}  // namespace smooth
@@ -0,0 +1,98 @@
+// Copyright (c) 2024 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+
+namespace smooth {
+
+// Heap bytes owned by a value outside its own object, for memory_usage().
+// Zero unless specialized; specialize it for key or mapped types that own
+// heap memory:
+//
+//   template<> struct heap_usage<my_blob> {
+//       size_t operator()(const my_blob &b) const { return b.capacity(); }
+//   };
+template<typename T>
+struct heap_usage {
+    size_t operator()(const T &) const { return 0; }
+};
+
+// Strings own heap memory only once they outgrow the small-string buffer,
+// which lies inside the object.
+template<typename CharT, typename Traits, typename Alloc>
+struct heap_usage<std::basic_string<CharT, Traits, Alloc>> {
+    size_t operator()(const std::basic_string<CharT, Traits, Alloc> &s) const {
+        const char *data = reinterpret_cast<const char *>(s.data());
+        const char *object = reinterpret_cast<const char *>(&s);
+        if (data >= object && data < object + sizeof(s)) {
+            return 0;
+        }
+        return (s.capacity() + 1) * sizeof(CharT);
+    }
+};
+
+template<typename First, typename Second>
+struct heap_usage<std::pair<First, Second>> {
+    size_t operator()(const std::pair<First, Second> &p) const {
+        return heap_usage<First>()(p.first) + heap_usage<Second>()(p.second);
+    }
+};
+
+// Bytes held by a map, by component. Node and payload figures are what was
+// requested from the allocator; its per-allocation overhead is not
+// included. Mapped arrays are counted in whole pages.
+struct memory_breakdown {
+    size_t object_bytes = 0;        // The map objects themselves
+    // Bucket arrays and their occupancy bitmaps, split by whether they were
+    // small enough (below k_threshold_for_mmap) to come from the heap.
+    size_t bucket_heap_bytes = 0;
+    size_t bucket_mmap_bytes = 0;
+    size_t list_node_bytes = 0;
+    size_t tree_node_bytes = 0;
+    size_t payload_bytes = 0;       // heap_usage<> of keys and values
+    size_t filter_bytes = 0;        // Lookup filters, if enabled
+    size_t list_nodes = 0;
+    size_t tree_nodes = 0;
+
+    size_t total() const {
+        return object_bytes + bucket_heap_bytes + bucket_mmap_bytes + list_node_bytes + tree_node_bytes +
+               payload_bytes + filter_bytes;
+    }
+
+    memory_breakdown &operator+=(const memory_breakdown &other) {
+        object_bytes += other.object_bytes;
+        bucket_heap_bytes += other.bucket_heap_bytes;
+        bucket_mmap_bytes += other.bucket_mmap_bytes;
+        list_node_bytes += other.list_node_bytes;
+        tree_node_bytes += other.tree_node_bytes;
+        payload_bytes += other.payload_bytes;
+        filter_bytes += other.filter_bytes;
+        list_nodes += other.list_nodes;
+        tree_nodes += other.tree_nodes;
+        return *this;
+    }
+
+    std::string dump() const {
+        char buf[512];
+        std::snprintf(buf, sizeof(buf),
+                      "total: %zu\n"
+                      " objects: %zu\n"
+                      " bucket arrays (heap): %zu\n"
+                      " bucket arrays (mmap): %zu\n"
+                      " list nodes: %zu (%zu nodes)\n"
+                      " tree nodes: %zu (%zu nodes)\n"
+                      " key/value payload: %zu\n"
+                      " lookup filters: %zu\n",
+                      total(), object_bytes, bucket_heap_bytes, bucket_mmap_bytes, list_node_bytes, list_nodes,
+                      tree_node_bytes, tree_nodes, payload_bytes, filter_bytes);
+        return buf;
+    }
+};
+
+}  // namespace smooth
@@ -6,6 +6,7 @@
 
 #include <stdexcept>
 #include <cstring>
+#include "probes.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -57,6 +58,17 @@ int platform_munmap(void* addr, size_t len) {
 
 #endif
 
+inline size_t platform_page_size() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return static_cast<size_t>(info.dwPageSize);
+#else
+    static const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return page;
+#endif
+}
+
 const size_t k_threshold_for_mmap = 4096;
 
 template <typename T>
@@ -78,6 +90,7 @@ public:
         if (data_ == reinterpret_cast<void*>(-1)) {
           throw std::runtime_error("Error mapping memory");
         }
+        SMOOTH_PROBE2(mmap__map, data_, size_in_bytes);
       }
     }
 
@@ -92,6 +105,7 @@ public:
             char* ptr = reinterpret_cast<char*>(data_);
             delete [] ptr;
         } else {
+          SMOOTH_PROBE2(mmap__unmap, data_, size_in_bytes);
           if (platform_munmap(data_, size_in_bytes) == -1) {
             assert(0);
           }
@@ -128,8 +142,22 @@ public:
     }
 
     T* data() { return data_; }
+    const T* data() const { return data_; }
     size_t size() const { return size_; }
 
+    // Whether the elements live in an anonymous mapping rather than on the heap.
+    bool mapped() const { return size_ * sizeof(T) >= k_threshold_for_mmap; }
+
+    // Bytes allocated for the elements; mappings take whole pages.
+    size_t reserved_bytes() const {
+      size_t size_in_bytes = size_ * sizeof(T);
+      if (!mapped()) {
+        return size_in_bytes;
+      }
+      size_t page = platform_page_size();
+      return (size_in_bytes + page - 1) / page * page;
+    }
+
     // Access element at a specific index (non-const)
     T& at(size_t index) {
       if (index >= size_) {
@@ -0,0 +1,135 @@
+// Copyright (c) 2024 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include "mmap_array.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace smooth {
+
+inline size_t count_trailing_zeros(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return index;
+#else
+    return static_cast<size_t>(__builtin_ctzll(word));
+#endif
+}
+
+inline size_t population_count(uint64_t word) {
+#ifdef _MSC_VER
+    return static_cast<size_t>(__popcnt64(word));
+#else
+    return static_cast<size_t>(__builtin_popcountll(word));
+#endif
+}
+
+// Words checked together when skipping long runs of empty buckets. Eight
+// words cover 512 buckets and fit in one cache line.
+const size_t k_bitmap_skip_words = 8;
+
+// One bit per bucket, set while the bucket is non-empty, so iteration can
+// jump over empty buckets a word (or a cache line) at a time.
+class occupancy_bitmap {
+public:
+    occupancy_bitmap() : size_(0) {}
+
+    explicit occupancy_bitmap(size_t size) : words_((size + 63) / 64), size_(size) {}
+
+    occupancy_bitmap(occupancy_bitmap &&other) noexcept
+            : words_(std::move(other.words_)), size_(other.size_) {
+        other.size_ = 0;
+    }
+
+    occupancy_bitmap &operator=(occupancy_bitmap &&other) noexcept {
+        if (this != &other) {
+            words_ = std::move(other.words_);
+            size_ = other.size_;
+            other.size_ = 0;
+        }
+        return *this;
+    }
+
+    void swap(occupancy_bitmap &other) {
+        words_.swap(other.words_);
+        std::swap(size_, other.size_);
+    }
+
+    void clear() {
+        words_.clear();
+        size_ = 0;
+    }
+
+    size_t size() const { return size_; }
+
+    void set(size_t index) {
+        words_[index >> 6] |= uint64_t(1) << (index & 63);
+    }
+
+    void reset(size_t index) {
+        words_[index >> 6] &= ~(uint64_t(1) << (index & 63));
+    }
+
+    bool test(size_t index) const {
+        return (words_[index >> 6] >> (index & 63)) & 1;
+    }
+
+    // Index of the first set bit at or after index, or size() if there is none.
+    size_t find_next(size_t index) const {
+        if (index >= size_) {
+            return size_;
+        }
+        size_t num_words = words_.size();
+        size_t w = index >> 6;
+        uint64_t word = words_[w] & (~uint64_t(0) << (index & 63));
+        while (word == 0) {
+            if (++w >= num_words) {
+                return size_;
+            }
+            // Skip whole cache lines of empty buckets.
+            while (w + k_bitmap_skip_words <= num_words && all_zero(w)) {
+                w += k_bitmap_skip_words;
+            }
+            if (w >= num_words) {
+                return size_;
+            }
+            word = words_[w];
+        }
+        return (w << 6) + count_trailing_zeros(word);
+    }
+
+    bool mapped() const { return words_.mapped(); }
+
+    size_t memory_bytes() const { return words_.reserved_bytes(); }
+
+    // Number of set bits.
+    size_t count() const {
+        size_t total = 0;
+        for (size_t i = 0; i < words_.size(); i++) {
+            total += population_count(words_[i]);
+        }
+        return total;
+    }
+
+private:
+    bool all_zero(size_t w) const {
+        uint64_t any = 0;
+        for (size_t i = 0; i < k_bitmap_skip_words; i++) {
+            any |= words_[w + i];
+        }
+        return any == 0;
+    }
+
+    mmap_array<uint64_t> words_;
+    size_t size_;
+};
+
+}  // namespace smooth
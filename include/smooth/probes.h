@@ -0,0 +1,50 @@
+// Copyright (c) 2024 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+// USDT (user-level statically defined tracing) probes, compiled in with
+// SMOOTH_ENABLE_PROBES (the CMake option of the same name) where
+// <sys/sdt.h> is available. An unattached probe is a single nop and its
+// arguments are only read by the tracer. Without it the SMOOTH_PROBE macros
+// expand to nothing and their arguments are not evaluated.
+//
+// All probes are under the provider "smooth"; a double underscore in a
+// name reads as a dash to the tools, e.g.
+//
+//   bpftrace -e 'usdt:./app:smooth:rehash-start { printf("%d -> %d\n", arg2, arg3); }'
+//
+//   rehash-start     kind, size, old bucket count, new bucket count
+//   rehash-finish    kind, size, bucket count
+//   rehash-step      elements moved, old buckets left
+//   steal-elements   elements stolen, next bucket, elements left
+//   treefy           chain length
+//   un-treefy        chain length
+//   mmap-map         address, bytes
+//   mmap-unmap       address, bytes
+//
+// kind is a rehash_kind: 0 grow, 1 shrink, 2 reseed.
+
+#if defined(SMOOTH_ENABLE_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SMOOTH_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef SMOOTH_HAVE_PROBES
+
+#define SMOOTH_PROBE1(name, a) DTRACE_PROBE1(smooth, name, a)
+#define SMOOTH_PROBE2(name, a, b) DTRACE_PROBE2(smooth, name, a, b)
+#define SMOOTH_PROBE3(name, a, b, c) DTRACE_PROBE3(smooth, name, a, b, c)
+#define SMOOTH_PROBE4(name, a, b, c, d) DTRACE_PROBE4(smooth, name, a, b, c, d)
+
+#else
+
+#define SMOOTH_PROBE1(name, a) ((void)0)
+#define SMOOTH_PROBE2(name, a, b) ((void)0)
+#define SMOOTH_PROBE3(name, a, b, c) ((void)0)
+#define SMOOTH_PROBE4(name, a, b, c, d) ((void)0)
+
+#endif  // SMOOTH_HAVE_PROBES
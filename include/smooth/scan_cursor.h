@@ -0,0 +1,130 @@
+// Copyright (c) 2024 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cinttypes>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace smooth {
+
+// Reverse the bits of a scan cursor.
+inline size_t reverse_bits(size_t v) {
+    size_t result = 0;
+    for (size_t i = 0; i < sizeof(size_t) * 8; i++) {
+        result = (result << 1) | (v & 1);
+        v >>= 1;
+    }
+    return result;
+}
+
+// A resumable slice of a hashmap scan.
+//
+// scan() cursors advance through the bit-reversed hash space, so a slice is
+// the range [first, last] of bit-reversed hashes. Elements are assigned to
+// slices by their own hash rather than their bucket index, which keeps the
+// slices disjoint whatever the table size, and lets a slice be resumed after
+// the map grows, shrinks or migrates.
+class range_cursor {
+public:
+    range_cursor(size_t first, size_t last)
+            : first_(first), last_(last), position_(reverse_bits(first)), finished_(false) {
+        if (first > last) {
+            throw std::invalid_argument("range_cursor: first is after last");
+        }
+    }
+
+    size_t first() const { return first_; }
+    size_t last() const { return last_; }
+
+    // The scan() cursor to resume from.
+    size_t position() const { return position_; }
+
+    bool finished() const { return finished_; }
+
+    // Whether an element with this hash belongs to the slice.
+    bool contains_hash(size_t hash) const {
+        size_t r = reverse_bits(hash);
+        return r >= first_ && r <= last_;
+    }
+
+    // Record the cursor returned by a scan step.
+    void advance(size_t next) {
+        if (next == 0 || reverse_bits(next) > last_) {
+            finished_ = true;
+        } else {
+            position_ = next;
+        }
+    }
+
+    // Text form that can be stored or sent to another process and read back
+    // with deserialize().
+    std::string serialize() const {
+        char buf[96];
+        std::snprintf(buf, sizeof(buf), "rc1:%016" PRIx64 ":%016" PRIx64 ":%016" PRIx64 ":%d",
+                      static_cast<uint64_t>(first_), static_cast<uint64_t>(last_),
+                      static_cast<uint64_t>(position_), finished_ ? 1 : 0);
+        return std::string(buf);
+    }
+
+    static range_cursor deserialize(const std::string &text) {
+        uint64_t first, last, position;
+        int finished;
+        char tail;
+        if (std::sscanf(text.c_str(), "rc1:%16" SCNx64 ":%16" SCNx64 ":%16" SCNx64 ":%d%c",
+                        &first, &last, &position, &finished, &tail) != 4 ||
+            (finished != 0 && finished != 1) || first > last ||
+            first > std::numeric_limits<size_t>::max() || last > std::numeric_limits<size_t>::max()) {
+            throw std::invalid_argument("range_cursor: malformed cursor '" + text + "'");
+        }
+        range_cursor cursor(static_cast<size_t>(first), static_cast<size_t>(last));
+        size_t r = reverse_bits(static_cast<size_t>(position));
+        if (r < cursor.first_ || r > cursor.last_) {
+            throw std::invalid_argument("range_cursor: position outside range in '" + text + "'");
+        }
+        cursor.position_ = static_cast<size_t>(position);
+        cursor.finished_ = finished == 1;
+        return cursor;
+    }
+
+private:
+    size_t first_;
+    size_t last_;
+    size_t position_;
+    bool finished_;
+};
+
+// Split the whole scan space into count disjoint range cursors of nearly
+// equal size. Together they visit every element of the map.
+inline std::vector<range_cursor> split_range_cursors(size_t count) {
+    if (count == 0) {
+        throw std::invalid_argument("split_range_cursors: count must be positive");
+    }
+    // The space holds max + 1 values: count ranges of step, the first
+    // extra of them one longer.
+    const size_t max = std::numeric_limits<size_t>::max();
+    size_t step = max / count;
+    size_t extra = max % count + 1;
+    if (extra == count) {
+        step++;
+        extra = 0;
+    }
+    std::vector<range_cursor> cursors;
+    cursors.reserve(count);
+    size_t first = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t length = step + (i < extra ? 1 : 0);
+        size_t last = i + 1 == count ? max : first + length - 1;
+        cursors.emplace_back(first, last);
+        first = last + 1;
+    }
+    return cursors;
+}
+
+}  // namespace smooth
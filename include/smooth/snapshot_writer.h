@@ -0,0 +1,777 @@
+// Copyright (c) 2024 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#ifdef _WIN32
+#error "snapshot_writer.h requires POSIX file I/O"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef SMOOTH_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+namespace smooth {
+
+// On-disk layout:
+//   header  : magic[8] "SMOOTHSN", u32 version, u32 reserved
+//   records : u32 key_len, key bytes, u32 value_len, value bytes
+//   footer  : u64 entry count, u64 record bytes, magic[8] "SMOOTHSN"
+// Integers are stored in host byte order.
+const char k_snapshot_magic[8] = {'S', 'M', 'O', 'O', 'T', 'H', 'S', 'N'};
+const uint32_t k_snapshot_version = 1;
+const size_t k_snapshot_header_size = 16;
+const size_t k_snapshot_footer_size = 24;
+
+// Buffers are aligned (and sized) to this so they can be used with O_DIRECT.
+const size_t k_snapshot_alignment = 4096;
+
+const size_t k_snapshot_buckets_per_step = 1024;
+
+// Encodes keys and values into the snapshot stream. Specialize it for types
+// that are neither trivially copyable nor std::string.
+template<typename T, typename Enable = void>
+struct snapshot_codec;
+
+template<typename T>
+struct snapshot_codec<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type> {
+    static size_t size(const T &) { return sizeof(T); }
+
+    static void encode(const T &value, char *out) { std::memcpy(out, &value, sizeof(T)); }
+
+    static bool decode(const char *in, size_t len, T *value) {
+        if (len != sizeof(T)) {
+            return false;
+        }
+        std::memcpy(value, in, sizeof(T));
+        return true;
+    }
+};
+
+template<>
+struct snapshot_codec<std::string> {
+    static size_t size(const std::string &value) { return value.size(); }
+
+    static void encode(const std::string &value, char *out) { std::memcpy(out, value.data(), value.size()); }
+
+    static bool decode(const char *in, size_t len, std::string *value) {
+        value->assign(in, len);
+        return true;
+    }
+};
+
+class snapshot_io;
+
+struct snapshot_options {
+    // Size of each ring buffer; must be a non-zero multiple of k_snapshot_alignment.
+    size_t buffer_size = 1 << 20;
+    // Number of ring buffers. Memory use is bounded by buffer_size * buffer_count.
+    size_t buffer_count = 4;
+    // Worker threads for the pwrite fallback.
+    size_t io_threads = 2;
+    // Open the file with O_DIRECT. Silently falls back to buffered I/O when
+    // the file system refuses it.
+    bool direct_io = false;
+    // Use io_uring when compiled with SMOOTH_HAVE_LIBURING and the kernel allows it.
+    bool prefer_io_uring = true;
+    // fdatasync() the file, through the write backend, before step()
+    // reports completion.
+    bool sync_on_finish = true;
+    // Write backend for the file descriptor, replacing io_uring and the
+    // pwrite pool when set, e.g. to throttle snapshot I/O.
+    std::function<std::unique_ptr<snapshot_io>(int fd, size_t depth)> io_factory;
+};
+
+// Completion-based write interface shared by the io_uring and pwrite backends.
+// Each submitted write is identified by the ring slot that owns its buffer.
+class snapshot_io {
+public:
+    virtual ~snapshot_io() = default;
+
+    virtual void submit(size_t slot, const char *data, size_t len, uint64_t offset) = 0;
+
+    // fdatasync() the file. Only submitted once every write has finished;
+    // slot is one past the ring and is reported by reap() like a write's.
+    virtual void submit_sync(size_t slot) = 0;
+
+    // Append finished slots to done. Blocks until at least one write has
+    // finished when wait is true and a write is still in flight.
+    virtual void reap(bool wait, std::vector<size_t> *done) = 0;
+};
+
+inline int snapshot_pwrite_fully(int fd, const char *data, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t ret = ::pwrite(fd, data, len, static_cast<off_t>(offset));
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        data += ret;
+        len -= static_cast<size_t>(ret);
+        offset += static_cast<uint64_t>(ret);
+    }
+    return 0;
+}
+
+// Fallback backend: a small pool of threads issuing blocking pwrite() calls.
+class snapshot_pwrite_pool : public snapshot_io {
+public:
+    snapshot_pwrite_pool(int fd, size_t num_threads)
+            : fd_(fd), in_flight_(0), error_(0), stopping_(false) {
+        num_threads = std::max<size_t>(num_threads, 1);
+        for (size_t i = 0; i < num_threads; i++) {
+            workers_.emplace_back([this]() { work(); });
+        }
+    }
+
+    ~snapshot_pwrite_pool() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        job_cv_.notify_all();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    void submit(size_t slot, const char *data, size_t len, uint64_t offset) override {
+        push(job{slot, data, len, offset, false});
+    }
+
+    void submit_sync(size_t slot) override {
+        push(job{slot, nullptr, 0, 0, true});
+    }
+
+    void reap(bool wait, std::vector<size_t> *done) override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (wait) {
+            done_cv_.wait(lock, [this]() { return !finished_.empty() || error_ != 0 || in_flight_ == 0; });
+        }
+        if (error_ != 0) {
+            throw std::system_error(error_, std::generic_category(), "snapshot write failed");
+        }
+        done->insert(done->end(), finished_.begin(), finished_.end());
+        finished_.clear();
+    }
+
+private:
+    struct job {
+        size_t slot;
+        const char *data;
+        size_t len;
+        uint64_t offset;
+        bool sync;
+    };
+
+    void push(const job &next) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_.push_back(next);
+            in_flight_++;
+        }
+        job_cv_.notify_one();
+    }
+
+    void work() {
+        for (;;) {
+            job next;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                // Pending jobs are drained before a stopping worker exits.
+                job_cv_.wait(lock, [this]() { return stopping_ || !jobs_.empty(); });
+                if (jobs_.empty()) {
+                    return;
+                }
+                next = jobs_.front();
+                jobs_.pop_front();
+            }
+
+            int err = 0;
+            if (!next.sync) {
+                err = snapshot_pwrite_fully(fd_, next.data, next.len, next.offset);
+            } else if (::fdatasync(fd_) != 0) {
+                err = errno;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (err != 0 && error_ == 0) {
+                    error_ = err;
+                }
+                finished_.push_back(next.slot);
+                in_flight_--;
+            }
+            done_cv_.notify_all();
+        }
+    }
+
+    int fd_;
+    size_t in_flight_;
+    int error_;
+    bool stopping_;
+    std::mutex mutex_;
+    std::condition_variable job_cv_;
+    std::condition_variable done_cv_;
+    std::deque<job> jobs_;
+    std::vector<size_t> finished_;
+    std::vector<std::thread> workers_;
+};
+
+#ifdef SMOOTH_HAVE_LIBURING
+
+class snapshot_uring : public snapshot_io {
+public:
+    // Returns nullptr when the kernel refuses to set up a ring.
+    static std::unique_ptr<snapshot_uring> create(int fd, size_t depth) {
+        std::unique_ptr<snapshot_uring> io(new snapshot_uring(fd, depth));
+        if (io_uring_queue_init(static_cast<unsigned>(depth), &io->ring_, 0) < 0) {
+            return nullptr;
+        }
+        io->initialized_ = true;
+        return io;
+    }
+
+    ~snapshot_uring() override {
+        if (!initialized_) {
+            return;
+        }
+        // Buffers must outlive the kernel's use of them.
+        std::vector<size_t> ignored;
+        while (in_flight_ > 0) {
+            try {
+                reap(true, &ignored);
+            } catch (...) {
+                break;
+            }
+        }
+        io_uring_queue_exit(&ring_);
+    }
+
+    void submit(size_t slot, const char *data, size_t len, uint64_t offset) override {
+        requests_[slot] = request{data, len, offset, false};
+        in_flight_++;
+        queue(slot);
+    }
+
+    void submit_sync(size_t slot) override {
+        requests_[slot] = request{nullptr, 0, 0, true};
+        in_flight_++;
+        queue(slot);
+    }
+
+    void reap(bool wait, std::vector<size_t> *done) override {
+        bool need_one = wait;
+        while (in_flight_ > 0) {
+            io_uring_cqe *cqe = nullptr;
+            int ret = need_one ? io_uring_wait_cqe(&ring_, &cqe) : io_uring_peek_cqe(&ring_, &cqe);
+            if (ret == -EAGAIN) {
+                break;
+            }
+            if (ret == -EINTR) {
+                continue;
+            }
+            if (ret < 0) {
+                throw std::system_error(-ret, std::generic_category(), "io_uring wait failed");
+            }
+
+            size_t slot = reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe));
+            int res = cqe->res;
+            io_uring_cqe_seen(&ring_, cqe);
+
+            request &req = requests_[slot];
+            if (res == -EINTR || res == -EAGAIN) {
+                queue(slot);
+                continue;
+            }
+            if (res < 0) {
+                in_flight_--;
+                throw std::system_error(-res, std::generic_category(), "snapshot write failed");
+            }
+            if (static_cast<size_t>(res) < req.len) {
+                // Short write, resubmit the remainder.
+                req.data += res;
+                req.len -= static_cast<size_t>(res);
+                req.offset += static_cast<uint64_t>(res);
+                queue(slot);
+                continue;
+            }
+            in_flight_--;
+            done->push_back(slot);
+            need_one = false;
+        }
+    }
+
+private:
+    struct request {
+        const char *data;
+        size_t len;
+        uint64_t offset;
+        bool sync;
+    };
+
+    // One request more than the ring for the final sync.
+    snapshot_uring(int fd, size_t depth)
+            : fd_(fd), in_flight_(0), initialized_(false), requests_(depth + 1) {}
+
+    void queue(size_t slot) {
+        const request &req = requests_[slot];
+        io_uring_sqe *sqe = io_uring_get_sqe(&ring_);
+        if (sqe == nullptr) {
+            io_uring_submit(&ring_);
+            sqe = io_uring_get_sqe(&ring_);
+            if (sqe == nullptr) {
+                throw std::runtime_error("io_uring submission queue is full");
+            }
+        }
+        if (req.sync) {
+            io_uring_prep_fsync(sqe, fd_, IORING_FSYNC_DATASYNC);
+        } else {
+            io_uring_prep_write(sqe, fd_, req.data, static_cast<unsigned>(req.len), req.offset);
+        }
+        io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(static_cast<uintptr_t>(slot)));
+        int ret = io_uring_submit(&ring_);
+        if (ret < 0) {
+            throw std::system_error(-ret, std::generic_category(), "io_uring submit failed");
+        }
+    }
+
+    io_uring ring_;
+    int fd_;
+    size_t in_flight_;
+    bool initialized_;
+    std::vector<request> requests_;
+};
+
+#endif // SMOOTH_HAVE_LIBURING
+
+// Writes a snapshot of a fixed_hashmap incrementally, in bucket order.
+//
+// Each call to step() serializes at most max_buckets buckets into a ring of
+// aligned buffers and hands full buffers to io_uring (or the pwrite pool),
+// so the caller can keep serving the map between steps. step() never waits
+// for I/O: a bucket's records are serialized together, and whatever does
+// not fit in the free buffers is kept and written first by the next step.
+// When every buffer is in flight step() returns without doing any work.
+// The closing fdatasync() goes through the backend too, and a later step()
+// reports completion once it has finished.
+// Memory use is the ring plus the records of one bucket. Because the bucket
+// count of a fixed_hashmap never changes, every element present for the
+// whole duration of the snapshot is written exactly once; elements inserted
+// or erased concurrently may or may not be included.
+template<typename Map>
+class snapshot_writer {
+public:
+    using key_type = typename std::remove_const<typename Map::value_type::first_type>::type;
+    using mapped_type = typename Map::value_type::second_type;
+    using value_type = typename Map::value_type;
+
+    snapshot_writer(const Map &map, const std::string &path,
+                    const snapshot_options &options = snapshot_options())
+            : map_(map),
+              options_(options),
+              fd_(-1),
+              direct_io_(false),
+              using_io_uring_(false),
+              buffers_(nullptr, &std::free),
+              pending_offset_(0),
+              current_slot_(k_no_slot),
+              fill_(0),
+              file_offset_(0),
+              record_bytes_(0),
+              entries_(0),
+              next_bucket_(0),
+              in_flight_(0),
+              footer_written_(false),
+              file_complete_(false),
+              finished_(false) {
+        if (options_.buffer_size == 0 || options_.buffer_size % k_snapshot_alignment != 0) {
+            throw std::invalid_argument("snapshot buffer size must be a multiple of k_snapshot_alignment");
+        }
+        options_.buffer_count = std::max<size_t>(options_.buffer_count, 1);
+
+        open_file(path);
+
+        void *memory = nullptr;
+        if (posix_memalign(&memory, k_snapshot_alignment, options_.buffer_size * options_.buffer_count) != 0) {
+            ::close(fd_);
+            throw std::bad_alloc();
+        }
+        buffers_.reset(static_cast<char *>(memory));
+        for (size_t i = options_.buffer_count; i > 0; i--) {
+            free_slots_.push_back(i - 1);
+        }
+
+        if (options_.io_factory) {
+            io_ = options_.io_factory(fd_, options_.buffer_count);
+        }
+#ifdef SMOOTH_HAVE_LIBURING
+        if (!io_ && options_.prefer_io_uring) {
+            io_ = snapshot_uring::create(fd_, options_.buffer_count);
+            using_io_uring_ = io_ != nullptr;
+        }
+#endif
+        if (!io_) {
+            io_.reset(new snapshot_pwrite_pool(fd_, options_.io_threads));
+        }
+
+        char header[k_snapshot_header_size] = {};
+        std::memcpy(header, k_snapshot_magic, sizeof(k_snapshot_magic));
+        std::memcpy(header + 8, &k_snapshot_version, sizeof(k_snapshot_version));
+        pending_.append(header, sizeof(header));
+    }
+
+    ~snapshot_writer() {
+        // Make sure no write still references the ring before it is freed.
+        try {
+            while (in_flight_ > 0) {
+                reap(true);
+            }
+        } catch (...) {
+        }
+        io_.reset();
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    snapshot_writer(const snapshot_writer &) = delete;
+
+    snapshot_writer &operator=(const snapshot_writer &) = delete;
+
+    // Returns true once the whole snapshot is on disk.
+    bool step(size_t max_buckets = k_snapshot_buckets_per_step) {
+        if (finished_) {
+            return true;
+        }
+        reap(false);
+        if (!drain_pending()) {
+            return false;
+        }
+
+        size_t visited = 0;
+        while (visited < max_buckets) {
+            next_bucket_ = map_.next_occupied_bucket(next_bucket_);
+            if (next_bucket_ >= map_.get_bucket_count()) {
+                break;
+            }
+            map_.for_each_in_bucket(next_bucket_, [this](const value_type &kv) { append_record(kv); });
+            next_bucket_++;
+            visited++;
+            if (!drain_pending()) {
+                return false;
+            }
+        }
+
+        if (next_bucket_ < map_.get_bucket_count()) {
+            return false;
+        }
+
+        if (!footer_written_) {
+            append_footer();
+            if (!drain_pending()) {
+                return false;
+            }
+        }
+        if (current_slot_ != k_no_slot && fill_ > 0) {
+            submit_current();
+        }
+
+        if (in_flight_ > 0) {
+            return false;
+        }
+        if (!file_complete_) {
+            complete_file();
+            if (in_flight_ > 0) {
+                return false;
+            }
+        }
+        finished_ = true;
+        return true;
+    }
+
+    // Write the whole snapshot, blocking the caller.
+    void run() {
+        while (!step(k_snapshot_buckets_per_step)) {
+            if (in_flight_ == options_.buffer_count || (footer_written_ && in_flight_ > 0)) {
+                reap(true);
+            }
+        }
+    }
+
+    bool finished() const { return finished_; }
+
+    size_t entries_written() const { return entries_; }
+
+    // Logical snapshot size, excluding O_DIRECT padding.
+    uint64_t bytes_written() const { return k_snapshot_header_size + record_bytes_ + (footer_written_ ? k_snapshot_footer_size : 0); }
+
+    bool using_io_uring() const { return using_io_uring_; }
+
+    bool using_direct_io() const { return direct_io_; }
+
+private:
+    static const size_t k_no_slot = static_cast<size_t>(-1);
+
+    void open_file(const std::string &path) {
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+#ifdef O_DIRECT
+        if (options_.direct_io) {
+            fd_ = ::open(path.c_str(), flags | O_DIRECT, 0644);
+            direct_io_ = fd_ >= 0;
+        }
+#endif
+        if (fd_ < 0) {
+            fd_ = ::open(path.c_str(), flags, 0644);
+        }
+        if (fd_ < 0) {
+            throw std::system_error(errno, std::generic_category(), "cannot open snapshot file " + path);
+        }
+    }
+
+    char *slot_data(size_t slot) {
+        return buffers_.get() + slot * options_.buffer_size;
+    }
+
+    // Slot number of the final sync, one past the ring.
+    size_t sync_slot() const { return options_.buffer_count; }
+
+    void reap(bool wait) {
+        done_.clear();
+        io_->reap(wait, &done_);
+        for (size_t slot : done_) {
+            if (slot != sync_slot()) {
+                free_slots_.push_back(slot);
+            }
+            in_flight_--;
+        }
+    }
+
+    // Make sure a buffer is being filled; false when the whole ring is in
+    // flight.
+    bool acquire_buffer() {
+        if (current_slot_ != k_no_slot) {
+            return true;
+        }
+        if (free_slots_.empty()) {
+            return false;
+        }
+        current_slot_ = free_slots_.back();
+        free_slots_.pop_back();
+        fill_ = 0;
+        return true;
+    }
+
+    void submit_current() {
+        size_t len = fill_;
+        if (direct_io_) {
+            // O_DIRECT needs whole blocks; the tail is truncated in complete_file().
+            size_t padded = (len + k_snapshot_alignment - 1) / k_snapshot_alignment * k_snapshot_alignment;
+            std::memset(slot_data(current_slot_) + len, 0, padded - len);
+            len = padded;
+        }
+        io_->submit(current_slot_, slot_data(current_slot_), len, file_offset_);
+        file_offset_ += len;
+        in_flight_++;
+        current_slot_ = k_no_slot;
+        fill_ = 0;
+    }
+
+    // Copy pending bytes into the ring, submitting buffers as they fill.
+    // Returns false, keeping the rest, when no buffer is free.
+    bool drain_pending() {
+        while (pending_offset_ < pending_.size()) {
+            if (!acquire_buffer()) {
+                return false;
+            }
+            size_t n = std::min(pending_.size() - pending_offset_, options_.buffer_size - fill_);
+            std::memcpy(slot_data(current_slot_) + fill_, pending_.data() + pending_offset_, n);
+            fill_ += n;
+            pending_offset_ += n;
+            if (fill_ == options_.buffer_size) {
+                submit_current();
+            }
+        }
+        pending_.clear();
+        pending_offset_ = 0;
+        return true;
+    }
+
+    void append_record(const value_type &kv) {
+        size_t key_len = snapshot_codec<key_type>::size(kv.first);
+        size_t value_len = snapshot_codec<mapped_type>::size(kv.second);
+        if (key_len > UINT32_MAX || value_len > UINT32_MAX) {
+            throw std::length_error("snapshot record is too large");
+        }
+        size_t start = pending_.size();
+        pending_.resize(start + 8 + key_len + value_len);
+        char *out = &pending_[start];
+        uint32_t len32 = static_cast<uint32_t>(key_len);
+        std::memcpy(out, &len32, 4);
+        snapshot_codec<key_type>::encode(kv.first, out + 4);
+        len32 = static_cast<uint32_t>(value_len);
+        std::memcpy(out + 4 + key_len, &len32, 4);
+        snapshot_codec<mapped_type>::encode(kv.second, out + 8 + key_len);
+        record_bytes_ += 8 + key_len + value_len;
+        entries_++;
+    }
+
+    void append_footer() {
+        char footer[k_snapshot_footer_size];
+        uint64_t entries = entries_;
+        std::memcpy(footer, &entries, 8);
+        std::memcpy(footer + 8, &record_bytes_, 8);
+        std::memcpy(footer + 16, k_snapshot_magic, sizeof(k_snapshot_magic));
+        pending_.append(footer, sizeof(footer));
+        footer_written_ = true;
+    }
+
+    // Called once every write has finished. Without O_DIRECT the file is
+    // already exactly bytes_written() long; with it, the padding of the last
+    // block is cut, which changes only metadata. The sync, if any, is left to
+    // the backend. The file and the backend are released by the destructor.
+    void complete_file() {
+        if (direct_io_ && ::ftruncate(fd_, static_cast<off_t>(bytes_written())) != 0) {
+            throw std::system_error(errno, std::generic_category(), "cannot truncate snapshot file");
+        }
+        if (options_.sync_on_finish) {
+            io_->submit_sync(sync_slot());
+            in_flight_++;
+        }
+        file_complete_ = true;
+    }
+
+    const Map &map_;
+    snapshot_options options_;
+    int fd_;
+    bool direct_io_;
+    bool using_io_uring_;
+    std::unique_ptr<char, void (*)(void *)> buffers_;
+    std::unique_ptr<snapshot_io> io_;
+    std::vector<size_t> free_slots_;
+    std::vector<size_t> done_;
+    // Serialized bytes not yet copied into the ring.
+    std::string pending_;
+    size_t pending_offset_;
+    size_t current_slot_;
+    size_t fill_;
+    uint64_t file_offset_;
+    uint64_t record_bytes_;
+    size_t entries_;
+    size_t next_bucket_;
+    size_t in_flight_;
+    bool footer_written_;
+    bool file_complete_;
+    bool finished_;
+};
+
+template<typename Map>
+const size_t snapshot_writer<Map>::k_no_slot;
+
+// Read a snapshot written by snapshot_writer and insert its entries into map.
+// Returns the number of entries read.
+template<typename Map>
+size_t load_snapshot(const std::string &path, Map *map) {
+    using key_type = typename std::remove_const<typename Map::value_type::first_type>::type;
+    using mapped_type = typename Map::value_type::second_type;
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot open snapshot file " + path);
+    }
+    std::string data;
+    char chunk[1 << 16];
+    for (;;) {
+        ssize_t n = ::read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "cannot read snapshot file " + path);
+        }
+        if (n == 0) {
+            break;
+        }
+        data.append(chunk, static_cast<size_t>(n));
+    }
+    ::close(fd);
+
+    if (data.size() < k_snapshot_header_size + k_snapshot_footer_size ||
+        std::memcmp(data.data(), k_snapshot_magic, sizeof(k_snapshot_magic)) != 0 ||
+        std::memcmp(data.data() + data.size() - 8, k_snapshot_magic, sizeof(k_snapshot_magic)) != 0) {
+        throw std::runtime_error("not a snapshot file: " + path);
+    }
+    uint32_t version;
+    std::memcpy(&version, data.data() + 8, 4);
+    if (version != k_snapshot_version) {
+        throw std::runtime_error("unsupported snapshot version");
+    }
+    uint64_t entries;
+    uint64_t record_bytes;
+    const char *footer = data.data() + data.size() - k_snapshot_footer_size;
+    std::memcpy(&entries, footer, 8);
+    std::memcpy(&record_bytes, footer + 8, 8);
+    if (record_bytes != data.size() - k_snapshot_header_size - k_snapshot_footer_size) {
+        throw std::runtime_error("truncated snapshot file: " + path);
+    }
+
+    const char *p = data.data() + k_snapshot_header_size;
+    const char *end = footer;
+    size_t count = 0;
+    while (p < end) {
+        uint32_t key_len;
+        uint32_t value_len;
+        key_type key;
+        mapped_type value;
+        if (end - p < 4) {
+            throw std::runtime_error("corrupt snapshot record");
+        }
+        std::memcpy(&key_len, p, 4);
+        p += 4;
+        if (static_cast<size_t>(end - p) < key_len + 4 || !snapshot_codec<key_type>::decode(p, key_len, &key)) {
+            throw std::runtime_error("corrupt snapshot record");
+        }
+        p += key_len;
+        std::memcpy(&value_len, p, 4);
+        p += 4;
+        if (static_cast<size_t>(end - p) < value_len ||
+            !snapshot_codec<mapped_type>::decode(p, value_len, &value)) {
+            throw std::runtime_error("corrupt snapshot record");
+        }
+        p += value_len;
+        map->insert(std::make_pair(std::move(key), std::move(value)));
+        count++;
+    }
+    if (count != entries) {
+        throw std::runtime_error("snapshot entry count mismatch");
+    }
+    return count;
+}
+
+}  // namespace smooth
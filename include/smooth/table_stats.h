@@ -0,0 +1,143 @@
+// Copyright (c) 2024 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace smooth {
+
+// Chain lengths counted individually in the histogram; longer chains share
+// the last slot, as DICT_STATS_VECTLEN in Redis.
+const size_t k_stats_chain_slots = 50;
+
+// Buckets examined per table by stats() by default. Larger tables are
+// sampled at a fixed stride, so a call costs about the same at any size.
+// The stride is odd, hence coprime with the power-of-two bucket count: an
+// even one would only sample buckets whose low index bits, and so the low
+// bits of their elements' hashes, are zero.
+const size_t k_stats_sample_buckets = 1 << 16;
+
+// Shape of one fixed_hashmap table, from fixed_hashmap::stats(). Fields
+// after used_buckets describe the sampled buckets only.
+struct table_stats {
+    size_t bucket_count = 0;
+    size_t size = 0;
+    // Non-empty buckets, counted exactly from the occupancy bitmap.
+    size_t used_buckets = 0;
+    size_t sampled_buckets = 0;
+    size_t sampled_elements = 0;
+    size_t max_chain = 0;
+    size_t tree_buckets = 0;
+    size_t max_tree_depth = 0;
+    // Sum over sampled elements of the key comparisons a lookup of each
+    // one makes.
+    size_t probe_total = 0;
+    size_t chain_lengths[k_stats_chain_slots] = {};
+
+    bool sampled() const { return sampled_buckets < bucket_count; }
+
+    void add_bucket(size_t length, bool tree, size_t depth) {
+        sampled_buckets++;
+        sampled_elements += length;
+        chain_lengths[length < k_stats_chain_slots ? length : k_stats_chain_slots - 1]++;
+        if (length > max_chain) {
+            max_chain = length;
+        }
+        if (tree) {
+            tree_buckets++;
+            if (depth > max_tree_depth) {
+                max_tree_depth = depth;
+            }
+        }
+        // Chains are searched front to back, the tree buckets in order.
+        probe_total += length * (length + 1) / 2;
+    }
+
+    // Mean length of the non-empty chains in the sample.
+    double average_chain() const {
+        size_t used = sampled_buckets - chain_lengths[0];
+        return used == 0 ? 0.0 : static_cast<double>(sampled_elements) / used;
+    }
+
+    // Mean key comparisons to find a key that is present.
+    double average_probe() const {
+        return sampled_elements == 0 ? 0.0 : static_cast<double>(probe_total) / sampled_elements;
+    }
+
+    // Text in the format of Redis DEBUG HTSTATS, plus lines for sampling,
+    // tree buckets and probe length.
+    std::string dump(int table_id, const char *label) const {
+        char buf[256];
+        std::string out;
+        if (size == 0) {
+            std::snprintf(buf, sizeof(buf), "Hash table %d stats (%s):\n"
+                                            "No stats available for empty dictionaries\n", table_id, label);
+            return buf;
+        }
+        std::snprintf(buf, sizeof(buf),
+                      "Hash table %d stats (%s):\n"
+                      " table size: %zu\n"
+                      " number of elements: %zu\n"
+                      " different slots: %zu\n"
+                      " max chain length: %zu\n"
+                      " avg chain length (counted): %.02f\n"
+                      " avg chain length (computed): %.02f\n",
+                      table_id, label, bucket_count, size, used_buckets, max_chain, average_chain(),
+                      used_buckets == 0 ? 0.0 : static_cast<double>(size) / used_buckets);
+        out += buf;
+        if (sampled()) {
+            std::snprintf(buf, sizeof(buf), " sampled buckets: %zu of %zu\n", sampled_buckets, bucket_count);
+            out += buf;
+        }
+        std::snprintf(buf, sizeof(buf),
+                      " tree buckets: %zu (max depth %zu)\n"
+                      " avg probe length: %.02f\n"
+                      " Chain length distribution:\n",
+                      tree_buckets, max_tree_depth, average_probe());
+        out += buf;
+        for (size_t i = 0; i < k_stats_chain_slots; i++) {
+            if (chain_lengths[i] == 0) {
+                continue;
+            }
+            std::snprintf(buf, sizeof(buf), "   %s%zu: %zu (%.02f%%)\n", i == k_stats_chain_slots - 1 ? ">=" : "", i,
+                          chain_lengths[i], 100.0 * chain_lengths[i] / sampled_buckets);
+            out += buf;
+        }
+        return out;
+    }
+};
+
+// Both tables of a hashmap, from hashmap::stats().
+struct hashmap_stats {
+    table_stats main;
+    // The table being migrated from; empty unless rehashing.
+    table_stats old;
+    bool rehashing = false;
+    bool reseeding = false;
+    // Old buckets left to migrate.
+    size_t buckets_to_migrate = 0;
+    size_t reseed_count = 0;
+
+    std::string dump() const {
+        std::string out = main.dump(0, "main hash table");
+        if (rehashing) {
+            out += old.dump(1, reseeding ? "old hash table, previous seed" : "old hash table");
+            char buf[96];
+            std::snprintf(buf, sizeof(buf), " buckets left to migrate: %zu of %zu\n", buckets_to_migrate,
+                          old.bucket_count);
+            out += buf;
+        }
+        if (reseed_count > 0) {
+            char buf[64];
+            std::snprintf(buf, sizeof(buf), "Reseeds after collision attacks: %zu\n", reseed_count);
+            out += buf;
+        }
+        return out;
+    }
+};
+
+}  // namespace smooth
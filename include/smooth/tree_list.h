@@ -4,13 +4,33 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 #include <cmath>
 #include <cassert>
+#include <cstring>
+#include "counters.h"
+#include "probes.h"
 
 namespace smooth {
 
+// Tags of the first elements of a list, kept in the header itself.
+const size_t k_head_tags = 4;
+
+// List nodes keep their tag in a byte of their own. Defining
+// SMOOTH_TAG_IN_LINK (the CMake option of the same name) moves it into the
+// top byte of the next pointer on x86-64, where user-space addresses fit
+// in 47 bits, or 56 with five-level paging, so a node is no larger than
+// its element and a pointer. The next pointer then no longer holds a plain
+// address: LeakSanitizer and other conservative scanners cannot follow it,
+// and report the nodes of maps still alive at exit, such as globals, as
+// leaks. Elsewhere the top byte may hold hardware pointer tags, so the
+// macro is ignored.
+#if defined(SMOOTH_TAG_IN_LINK) && !defined(__x86_64__) && !defined(_M_X64)
+#undef SMOOTH_TAG_IN_LINK
+#endif
+
 template<typename T, typename compare = std::less<T>>
 class tree_list_base {
 public:
@@ -33,6 +53,7 @@ public:
                   right_(nullptr),
                   parent_(nullptr),
                   color_(k_red),
+                  tag_(0),
                   data_(data) {}
 
         template<typename... Args>
@@ -41,6 +62,7 @@ public:
                   right_(nullptr),
                   parent_(nullptr),
                   color_(k_red),
+                  tag_(0),
                   data_(std::forward<Args>(args)...) {}
 
         rb_node_type(const rb_node_type &) = delete;
@@ -53,6 +75,10 @@ public:
 
         void set_color(node_color color) { color_ = color; }
 
+        uint8_t tag() const { return tag_; }
+
+        void set_tag(uint8_t tag) { tag_ = tag; }
+
         // Fetches the user data.
         T &data() { return data_; }
 
@@ -64,7 +90,10 @@ public:
         // fields. Any augmentation information also does not need to be
         // copied, as it will be recomputed. Subclasses must call the
         // superclass implementation.
-        virtual void copy_from(rb_node_type *src) { data_ = src->data(); }
+        virtual void copy_from(rb_node_type *src) {
+            data_ = src->data();
+            tag_ = src->tag_;
+        }
 
         rb_node_type *left() { return left_; }
 
@@ -91,6 +120,7 @@ public:
         rb_node_type *right_;
         rb_node_type *parent_;
         node_color color_;
+        uint8_t tag_;
         T data_;
     };
 
@@ -102,14 +132,50 @@ public:
     // Node structure for the linked list.
     struct list_node_type {
         T data;
-        list_node_type *next;
 
-        explicit list_node_type(const T &data) : data(data), next(nullptr) {}
+        explicit list_node_type(const T &data) : data(data) { set_link(nullptr, 0); }
 
-        explicit list_node_type(T &&data) : data(std::move(data)), next(nullptr) {}
+        explicit list_node_type(T &&data) : data(std::move(data)) { set_link(nullptr, 0); }
 
         template<typename... Args>
-        list_node_type(Args &&... args) : data(std::forward<Args>(args)...), next(nullptr) {}
+        list_node_type(Args &&... args) : data(std::forward<Args>(args)...) { set_link(nullptr, 0); }
+
+#ifdef SMOOTH_TAG_IN_LINK
+        list_node_type *next() const { return reinterpret_cast<list_node_type *>(link_ & k_pointer_bits); }
+
+        uint8_t tag() const { return static_cast<uint8_t>(link_ >> k_tag_shift); }
+
+        void set_next(list_node_type *next) { set_link(next, tag()); }
+
+        void set_tag(uint8_t tag) { set_link(next(), tag); }
+
+    private:
+        static const int k_tag_shift = 56;
+        static const uintptr_t k_pointer_bits = (uintptr_t(1) << k_tag_shift) - 1;
+
+        void set_link(list_node_type *next, uint8_t tag) {
+            link_ = reinterpret_cast<uintptr_t>(next) | (static_cast<uintptr_t>(tag) << k_tag_shift);
+        }
+
+        uintptr_t link_;  // Next node, with the tag in the top byte
+#else
+        list_node_type *next() const { return next_; }
+
+        uint8_t tag() const { return tag_; }
+
+        void set_next(list_node_type *next) { next_ = next; }
+
+        void set_tag(uint8_t tag) { tag_ = tag; }
+
+    private:
+        void set_link(list_node_type *next, uint8_t tag) {
+            next_ = next;
+            tag_ = tag;
+        }
+
+        list_node_type *next_;
+        uint8_t tag_;
+#endif
     };
 
     // Mixed node structure
@@ -204,7 +270,7 @@ public:
 
         void increment() {
             if (node_.ds_type_ == data_struct_type::k_linked_list) {
-                node_.list_node_ = node_.list_node_->next;
+                node_.list_node_ = node_.list_node_->next();
             } else {
                 node_.tree_node_ = walk_to_next_node(node_.tree_node_);
             }
@@ -276,24 +342,93 @@ public:
 
     template<typename P>
     iterator insert(P &&data) {
+        return insert_tagged(std::forward<P>(data), 0);
+    }
+
+    template<typename... Args>
+    iterator emplace(Args &&... args) {
+        return emplace_tagged(0, std::forward<Args>(args)...);
+    }
+
+    // Insert with a tag, usually a few bits of the element's hash, for
+    // find_tagged().
+    template<typename P>
+    iterator insert_tagged(P &&data, uint8_t tag) {
         treefy_or_un_treefy();
         if (ds_type_ == data_struct_type::k_linked_list) {
-            const auto list_node = list_insert(std::forward<decltype(data)>(data));
+            const auto list_node = list_insert(std::forward<decltype(data)>(data), tag);
             return iterator(list_node);
         }
         auto rb_node = tree_insert(std::forward<decltype(data)>(data));
+        rb_node->set_tag(tag);
         return iterator(mixed_node_type(rb_node));
     }
 
     template<typename... Args>
-    iterator emplace(Args &&... args) {
+    iterator emplace_tagged(uint8_t tag, Args &&... args) {
         treefy_or_un_treefy();
         if (ds_type_ == data_struct_type::k_linked_list) {
             auto list_node = list_emplace(std::forward<Args>(args)...);
+            list_node->set_tag(tag);
+            head_tags_[0] = tag;
             return iterator(list_node);
         }
-        mixed_node_type mix_node(tree_emplace(std::forward<Args>(args)...));
-        return iterator(mix_node);
+        auto rb_node = tree_emplace(std::forward<Args>(args)...);
+        rb_node->set_tag(tag);
+        return iterator(mixed_node_type(rb_node));
+    }
+
+    // Find the element with this tag for which match(element) is true.
+    // Elements with other tags are skipped without reading them, and in a
+    // list the first k_head_tags tags sit in the header, so a miss in a
+    // short list touches no node at all. Nodes walked are counted in
+    // k_counter_nodes_visited when CountVisits is set.
+    template<bool CountVisits = true, typename Match>
+    iterator find_tagged(uint8_t tag, Match &&match) const {
+        if (ds_type_ == data_struct_type::k_linked_list) {
+            size_t in_header = size_ < k_head_tags ? static_cast<size_t>(size_) : k_head_tags;
+            bool header_hit = false;
+            for (size_t i = 0; i < in_header; i++) {
+                header_hit |= head_tags_[i] == tag;
+            }
+            if (!header_hit && size_ <= k_head_tags) {
+                return iterator(static_cast<list_node_type *>(nullptr));
+            }
+            size_t i = 0;
+            for (list_node_type *node = head_; node != nullptr; node = node->next(), i++) {
+                if (CountVisits) {
+                    SMOOTH_COUNT(k_counter_nodes_visited);
+                }
+                uint8_t node_tag = i < k_head_tags ? head_tags_[i] : node->tag();
+                if (node_tag == tag && match(node->data)) {
+                    return iterator(node);
+                }
+            }
+            return iterator(static_cast<list_node_type *>(nullptr));
+        }
+        if (root_ != nullptr) {
+            for (rb_node_type *node = walk_to_leftmost_minor(root_); node != nullptr; node = walk_to_next_node(node)) {
+                if (CountVisits) {
+                    SMOOTH_COUNT(k_counter_nodes_visited);
+                }
+                if (node->tag() == tag && match(node->data())) {
+                    return iterator(mixed_node_type(node));
+                }
+            }
+        }
+        return iterator(static_cast<list_node_type *>(nullptr));
+    }
+
+    bool is_tree() const {
+        return ds_type_ == data_struct_type::k_red_black_tree;
+    }
+
+    // Levels of the tree, or the length of the list.
+    size_t depth() const {
+        if (!is_tree()) {
+            return static_cast<size_t>(size_);
+        }
+        return subtree_depth(root_);
     }
 
     iterator insert(iterator pos, const T &data) {
@@ -329,12 +464,17 @@ public:
         std::swap(size_, other.size_);
         std::swap(ds_type_, other.ds_type_);
         std::swap(root_, other.root_);
+        for (size_t i = 0; i < k_head_tags; i++) {
+            std::swap(head_tags_[i], other.head_tags_[i]);
+        }
     }
 
     // Erase a node with the given data.
     void erase(const T &data) {
         if (ds_type_ == data_struct_type::k_linked_list) {
             list_erase(data);
+            refresh_head_tags();
+            return;
         }
         tree_erase(data);
     }
@@ -350,26 +490,33 @@ public:
 
             // Handle if it's the head
             if (to_delete.get() == head_) {
-                head_ = to_delete->next;
+                head_ = to_delete->next();
                 it = iterator(head_);
             } else {
                 list_node_type *prev_node = head_;
-                while (prev_node->next != to_delete.get()) {
-                    prev_node = prev_node->next;
+                while (prev_node->next() != to_delete.get()) {
+                    prev_node = prev_node->next();
                 }
-                prev_node->next = to_delete->next;
-                it = iterator(prev_node->next);
+                prev_node->set_next(to_delete->next());
+                it = iterator(prev_node->next());
             }
             --size_;
+            refresh_head_tags();
         } else {
-            delete_node(it.node_.tree_node_);
+            rb_node_type *node = it.node_.tree_node_;
+            rb_node_type *next = walk_to_next_node(node);
+            // With two children delete_node() moves the successor's data into
+            // node and frees the successor instead, so node is the next element.
+            bool successor_moved = node->left() != nullptr && node->right() != nullptr;
+            delete_node(node);
+            it = iterator(mixed_node_type(successor_moved ? node : next));
         }
         return it;
     }
 
     // Get iterator to the beginning
     iterator begin() noexcept {
-        if (ds_type_ == data_struct_type::k_red_black_tree) {
+        if (ds_type_ == data_struct_type::k_red_black_tree && root_ != nullptr) {
             rb_node_type *rb_node = root_;
             while (rb_node->left() != nullptr) {
                 rb_node = rb_node->left();
@@ -385,7 +532,7 @@ public:
     }
 
     const_iterator begin() const noexcept {
-        if (ds_type_ == data_struct_type::k_linked_list) {
+        if (ds_type_ == data_struct_type::k_linked_list || root_ == nullptr) {
             return const_iterator(head_);
         }
 
@@ -402,7 +549,7 @@ public:
 
     // Get const_iterator to the beginning
     const_iterator cbegin() const {
-        if (ds_type_ == data_struct_type::k_linked_list) {
+        if (ds_type_ == data_struct_type::k_linked_list || root_ == nullptr) {
             return const_iterator(head_);
         }
 
@@ -423,7 +570,15 @@ protected:
     bool update_node(rb_node_type *) { return false; }
 
     void un_treefy() {
-        traversal_un_treefy(root_);
+        // head_ shares storage with root_, so detach the tree first. Nodes
+        // are pushed onto the list front, which keeps head_tags_ current.
+        rb_node_type *root = root_;
+        head_ = nullptr;
+        size_ = 0;
+        ds_type_ = data_struct_type::k_linked_list;
+        if (root != nullptr) {
+            traversal_un_treefy(root);
+        }
     }
 
     void traversal_un_treefy(rb_node_type *node) {
@@ -434,17 +589,21 @@ protected:
             traversal_un_treefy(node->right());
         }
 
-        list_insert(std::move(node->data()));
+        list_insert(std::move(node->data()), node->tag());
         delete node;
     }
 
     void treefy_or_un_treefy() {
         if (ds_type_ == data_struct_type::k_linked_list) {
             if (size_ >= 10) {
+                SMOOTH_COUNT(k_counter_treefies);
+                SMOOTH_PROBE1(treefy, size_);
                 treefy();
             }
         } else {
             if (size_ <= 3) {
+                SMOOTH_COUNT(k_counter_un_treefies);
+                SMOOTH_PROBE1(un__treefy, size_);
                 un_treefy();
             }
         }
@@ -453,14 +612,15 @@ protected:
     rb_node_type *treefy() {
         list_node_type *node = head_;
         root_ = nullptr;
-        rb_node_type *rb_node = nullptr;
         while (node != nullptr) {
-            auto tree_node = new rb_node_type(node->data);
+            auto tree_node = new rb_node_type(std::move(node->data));
+            tree_node->set_tag(node->tag());
             tree_insert_node(tree_node);
-            node = node->next;
+            std::unique_ptr<list_node_type> to_delete(node);
+            node = node->next();
         }
         ds_type_ = data_struct_type::k_red_black_tree;
-        return rb_node;
+        return root_;
     }
 
     list_node_type *list_search(const T &data) const {
@@ -469,29 +629,48 @@ protected:
             if (node->data == data) {
                 return node;
             }
-            node = node->next;
+            node = node->next();
         }
         return nullptr;
     }
 
     template<typename P>
-    list_node_type *list_insert(P &&data) {
+    list_node_type *list_insert(P &&data, uint8_t tag = 0) {
         auto old = head_;
         head_ = new list_node_type(std::forward<decltype(data)>(data));
-        head_->next = old;
+        head_->set_next(old);
+        head_->set_tag(tag);
+        push_head_tag(tag);
         ++size_;
         return head_;
     }
 
+    // The caller sets the tag, in the node and in head_tags_[0].
     template<typename... Args>
     list_node_type *list_emplace(Args &&... args) {
         auto old = head_;
         head_ = new list_node_type(std::forward<decltype(args)>(args)...);
-        head_->next = old;
+        head_->set_next(old);
+        push_head_tag(0);
         ++size_;
         return head_;
     }
 
+    void push_head_tag(uint8_t tag) {
+        for (size_t i = k_head_tags - 1; i > 0; i--) {
+            head_tags_[i] = head_tags_[i - 1];
+        }
+        head_tags_[0] = tag;
+    }
+
+    // Reload head_tags_ from the first nodes after an erase.
+    void refresh_head_tags() {
+        list_node_type *node = head_;
+        for (size_t i = 0; i < k_head_tags && node != nullptr; i++, node = node->next()) {
+            head_tags_[i] = node->tag();
+        }
+    }
+
     void list_erase(const T &data) {
         list_node_type *prev_node = nullptr;
         list_node_type *current_node = head_;
@@ -499,16 +678,16 @@ protected:
         while (current_node != nullptr) {
             if (current_node->data == data) {
                 if (prev_node == nullptr) {
-                    head_ = current_node->next;
+                    head_ = current_node->next();
                 } else {
-                    prev_node->next = std::move(current_node->next);
+                    prev_node->set_next(current_node->next());
                 }
                 to_delete.reset(current_node);
                 --size_;
                 return;
             }
             prev_node = current_node;
-            current_node = current_node->next;
+            current_node = current_node->next();
         }
     }
 
@@ -530,6 +709,13 @@ protected:
     }
 
 
+    static size_t subtree_depth(const rb_node_type *node) {
+        if (node == nullptr) {
+            return 0;
+        }
+        return 1 + std::max(subtree_depth(node->left()), subtree_depth(node->right()));
+    }
+
     static rb_node_type *walk_to_leftmost_minor(rb_node_type *node) {
         while (node->left() != nullptr) {
             node = node->left();
@@ -597,7 +783,7 @@ protected:
 
         auto current = head_;
         while (current != nullptr) {
-            list_node_type *next = current->next;
+            list_node_type *next = current->next();
             {
                 std::unique_ptr<list_node_type> to_delete(current);
             }
@@ -951,6 +1137,10 @@ protected:
 
         std::unique_ptr<rb_node_type> to_delete(y);
         --size_;
+        if (size_ == 0) {
+            // root_ is null, which is also an empty list.
+            ds_type_ = data_struct_type::k_linked_list;
+        }
     }
 
     // Root node of the tree
@@ -960,6 +1150,9 @@ protected:
     };
     uint64_t size_;
     data_struct_type ds_type_;
+    // Tags of the first elements of a list, in list order; fits in what
+    // would otherwise be padding.
+    uint8_t head_tags_[k_head_tags];
 };
 
 
@@ -971,6 +1164,7 @@ public:
         this->size_ = 0;
         this->ds_type_ = tree_list_base<T, compare>::data_struct_type::k_linked_list;
         this->head_ = nullptr;
+        std::memset(this->head_tags_, 0, sizeof(this->head_tags_));
     }
 
     ~tree_list() {
@@ -995,6 +1189,7 @@ public:
         this->size_ = rhs.size_;
         this->ds_type_ = rhs.ds_type_;
         this->root_ = rhs.root_;
+        std::memcpy(this->head_tags_, rhs.head_tags_, sizeof(this->head_tags_));
         rhs.size_ = 0;
         rhs.ds_type_ = tree_list_base<T, compare>::data_struct_type::k_linked_list;
         rhs.root_ = nullptr;
@@ -1005,6 +1200,7 @@ public:
         this->size_ = rhs.size_;
         this->ds_type_ = rhs.ds_type_;
         this->root_ = rhs.root_;
+        std::memcpy(this->head_tags_, rhs.head_tags_, sizeof(this->head_tags_));
         rhs.size_ = 0;
         rhs.ds_type_ = tree_list_base<T, compare>::data_struct_type::k_linked_list;
         rhs.root_ = nullptr;
@@ -1034,6 +1230,11 @@ public:
 static_assert(std::is_trivially_copyable<tree_list_base<int>>::value, "tree_list_base<int>> is not trivial copyable");
 static_assert(!std::is_trivially_copyable<tree_list<int>>::value, "tree_list<int> is trivial copyable");
 static_assert(std::is_trivially_copyable<tree_list_trivial<int>>::value, "tree_list_trivial<int>> is not trivial copyable");
+static_assert(sizeof(tree_list_trivial<int>) <= 3 * sizeof(uint64_t), "head tags should fit in the bucket header's padding");
+#ifdef SMOOTH_TAG_IN_LINK
+static_assert(sizeof(tree_list_trivial<uint64_t>::list_node_type) == 2 * sizeof(uint64_t),
+              "list node tags should fit in the next pointer");
+#endif
 
 };
 
@@ -0,0 +1,162 @@
+#include "src/benchmarks/alloc_counter.h"
+#include <cstdlib>
+#include <new>
+
+// Counters are per thread so that counting needs no atomics and other
+// threads do not disturb a measurement. They are plain data in static TLS,
+// which is set up before any allocation can reach them.
+namespace {
+
+struct thread_counts {
+  uint64_t allocations;
+  uint64_t frees;
+  uint64_t bytes;
+};
+
+thread_local thread_counts counts = {0, 0, 0};
+
+inline void note_alloc(void *p, size_t size) {
+  if (p != nullptr) {
+    counts.allocations++;
+    counts.bytes += size;
+  }
+}
+
+inline void note_free(void *p) {
+  if (p != nullptr) {
+    counts.frees++;
+  }
+}
+
+}  // namespace
+
+#if defined(__GLIBC__)
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *p, size_t size);
+void __libc_free(void *p);
+
+// Symbols in the executable take precedence over libc's, so these catch
+// every malloc in the program, libstdc++ and C libraries included.
+void *malloc(size_t size) {
+  void *p = __libc_malloc(size);
+  note_alloc(p, size);
+  return p;
+}
+
+void *calloc(size_t count, size_t size) {
+  void *p = __libc_calloc(count, size);
+  note_alloc(p, count * size);
+  return p;
+}
+
+void *realloc(void *old, size_t size) {
+  void *p = __libc_realloc(old, size);
+  if (p != nullptr || size == 0) {
+    note_free(old);
+  }
+  note_alloc(p, size);
+  return p;
+}
+
+void free(void *p) {
+  note_free(p);
+  __libc_free(p);
+}
+}
+
+static void *raw_malloc(size_t size) {
+  return __libc_malloc(size);
+}
+
+static void raw_free(void *p) {
+  __libc_free(p);
+}
+
+bool alloc_counter_covers_malloc() {
+  return true;
+}
+#else
+static void *raw_malloc(size_t size) {
+  return std::malloc(size);
+}
+
+static void raw_free(void *p) {
+  std::free(p);
+}
+
+bool alloc_counter_covers_malloc() {
+  return false;
+}
+#endif
+
+alloc_stats thread_alloc_stats() {
+  alloc_stats out;
+  out.allocations = counts.allocations;
+  out.frees = counts.frees;
+  out.bytes = counts.bytes;
+  return out;
+}
+
+static void *counted_new(size_t size) {
+  void *p = raw_malloc(size == 0 ? 1 : size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  note_alloc(p, size);
+  return p;
+}
+
+static void *counted_new_nothrow(size_t size) noexcept {
+  void *p = raw_malloc(size == 0 ? 1 : size);
+  note_alloc(p, size);
+  return p;
+}
+
+static void counted_delete(void *p) noexcept {
+  note_free(p);
+  raw_free(p);
+}
+
+void *operator new(size_t size) {
+  return counted_new(size);
+}
+
+void *operator new[](size_t size) {
+  return counted_new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return counted_new_nothrow(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return counted_new_nothrow(size);
+}
+
+void operator delete(void *p) noexcept {
+  counted_delete(p);
+}
+
+void operator delete[](void *p) noexcept {
+  counted_delete(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  counted_delete(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  counted_delete(p);
+}
+
+#if __cpp_sized_deallocation
+void operator delete(void *p, size_t) noexcept {
+  counted_delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+  counted_delete(p);
+}
+#endif
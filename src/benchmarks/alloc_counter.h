@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+
+// Heap allocations made by the calling thread, for allocation budgets in
+// tests and allocations-per-operation in benchmarks. Counting needs
+// alloc_counter.cc linked into the program (the alloc_counter library): it
+// replaces operator new and delete and, with glibc, interposes malloc,
+// calloc, realloc and free, which also covers C libraries and tables
+// allocated with calloc, as redis_style_dict's are. Memory from mmap, as
+// large mmap_arrays use, is not counted.
+struct alloc_stats {
+  uint64_t allocations;  // Calls that returned memory, including realloc
+  uint64_t frees;        // Calls that released memory, including realloc
+  uint64_t bytes;        // Bytes requested by allocations
+
+  alloc_stats() : allocations(0), frees(0), bytes(0) {}
+
+  alloc_stats operator-(const alloc_stats &other) const {
+    alloc_stats out;
+    out.allocations = allocations - other.allocations;
+    out.frees = frees - other.frees;
+    out.bytes = bytes - other.bytes;
+    return out;
+  }
+
+  alloc_stats &operator+=(const alloc_stats &other) {
+    allocations += other.allocations;
+    frees += other.frees;
+    bytes += other.bytes;
+    return *this;
+  }
+};
+
+// Totals for the calling thread since it started.
+alloc_stats thread_alloc_stats();
+
+// Whether malloc and free are counted as well as operator new and delete.
+bool alloc_counter_covers_malloc();
+
+// Allocations of the calling thread from construction on.
+class alloc_scope {
+public:
+  alloc_scope() : start_(thread_alloc_stats()) {}
+
+  alloc_stats delta() const { return thread_alloc_stats() - start_; }
+
+  void restart() { start_ = thread_alloc_stats(); }
+
+private:
+  alloc_stats start_;
+};
@@ -0,0 +1,169 @@
+// Tail latency of inserts while a map grows from empty: times every
+// insert and reports, per window of operations, the max, p99.9 and p99.99
+// latency, and whether the window contains a rehash boundary. Incremental
+// rehashing should keep the max flat; a stop-the-world rehash shows up as
+// a spike in the windows marked as rehashing.
+//
+//   growth_latency [map] [keys] [window]
+//
+// map is smooth (default), std or redis_style (redis_style_dict.h), keys defaults to 100M and window to 1M
+// operations. Output is CSV on stdout, one line per window, with a summary
+// on stderr. To plot the max per window, marking rehash windows:
+//
+//   growth_latency smooth > smooth.csv
+//   gnuplot -p -e "set datafile separator ','; set logscale y; plot 'smooth.csv' using 2:4 with lines title 'max', '' using 2:(\$7 > 0 ? \$4 : 1/0) with points title 'rehash'"
+
+#include "smooth/hash.h"
+#include "smooth/hashmap.h"
+#include "smooth/latency.h"
+#include "smooth/map_events.h"
+#include "src/benchmarks/redis_style_dict.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+
+using namespace smooth;
+
+// Counts rehash starts and finishes, the boundaries a window can contain.
+struct boundary_counter : map_event_listener {
+  size_t boundaries = 0;
+
+  void on_rehash_start(const rehash_start_event &) override { boundaries++; }
+  void on_rehash_finish(const rehash_finish_event &) override { boundaries++; }
+};
+
+class smooth_driver {
+public:
+  smooth_driver() { map_.set_event_listener(&events_); }
+
+  void insert(uint64_t key, uint64_t value) { map_.insert(std::make_pair(key, value)); }
+
+  size_t size() const { return map_.size(); }
+
+  size_t take_boundaries() {
+    size_t boundaries = events_.boundaries;
+    events_.boundaries = 0;
+    return boundaries;
+  }
+
+private:
+  boundary_counter events_;
+  hashmap<uint64_t, uint64_t> map_;
+};
+
+// std::unordered_map rehashes all at once inside the insert that crosses
+// its load factor, which shows as a bucket count change.
+class std_driver {
+public:
+  std_driver() : buckets_(map_.bucket_count()) {}
+
+  void insert(uint64_t key, uint64_t value) { map_.insert(std::make_pair(key, value)); }
+
+  size_t size() const { return map_.size(); }
+
+  // Checked once per window, not per insert, to keep it out of the
+  // timings; it counts windows whose bucket count changed.
+  size_t take_boundaries() {
+    size_t buckets = map_.bucket_count();
+    size_t boundaries = buckets != buckets_ ? 1 : 0;
+    buckets_ = buckets;
+    return boundaries;
+  }
+
+private:
+  std::unordered_map<uint64_t, uint64_t> map_;
+  size_t buckets_;
+};
+
+// redis_style_dict rehashes incrementally like smooth::hashmap, a bucket
+// per operation; a window that started or finished a rehash changed the
+// total slot count.
+class redis_style_driver {
+public:
+  redis_style_driver() : buckets_(map_.bucket_count()) {}
+
+  void insert(uint64_t key, uint64_t value) { map_.insert(key, value); }
+
+  size_t size() const { return map_.size(); }
+
+  size_t take_boundaries() {
+    size_t buckets = map_.bucket_count();
+    size_t boundaries = buckets != buckets_ ? 1 : 0;
+    buckets_ = buckets;
+    return boundaries;
+  }
+
+private:
+  redis_style_dict map_;
+  size_t buckets_;
+};
+
+struct run_summary {
+  latency_histogram all;
+  size_t rehash_windows = 0;
+  uint64_t worst_window_max_ns = 0;
+};
+
+template<typename Driver>
+static void run(const char *name, uint64_t keys, uint64_t window) {
+  Driver driver;
+  tsc_clock clock;
+  latency_histogram histogram;
+  run_summary summary;
+  std::printf("map,window,size,max_ns,p999_ns,p9999_ns,rehash_boundaries\n");
+  uint64_t window_index = 0;
+  for (uint64_t i = 0; i < keys; i++) {
+    uint64_t key = hash_mix64(i);
+    uint64_t start = tsc_clock::now();
+    driver.insert(key, i);
+    uint64_t end = tsc_clock::now();
+    histogram.record(end > start ? end - start : 0);
+    if (histogram.count() == window || i + 1 == keys) {
+      clock.calibrate();
+      size_t boundaries = driver.take_boundaries();
+      uint64_t max_ns = clock.to_nanos(histogram.max());
+      std::printf("%s,%llu,%zu,%llu,%llu,%llu,%zu\n", name, static_cast<unsigned long long>(window_index),
+                  driver.size(), static_cast<unsigned long long>(max_ns),
+                  static_cast<unsigned long long>(clock.to_nanos(histogram.percentile(0.999))),
+                  static_cast<unsigned long long>(clock.to_nanos(histogram.percentile(0.9999))), boundaries);
+      summary.all.merge(histogram);
+      if (boundaries > 0) {
+        summary.rehash_windows++;
+      }
+      if (max_ns > summary.worst_window_max_ns) {
+        summary.worst_window_max_ns = max_ns;
+      }
+      histogram.reset();
+      window_index++;
+    }
+  }
+  std::fflush(stdout);
+  std::fprintf(stderr, "%s: %llu inserts, %llu windows (%zu with rehash boundaries), "
+                       "p99.9 %lluns, p99.99 %lluns, max %lluns\n",
+               name, static_cast<unsigned long long>(keys), static_cast<unsigned long long>(window_index),
+               summary.rehash_windows, static_cast<unsigned long long>(clock.to_nanos(summary.all.percentile(0.999))),
+               static_cast<unsigned long long>(clock.to_nanos(summary.all.percentile(0.9999))),
+               static_cast<unsigned long long>(summary.worst_window_max_ns));
+}
+
+int main(int argc, char **argv) {
+  std::string map = argc > 1 ? argv[1] : "smooth";
+  uint64_t keys = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100000000;
+  uint64_t window = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1000000;
+  if (keys == 0 || window == 0) {
+    std::fprintf(stderr, "usage: %s [smooth|std|redis_style] [keys] [window]\n", argv[0]);
+    return 1;
+  }
+  if (map == "smooth") {
+    run<smooth_driver>("smooth", keys, window);
+  } else if (map == "std") {
+    run<std_driver>("std", keys, window);
+  } else if (map == "redis_style") {
+    run<redis_style_driver>("redis_style", keys, window);
+  } else {
+    std::fprintf(stderr, "unknown map '%s'; expected smooth, std or redis_style\n", map.c_str());
+    return 1;
+  }
+  return 0;
+}
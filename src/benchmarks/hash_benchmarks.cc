@@ -0,0 +1,113 @@
+#include "benchmark/benchmark.h"
+#include "smooth/hash.h"
+#include "smooth/hashmap.h"
+#include <functional>
+#include <string>
+
+using namespace smooth;
+
+static void BM_StdHashInteger(benchmark::State &state) {
+  std::hash<uint64_t> hasher;
+  uint64_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hasher(i++));
+  }
+}
+BENCHMARK(BM_StdHashInteger);
+
+static void BM_SmoothHashInteger(benchmark::State &state) {
+  hash<uint64_t> hasher;
+  uint64_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hasher(i++));
+  }
+}
+BENCHMARK(BM_SmoothHashInteger);
+
+static void BM_StdHashString(benchmark::State &state) {
+  std::string text(state.range(0), 'x');
+  std::hash<std::string> hasher;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hasher(text));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_StdHashString)->RangeMultiplier(4)->Range(4, 64 << 10);
+
+static void BM_SmoothHashString(benchmark::State &state) {
+  std::string text(state.range(0), 'x');
+  hash<std::string> hasher;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hasher(text));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SmoothHashString)->RangeMultiplier(4)->Range(4, 64 << 10);
+
+static void BM_SmoothHashStringScalar(benchmark::State &state) {
+  std::string text(state.range(0), 'x');
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hash_bytes_scalar(text.data(), text.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SmoothHashStringScalar)->RangeMultiplier(4)->Range(256, 64 << 10);
+
+// Sequential keys are the worst case for an identity hash under
+// power-of-two masking.
+template<typename Hash>
+static void BM_HashMapSequentialFind(benchmark::State &state) {
+  hashmap<uint64_t, uint64_t, Hash> map;
+  uint64_t n = static_cast<uint64_t>(state.range(0));
+  for (uint64_t i = 0; i < n; i++) {
+    map.insert(std::make_pair(i << 10, i));
+  }
+  uint64_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map.find((i++ % n) << 10));
+  }
+}
+BENCHMARK_TEMPLATE(BM_HashMapSequentialFind, std::hash<uint64_t>)->Arg(1 << 16);
+BENCHMARK_TEMPLATE(BM_HashMapSequentialFind, hash<uint64_t>)->Arg(1 << 16);
+
+static void BM_KeyedHashInteger(benchmark::State &state) {
+  keyed_hash<uint64_t> hasher;
+  uint64_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hasher(i++));
+  }
+}
+BENCHMARK(BM_KeyedHashInteger);
+
+static void BM_KeyedHashString(benchmark::State &state) {
+  std::string text(state.range(0), 'x');
+  keyed_hash<std::string> hasher;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hasher(text));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_KeyedHashString)->RangeMultiplier(4)->Range(4, 64 << 10);
+
+// Collision attack: keys that differ only above bit 24 share a bucket under
+// an identity hash with power-of-two masking, so every insert and lookup
+// walks one chain. Time per operation should stay flat as the attack grows
+// with a keyed hash, and grow linearly with std::hash.
+template<typename Hash>
+static void BM_CollisionAttack(benchmark::State &state) {
+  uint64_t n = static_cast<uint64_t>(state.range(0));
+  for (auto _ : state) {
+    hashmap<uint64_t, uint64_t, Hash> map;
+    for (uint64_t i = 0; i < n; i++) {
+      map.insert(std::make_pair(i << 24, i));
+    }
+    for (uint64_t i = 0; i < n; i++) {
+      benchmark::DoNotOptimize(map.find(i << 24));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * n * 2);
+}
+BENCHMARK_TEMPLATE(BM_CollisionAttack, std::hash<uint64_t>)->RangeMultiplier(4)->Range(256, 4096);
+BENCHMARK_TEMPLATE(BM_CollisionAttack, keyed_hash<uint64_t>)->RangeMultiplier(4)->Range(256, 4096);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,46 @@
+#include "benchmark/benchmark.h"
+#include "smooth/hashmap.h"
+#include <string>
+
+using namespace smooth;
+
+// Bytes per entry, by component, as the map grows. The timing is of the
+// inserts; the counters are what to look at.
+template<typename Mapped>
+static Mapped make_value(uint64_t i, size_t length);
+
+template<>
+uint64_t make_value<uint64_t>(uint64_t i, size_t) {
+  return i;
+}
+
+template<>
+std::string make_value<std::string>(uint64_t i, size_t length) {
+  std::string value(length, 'v');
+  value[0] = static_cast<char>('a' + i % 26);
+  return value;
+}
+
+template<typename Mapped>
+static void BM_BytesPerEntry(benchmark::State &state) {
+  uint64_t n = static_cast<uint64_t>(state.range(0));
+  size_t value_length = static_cast<size_t>(state.range(1));
+  memory_breakdown usage;
+  for (auto _ : state) {
+    hashmap<uint64_t, Mapped> map;
+    for (uint64_t i = 0; i < n; i++) {
+      map.insert(std::make_pair(i, make_value<Mapped>(i, value_length)));
+    }
+    usage = map.memory_usage();
+  }
+  double entries = static_cast<double>(n);
+  state.counters["bytes_per_entry"] = usage.total() / entries;
+  state.counters["buckets"] = (usage.bucket_heap_bytes + usage.bucket_mmap_bytes) / entries;
+  state.counters["nodes"] = (usage.list_node_bytes + usage.tree_node_bytes) / entries;
+  state.counters["payload"] = usage.payload_bytes / entries;
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK_TEMPLATE(BM_BytesPerEntry, uint64_t)->RangeMultiplier(8)->Ranges({{1 << 10, 1 << 20}, {0, 0}});
+BENCHMARK_TEMPLATE(BM_BytesPerEntry, std::string)->RangeMultiplier(8)->Ranges({{1 << 10, 1 << 20}, {8, 64}});
+
+BENCHMARK_MAIN();
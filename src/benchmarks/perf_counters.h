@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware performance counters around benchmark workloads, through Linux
+// perf_event_open. Counters the CPU, kernel or perf_event_paranoid setting
+// do not allow are left out rather than failing the benchmark; elsewhere
+// than Linux none are available. Only user-space events of this thread are
+// counted.
+enum perf_counter_id {
+  k_perf_cycles,
+  k_perf_instructions,
+  k_perf_l1d_misses,
+  k_perf_llc_misses,
+  k_perf_dtlb_misses,
+  k_perf_branch_misses,
+  k_num_perf_counters
+};
+
+inline const char *perf_counter_name(perf_counter_id id) {
+  static const char *const names[k_num_perf_counters] = {"cycles", "instructions", "l1d_misses",
+                                                         "llc_misses", "dtlb_misses", "branch_misses"};
+  return names[id];
+}
+
+class perf_counters {
+public:
+  perf_counters() {
+    for (size_t i = 0; i < k_num_perf_counters; i++) {
+      fds_[i] = open(static_cast<perf_counter_id>(i));
+      totals_[i] = 0;
+    }
+  }
+
+  ~perf_counters() {
+#ifdef __linux__
+    for (size_t i = 0; i < k_num_perf_counters; i++) {
+      if (fds_[i] >= 0) {
+        close(fds_[i]);
+      }
+    }
+#endif
+  }
+
+  perf_counters(const perf_counters &) = delete;
+  perf_counters &operator=(const perf_counters &) = delete;
+
+  bool available(perf_counter_id id) const { return fds_[id] >= 0; }
+
+  bool any_available() const {
+    for (size_t i = 0; i < k_num_perf_counters; i++) {
+      if (fds_[i] >= 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Count from here until stop(); start() and stop() pairs accumulate.
+  void start() {
+#ifdef __linux__
+    for (size_t i = 0; i < k_num_perf_counters; i++) {
+      if (fds_[i] >= 0) {
+        ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+  }
+
+  void stop() {
+#ifdef __linux__
+    for (size_t i = 0; i < k_num_perf_counters; i++) {
+      if (fds_[i] >= 0) {
+        ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+      }
+    }
+    for (size_t i = 0; i < k_num_perf_counters; i++) {
+      if (fds_[i] >= 0) {
+        totals_[i] += read_scaled(fds_[i]);
+      }
+    }
+#endif
+  }
+
+  // Events counted between all start() and stop() pairs so far.
+  uint64_t total(perf_counter_id id) const { return totals_[id]; }
+
+  void reset() {
+    for (size_t i = 0; i < k_num_perf_counters; i++) {
+      totals_[i] = 0;
+    }
+  }
+
+  // Available counters divided by ops, as "name=value" pairs for a report.
+  std::string per_op(uint64_t ops) const {
+    std::string out;
+    char buf[64];
+    for (size_t i = 0; i < k_num_perf_counters; i++) {
+      if (fds_[i] < 0) {
+        continue;
+      }
+      std::snprintf(buf, sizeof(buf), "%s%s/op=%.2f", out.empty() ? "" : " ",
+                    perf_counter_name(static_cast<perf_counter_id>(i)),
+                    ops == 0 ? 0.0 : static_cast<double>(totals_[i]) / ops);
+      out += buf;
+    }
+    return out;
+  }
+
+private:
+#ifdef __linux__
+  static uint64_t cache_miss(uint64_t cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  }
+
+  static int open(perf_counter_id id) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    switch (id) {
+      case k_perf_cycles: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+      case k_perf_instructions: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+      case k_perf_l1d_misses: attr.type = PERF_TYPE_HW_CACHE; attr.config = cache_miss(PERF_COUNT_HW_CACHE_L1D); break;
+      case k_perf_llc_misses: attr.type = PERF_TYPE_HW_CACHE; attr.config = cache_miss(PERF_COUNT_HW_CACHE_LL); break;
+      case k_perf_dtlb_misses: attr.type = PERF_TYPE_HW_CACHE; attr.config = cache_miss(PERF_COUNT_HW_CACHE_DTLB); break;
+      case k_perf_branch_misses: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+      default: return -1;
+    }
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // The PMU has fewer counters than events here; the kernel time-shares
+    // them, and these let read_scaled() extrapolate.
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+
+  static uint64_t read_scaled(int fd) {
+    uint64_t values[3];
+    if (::read(fd, values, sizeof(values)) != static_cast<ssize_t>(sizeof(values)) || values[2] == 0) {
+      return 0;
+    }
+    if (values[2] >= values[1]) {
+      return values[0];
+    }
+    return static_cast<uint64_t>(static_cast<double>(values[0]) * values[1] / values[2]);
+  }
+#else
+  static int open(perf_counter_id) { return -1; }
+#endif
+
+  int fds_[k_num_perf_counters];
+  uint64_t totals_[k_num_perf_counters];
+};
@@ -0,0 +1,244 @@
+#pragma once
+
+#include "smooth/hash.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// A chained hash table built to the design of the Redis 6.2 dict, for
+// uint64_t keys and values, as a baseline for the benchmarks. It is written
+// for this repository and is not Redis code, so its numbers stand for the
+// design, not for a particular Redis build. What it shares with that
+// design:
+//   - two tables of power-of-two size, at least 4 buckets, and a rehash
+//     index; during a rehash new entries go to the second table;
+//   - each find, insert and erase first moves one bucket of the first
+//     table, visiting at most 10 empty buckets to find it;
+//   - growth to the next power of two above size + 1 when the load factor
+//     reaches 1;
+//   - shrinking after an erase leaves the table under 10% full, the check
+//     the Redis server runs from its cron job;
+//   - 24-byte entries holding key, value and next pointer, pushed at the
+//     head of their chain.
+class redis_style_dict {
+public:
+  redis_style_dict() : rehash_index_(-1) {}
+
+  ~redis_style_dict() {
+    release(tables_[0]);
+    release(tables_[1]);
+  }
+
+  redis_style_dict(const redis_style_dict &) = delete;
+  redis_style_dict &operator=(const redis_style_dict &) = delete;
+
+  bool insert(uint64_t key, uint64_t value) {
+    rehash_step();
+    expand_if_needed();
+    uint64_t hash = hash_of(key);
+    if (lookup(key, hash) != nullptr) {
+      return false;
+    }
+    table &t = is_rehashing() ? tables_[1] : tables_[0];
+    size_t index = hash & (t.size - 1);
+    entry *e = new entry;
+    e->key = key;
+    e->value = value;
+    e->next = t.buckets[index];
+    t.buckets[index] = e;
+    t.used++;
+    return true;
+  }
+
+  // The value of key, or null if absent. Not const: lookups also rehash.
+  const uint64_t *find(uint64_t key) {
+    if (size() == 0) {
+      return nullptr;
+    }
+    rehash_step();
+    entry *e = lookup(key, hash_of(key));
+    return e == nullptr ? nullptr : &e->value;
+  }
+
+  bool erase(uint64_t key) {
+    if (size() == 0) {
+      return false;
+    }
+    rehash_step();
+    uint64_t hash = hash_of(key);
+    for (int which = 0; which < 2; which++) {
+      table &t = tables_[which];
+      if (t.size == 0) {
+        break;
+      }
+      entry **link = &t.buckets[hash & (t.size - 1)];
+      for (entry *e = *link; e != nullptr; link = &e->next, e = e->next) {
+        if (e->key == key) {
+          *link = e->next;
+          delete e;
+          t.used--;
+          shrink_if_sparse();
+          return true;
+        }
+      }
+      if (!is_rehashing()) {
+        break;
+      }
+    }
+    return false;
+  }
+
+  size_t size() const { return tables_[0].used + tables_[1].used; }
+
+  size_t bucket_count() const { return tables_[0].size + tables_[1].size; }
+
+  bool is_rehashing() const { return rehash_index_ >= 0; }
+
+  // Bytes requested from the allocator, without its per-allocation
+  // overhead, to compare with smooth::hashmap::memory_usage().total().
+  size_t memory_bytes() const { return sizeof(*this) + bucket_count() * sizeof(entry *) + size() * sizeof(entry); }
+
+private:
+  static const size_t k_initial_size = 4;
+  static const int k_empty_visits_per_step = 10;
+  static const size_t k_min_fill_percent = 10;
+
+  struct entry {
+    uint64_t key;
+    uint64_t value;
+    entry *next;
+  };
+
+  struct table {
+    entry **buckets;
+    size_t size;
+    size_t used;
+
+    table() : buckets(nullptr), size(0), used(0) {}
+  };
+
+  static uint64_t hash_of(uint64_t key) { return smooth::hash_mix64(key); }
+
+  static size_t next_power(size_t size) {
+    size_t power = k_initial_size;
+    while (power < size) {
+      power *= 2;
+    }
+    return power;
+  }
+
+  static void release(table &t) {
+    for (size_t i = 0; i < t.size && t.used > 0; i++) {
+      entry *e = t.buckets[i];
+      while (e != nullptr) {
+        entry *next = e->next;
+        delete e;
+        t.used--;
+        e = next;
+      }
+    }
+    std::free(t.buckets);
+    t = table();
+  }
+
+  entry *lookup(uint64_t key, uint64_t hash) const {
+    for (int which = 0; which < 2; which++) {
+      const table &t = tables_[which];
+      if (t.size == 0) {
+        break;
+      }
+      for (entry *e = t.buckets[hash & (t.size - 1)]; e != nullptr; e = e->next) {
+        if (e->key == key) {
+          return e;
+        }
+      }
+      if (!is_rehashing()) {
+        break;
+      }
+    }
+    return nullptr;
+  }
+
+  // Start a rehash into a table of next_power(size) buckets, or make the
+  // first table. False when rehashing already or nothing would change.
+  bool expand(size_t size) {
+    if (is_rehashing() || tables_[0].used > size) {
+      return false;
+    }
+    size_t buckets = next_power(size);
+    if (buckets == tables_[0].size) {
+      return false;
+    }
+    table t;
+    t.buckets = static_cast<entry **>(std::calloc(buckets, sizeof(entry *)));
+    if (t.buckets == nullptr) {
+      throw std::bad_alloc();
+    }
+    t.size = buckets;
+    if (tables_[0].buckets == nullptr) {
+      tables_[0] = t;
+    } else {
+      tables_[1] = t;
+      rehash_index_ = 0;
+    }
+    return true;
+  }
+
+  void expand_if_needed() {
+    if (is_rehashing()) {
+      return;
+    }
+    if (tables_[0].size == 0) {
+      expand(k_initial_size);
+    } else if (tables_[0].used >= tables_[0].size) {
+      expand(tables_[0].used + 1);
+    }
+  }
+
+  void shrink_if_sparse() {
+    size_t slots = bucket_count();
+    if (slots > k_initial_size && size() * 100 / slots < k_min_fill_percent && !is_rehashing()) {
+      expand(tables_[0].used < k_initial_size ? k_initial_size : tables_[0].used);
+    }
+  }
+
+  // Move one bucket from the first table to the second.
+  void rehash_step() {
+    if (!is_rehashing()) {
+      return;
+    }
+    table &from = tables_[0];
+    table &to = tables_[1];
+    if (from.used != 0) {
+      int empty_visits = k_empty_visits_per_step;
+      while (from.buckets[rehash_index_] == nullptr) {
+        rehash_index_++;
+        if (--empty_visits == 0) {
+          return;
+        }
+      }
+      entry *e = from.buckets[rehash_index_];
+      while (e != nullptr) {
+        entry *next = e->next;
+        size_t index = hash_of(e->key) & (to.size - 1);
+        e->next = to.buckets[index];
+        to.buckets[index] = e;
+        from.used--;
+        to.used++;
+        e = next;
+      }
+      from.buckets[rehash_index_] = nullptr;
+      rehash_index_++;
+    }
+    if (from.used == 0) {
+      std::free(from.buckets);
+      tables_[0] = tables_[1];
+      tables_[1] = table();
+      rehash_index_ = -1;
+    }
+  }
+
+  table tables_[2];
+  long rehash_index_;
+};
@@ -0,0 +1,131 @@
+#include "benchmark/benchmark.h"
+#include "smooth/hash.h"
+#include "smooth/hashmap.h"
+#include "smooth/latency.h"
+#include "src/benchmarks/redis_style_dict.h"
+#include <cstdint>
+
+// smooth::hashmap against redis_style_dict, built to the Redis dict
+// design, on uint64_t keys: throughput of insert (growing from empty, so it
+// includes incremental rehashing), hit and miss lookups and erase, plus
+// bytes per entry and insert tail latency counters. growth_latency has the per-window view of the tail.
+
+using namespace smooth;
+
+class smooth_adapter {
+public:
+  bool insert(uint64_t key, uint64_t value) { return map_.insert(std::make_pair(key, value)).second; }
+
+  const uint64_t *find(uint64_t key) {
+    auto it = map_.find(key);
+    return it == map_.end() ? nullptr : &it->second;
+  }
+
+  bool erase(uint64_t key) { return map_.erase(key) == 1; }
+
+  size_t size() const { return map_.size(); }
+
+  size_t memory_bytes() const { return map_.memory_usage().total(); }
+
+private:
+  hashmap<uint64_t, uint64_t> map_;
+};
+
+static uint64_t key_of(uint64_t i) {
+  return hash_mix64(i);
+}
+
+template<typename Map>
+static void fill(Map &map, uint64_t n) {
+  for (uint64_t i = 0; i < n; i++) {
+    map.insert(key_of(i), i);
+  }
+}
+
+// Each insert is timed on its own for the tail counters.
+template<typename Map>
+static void BM_Insert(benchmark::State &state) {
+  uint64_t n = static_cast<uint64_t>(state.range(0));
+  tsc_clock clock;
+  latency_histogram latencies;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    Map *map = new Map();
+    for (uint64_t i = 0; i < n; i++) {
+      uint64_t start = tsc_clock::now();
+      map->insert(key_of(i), i);
+      uint64_t end = tsc_clock::now();
+      latencies.record(end > start ? end - start : 0);
+    }
+    state.PauseTiming();
+    bytes = map->memory_bytes();
+    delete map;
+    state.ResumeTiming();
+  }
+  clock.calibrate();
+  state.SetItemsProcessed(state.iterations() * n);
+  state.counters["bytes_per_entry"] = static_cast<double>(bytes) / n;
+  state.counters["p99_ns"] = static_cast<double>(clock.to_nanos(latencies.percentile(0.99)));
+  state.counters["p99.99_ns"] = static_cast<double>(clock.to_nanos(latencies.percentile(0.9999)));
+  state.counters["max_ns"] = static_cast<double>(clock.to_nanos(latencies.max()));
+}
+
+template<typename Map>
+static void BM_FindHit(benchmark::State &state) {
+  uint64_t n = static_cast<uint64_t>(state.range(0));
+  Map map;
+  fill(map, n);
+  uint64_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map.find(key_of(i)));
+    if (++i == n) {
+      i = 0;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+template<typename Map>
+static void BM_FindMiss(benchmark::State &state) {
+  uint64_t n = static_cast<uint64_t>(state.range(0));
+  Map map;
+  fill(map, n);
+  uint64_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map.find(key_of(n + i)));
+    if (++i == n) {
+      i = 0;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Erases everything, so both maps shrink along the way.
+template<typename Map>
+static void BM_Erase(benchmark::State &state) {
+  uint64_t n = static_cast<uint64_t>(state.range(0));
+  for (auto _ : state) {
+    state.PauseTiming();
+    Map *map = new Map();
+    fill(*map, n);
+    state.ResumeTiming();
+    for (uint64_t i = 0; i < n; i++) {
+      benchmark::DoNotOptimize(map->erase(key_of(i)));
+    }
+    state.PauseTiming();
+    delete map;
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+#define SMOOTH_REDIS_BENCHMARK(workload)                                                              \
+  BENCHMARK_TEMPLATE(workload, smooth_adapter)->RangeMultiplier(10)->Range(1000, 10000000);         \
+  BENCHMARK_TEMPLATE(workload, redis_style_dict)->RangeMultiplier(10)->Range(1000, 10000000)
+
+SMOOTH_REDIS_BENCHMARK(BM_Insert);
+SMOOTH_REDIS_BENCHMARK(BM_FindHit);
+SMOOTH_REDIS_BENCHMARK(BM_FindMiss);
+SMOOTH_REDIS_BENCHMARK(BM_Erase);
+
+BENCHMARK_MAIN();
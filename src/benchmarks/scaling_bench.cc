@@ -0,0 +1,450 @@
+// Throughput of smooth::hashmap<uint64_t, uint64_t> on 1 to N threads, as
+// scaling curves per configuration and operation mix.
+//
+//   scaling_bench [--threads=N] [--keys=N] [--seconds=X]
+//                 [--placement=compact|spread] [--configs=private,mutex,sharded]
+//                 [--mixes=read_only,read_mostly,write_heavy]
+//
+// Configurations:
+//   private  each thread has its own map of keys elements, so nothing is
+//            shared; the curve is bounded by memory bandwidth and caches.
+//   mutex    one shared map of keys elements behind a std::mutex.
+//   sharded  one shared key space over k_shards maps, each behind its own
+//            mutex. smooth has no concurrent map; this is the simplest
+//            thing one would build, and the curve a concurrent variant
+//            should beat.
+//
+// Mixes are the share of finds; the other operations erase a present key
+// and insert it again, so sizes stay put and writes allocate as real
+// updates of node-based maps do. Thread counts are the powers of two up to
+// --threads (default: all CPUs) and --threads itself.
+//
+// Threads are pinned. compact fills one NUMA node's CPUs before the next;
+// spread deals threads round-robin over the nodes, so the curves of the
+// two show the cost of crossing sockets. Private maps are built by their
+// own thread and so sit in its node's memory; shared maps are built by
+// thread 0. Output is CSV on stdout. To plot one mix:
+//
+//   scaling_bench > scaling.csv
+//   gnuplot -p -e "set datafile separator ','; set key left; plot for [c in 'private mutex sharded'] '< grep ^'.c.',read_mostly scaling.csv' using 3:5 with linespoints title c"
+
+#include "smooth/hash.h"
+#include "smooth/hashmap.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace smooth;
+
+typedef hashmap<uint64_t, uint64_t> map_type;
+
+const size_t k_shards = 64;
+const size_t k_cache_line = 64;
+// Operations between checks of the stop flag.
+const uint64_t k_ops_per_check = 256;
+
+static uint64_t key_of(uint64_t i) {
+  return hash_mix64(i);
+}
+
+static void fill(map_type &map, uint64_t keys) {
+  for (uint64_t i = 0; i < keys; i++) {
+    map.insert(std::make_pair(key_of(i), i));
+  }
+}
+
+class private_target {
+public:
+  private_target(size_t threads, uint64_t keys) : maps_(threads), keys_(keys) {}
+
+  void setup(size_t thread) {
+    maps_[thread].reset(new map_type());
+    fill(*maps_[thread], keys_);
+  }
+
+  bool find(size_t thread, uint64_t key) {
+    map_type &map = *maps_[thread];
+    return map.find(key) != map.end();
+  }
+
+  void replace(size_t thread, uint64_t key) {
+    map_type &map = *maps_[thread];
+    map.erase(key);
+    map.insert(std::make_pair(key, key));
+  }
+
+private:
+  std::vector<std::unique_ptr<map_type>> maps_;
+  uint64_t keys_;
+};
+
+class mutex_target {
+public:
+  mutex_target(size_t, uint64_t keys) : keys_(keys) {}
+
+  void setup(size_t thread) {
+    if (thread == 0) {
+      fill(map_, keys_);
+    }
+  }
+
+  bool find(size_t, uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return map_.find(key) != map_.end();
+  }
+
+  void replace(size_t, uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    map_.erase(key);
+    map_.insert(std::make_pair(key, key));
+  }
+
+private:
+  std::mutex mutex_;
+  map_type map_;
+  uint64_t keys_;
+};
+
+class sharded_target {
+public:
+  sharded_target(size_t, uint64_t keys) : shards_(k_shards), keys_(keys) {}
+
+  void setup(size_t thread) {
+    if (thread == 0) {
+      for (uint64_t i = 0; i < keys_; i++) {
+        uint64_t key = key_of(i);
+        shards_[shard_of(key)].map.insert(std::make_pair(key, i));
+      }
+    }
+  }
+
+  bool find(size_t, uint64_t key) {
+    shard &s = shards_[shard_of(key)];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.map.find(key) != s.map.end();
+  }
+
+  void replace(size_t, uint64_t key) {
+    shard &s = shards_[shard_of(key)];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.map.erase(key);
+    s.map.insert(std::make_pair(key, key));
+  }
+
+private:
+  // Padded so that neighbouring locks do not share a cache line.
+  struct shard {
+    std::mutex mutex;
+    map_type map;
+    char padding[k_cache_line];
+  };
+
+  // The top bits, which the maps' bucket index does not use.
+  static size_t shard_of(uint64_t key) { return static_cast<size_t>(hash_mix64(key) >> 58) % k_shards; }
+
+  std::vector<shard> shards_;
+  uint64_t keys_;
+};
+
+// CPUs of each NUMA node, from sysfs; a single node of every CPU where it
+// is not available.
+static std::vector<std::vector<int>> numa_nodes() {
+  std::vector<std::vector<int>> nodes;
+#ifdef __linux__
+  for (int node = 0;; node++) {
+    std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    if (!in) {
+      break;
+    }
+    // A list of ranges such as "0-7,16-23".
+    std::vector<int> cpus;
+    std::string range;
+    while (std::getline(in, range, ',')) {
+      int first = 0;
+      int last = 0;
+      int fields = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+      if (fields < 1) {
+        continue;
+      }
+      if (fields == 1) {
+        last = first;
+      }
+      for (int cpu = first; cpu <= last; cpu++) {
+        cpus.push_back(cpu);
+      }
+    }
+    if (!cpus.empty()) {
+      nodes.push_back(cpus);
+    }
+  }
+#endif
+  if (nodes.empty()) {
+    unsigned cpus = std::thread::hardware_concurrency();
+    nodes.push_back(std::vector<int>());
+    for (unsigned cpu = 0; cpu < (cpus == 0 ? 1 : cpus); cpu++) {
+      nodes.back().push_back(static_cast<int>(cpu));
+    }
+  }
+  return nodes;
+}
+
+struct placement {
+  int cpu;
+  size_t node;
+};
+
+// CPU and node of thread i. Threads beyond the CPU count wrap around.
+static placement place(const std::vector<std::vector<int>> &nodes, bool spread, size_t i) {
+  size_t total = 0;
+  for (const auto &cpus : nodes) {
+    total += cpus.size();
+  }
+  i %= total;
+  if (spread) {
+    // Round-robin over the nodes, skipping those with no CPUs left.
+    size_t round = 0;
+    for (;;) {
+      for (size_t node = 0; node < nodes.size(); node++) {
+        if (round < nodes[node].size()) {
+          if (i == 0) {
+            placement p = {nodes[node][round], node};
+            return p;
+          }
+          i--;
+        }
+      }
+      round++;
+    }
+  }
+  for (size_t node = 0;; node++) {
+    if (i < nodes[node].size()) {
+      placement p = {nodes[node][i], node};
+      return p;
+    }
+    i -= nodes[node].size();
+  }
+}
+
+static void pin_to(int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void)cpu;
+#endif
+}
+
+// Padded to a cache line so that threads do not write to shared lines.
+struct thread_result {
+  uint64_t ops;
+  uint64_t found;  // Keeps the finds from being optimized away
+  char padding[k_cache_line - 2 * sizeof(uint64_t)];
+};
+
+struct run_options {
+  uint64_t keys;
+  double seconds;
+  uint32_t find_per_mille;
+  bool spread;
+};
+
+// Runs one configuration on threads threads; returns operations per
+// second over all threads, and the number of nodes they span in nodes_used.
+template<typename Target>
+static double run(const run_options &options, const std::vector<std::vector<int>> &nodes, size_t threads,
+                  size_t &nodes_used) {
+  Target target(threads, options.keys);
+  std::vector<thread_result> results(threads);
+  std::atomic<size_t> ready(0);
+  std::atomic<bool> go(false);
+  std::atomic<bool> stop(false);
+  std::vector<bool> node_used(nodes.size(), false);
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; t++) {
+    placement where = place(nodes, options.spread, t);
+    node_used[where.node] = true;
+    workers.push_back(std::thread([&, t, where]() {
+      pin_to(where.cpu);
+      target.setup(t);
+      ready++;
+      while (!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      uint64_t x = 0x9e3779b97f4a7c15ull * (t + 1);
+      uint64_t ops = 0;
+      uint64_t found = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (uint64_t i = 0; i < k_ops_per_check; i++) {
+          x = x * 6364136223846793005ull + 1442695040888963407ull;
+          uint64_t key = key_of((x >> 33) % options.keys);
+          if ((x >> 20) % 1000 < options.find_per_mille) {
+            found += target.find(t, key);
+          } else {
+            target.replace(t, key);
+          }
+        }
+        ops += k_ops_per_check;
+      }
+      results[t].ops = ops;
+      results[t].found = found;
+    }));
+  }
+  while (ready.load() < threads) {
+    std::this_thread::yield();
+  }
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+  stop.store(true);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  uint64_t ops = 0;
+  uint64_t found = 0;
+  for (const thread_result &result : results) {
+    ops += result.ops;
+    found += result.found;
+  }
+  if (found == 0 && options.find_per_mille > 0) {
+    std::fprintf(stderr, "no key found\n");
+  }
+  nodes_used = static_cast<size_t>(std::count(node_used.begin(), node_used.end(), true));
+  return ops / elapsed;
+}
+
+struct mix {
+  const char *name;
+  uint32_t find_per_mille;
+};
+
+const mix k_mixes[] = {{"read_only", 1000}, {"read_mostly", 950}, {"write_heavy", 500}};
+
+const char *const k_configs[] = {"private", "mutex", "sharded"};
+
+static bool parse_flag(const std::string &arg, const char *name, std::string &value) {
+  std::string prefix = std::string("--") + name + "=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  value = arg.substr(prefix.size());
+  return true;
+}
+
+// Whether name is in the comma-separated list, or the list is empty.
+static bool selected(const std::string &list, const char *name) {
+  if (list.empty()) {
+    return true;
+  }
+  std::stringstream in(list);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    if (item == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static int usage(const char *program) {
+  std::fprintf(stderr,
+               "usage: %s [--threads=N] [--keys=N] [--seconds=X] [--placement=compact|spread]\n"
+               "       [--configs=private,mutex,sharded] [--mixes=read_only,read_mostly,write_heavy]\n",
+               program);
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  std::vector<std::vector<int>> nodes = numa_nodes();
+  size_t cpus = 0;
+  for (const auto &node : nodes) {
+    cpus += node.size();
+  }
+  size_t max_threads = cpus;
+  run_options options;
+  options.keys = 1000000;
+  options.seconds = 1.0;
+  options.find_per_mille = 1000;
+  options.spread = false;
+  std::string configs;
+  std::string mixes;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    std::string value;
+    if (parse_flag(arg, "threads", value)) {
+      max_threads = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (parse_flag(arg, "keys", value)) {
+      options.keys = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (parse_flag(arg, "seconds", value)) {
+      options.seconds = std::strtod(value.c_str(), nullptr);
+    } else if (parse_flag(arg, "placement", value) && (value == "compact" || value == "spread")) {
+      options.spread = value == "spread";
+    } else if (parse_flag(arg, "configs", value)) {
+      configs = value;
+    } else if (parse_flag(arg, "mixes", value)) {
+      mixes = value;
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (max_threads == 0 || options.keys == 0 || options.seconds <= 0) {
+    return usage(argv[0]);
+  }
+
+  std::vector<size_t> thread_counts;
+  for (size_t n = 1; n < max_threads; n *= 2) {
+    thread_counts.push_back(n);
+  }
+  thread_counts.push_back(max_threads);
+
+  std::fprintf(stderr, "%zu CPUs on %zu NUMA nodes, %s placement, %llu keys\n", cpus, nodes.size(),
+               options.spread ? "spread" : "compact", static_cast<unsigned long long>(options.keys));
+  std::printf("config,mix,threads,nodes,ops_per_sec,speedup,efficiency\n");
+  for (const char *config : k_configs) {
+    if (!selected(configs, config)) {
+      continue;
+    }
+    for (const mix &m : k_mixes) {
+      if (!selected(mixes, m.name)) {
+        continue;
+      }
+      options.find_per_mille = m.find_per_mille;
+      double single = 0;
+      for (size_t threads : thread_counts) {
+        size_t nodes_used = 0;
+        double rate;
+        if (std::string(config) == "private") {
+          rate = run<private_target>(options, nodes, threads, nodes_used);
+        } else if (std::string(config) == "mutex") {
+          rate = run<mutex_target>(options, nodes, threads, nodes_used);
+        } else {
+          rate = run<sharded_target>(options, nodes, threads, nodes_used);
+        }
+        if (threads == 1) {
+          single = rate;
+        }
+        double speedup = single > 0 ? rate / single : 0;
+        std::printf("%s,%s,%zu,%zu,%.0f,%.2f,%.2f\n", config, m.name, threads, nodes_used, rate, speedup,
+                    speedup / threads);
+        std::fflush(stdout);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,354 @@
+#include "benchmark/benchmark.h"
+#include "smooth/fixed_hashmap.h"
+#include "smooth/hash.h"
+#include "smooth/hashmap.h"
+#include "src/benchmarks/perf_counters.h"
+#ifdef SMOOTH_COUNT_ALLOCATIONS
+#include "src/benchmarks/alloc_counter.h"
+#endif
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// hashmap, fixed_hashmap and std::unordered_map side by side on the same
+// workloads, key types and sizes. Each benchmark name reads
+// BM_<workload><<key>, <map>>/<size>. Select with --benchmark_filter and get
+// JSON with --benchmark_format=json or --benchmark_out=<file>; the largest
+// sizes need several GB of memory. Where perf_event_open is allowed, the
+// hardware counters of the timed region are reported per operation as
+// cycles/op, instructions/op, l1d_misses/op and so on. The
+// smooth_alloc_benchmarks build of this file also reports heap allocations
+// and bytes per operation; its times include the counting.
+
+using namespace smooth;
+
+struct pod32 {
+  uint64_t words[4];
+
+  bool operator==(const pod32 &other) const { return std::memcmp(words, other.words, sizeof(words)) == 0; }
+  // Tree buckets order their keys.
+  bool operator<(const pod32 &other) const { return std::memcmp(words, other.words, sizeof(words)) < 0; }
+};
+
+namespace smooth {
+template<>
+struct is_trivially_hashable<pod32> : std::true_type {};
+}  // namespace smooth
+
+struct short_string {};  // Fits the small-string buffer
+struct long_string {};   // Always on the heap
+
+// Key i of a benchmark, spread over the key space so that neither map gets
+// sequential integers.
+template<typename Tag>
+struct key_maker;
+
+template<>
+struct key_maker<int64_t> {
+  typedef int64_t key_type;
+  static key_type make(uint64_t i) { return static_cast<int64_t>(hash_mix64(i)); }
+};
+
+template<>
+struct key_maker<short_string> {
+  typedef std::string key_type;
+  static key_type make(uint64_t i) { return std::to_string(hash_mix64(i) % 1000000000000ull); }
+};
+
+template<>
+struct key_maker<long_string> {
+  typedef std::string key_type;
+  static key_type make(uint64_t i) {
+    return "benchmark/long/key/" + std::to_string(hash_mix64(i)) + "/padding-padding";
+  }
+};
+
+template<>
+struct key_maker<pod32> {
+  typedef pod32 key_type;
+  static key_type make(uint64_t i) {
+    uint64_t h = hash_mix64(i);
+    pod32 key = {{h, ~h, h ^ 0x5555555555555555ull, i}};
+    return key;
+  }
+};
+
+// std::hash for the standard map, except for pod32, which it lacks.
+template<typename Key>
+struct std_hash_for {
+  typedef std::hash<Key> type;
+};
+
+template<>
+struct std_hash_for<pod32> {
+  typedef smooth::hash<pod32> type;
+};
+
+struct smooth_map {};
+struct smooth_fixed_map {};
+struct std_map {};
+
+// Map of the given kind keyed by Key, created ready for n elements where it
+// must be: fixed_hashmap has a fixed bucket count, the others start empty
+// and grow.
+template<typename Kind, typename Key>
+struct map_maker;
+
+template<typename Key>
+struct map_maker<smooth_map, Key> {
+  typedef hashmap<Key, uint64_t> map_type;
+  static map_type *make(size_t) { return new map_type(); }
+};
+
+template<typename Key>
+struct map_maker<smooth_fixed_map, Key> {
+  typedef fixed_hashmap<Key, uint64_t> map_type;
+  static map_type *make(size_t n) {
+    size_t buckets = 1;
+    while (buckets < n) {
+      buckets <<= 1;
+    }
+    return new map_type(static_cast<int>(buckets));
+  }
+};
+
+template<typename Key>
+struct map_maker<std_map, Key> {
+  typedef std::unordered_map<Key, uint64_t, typename std_hash_for<Key>::type> map_type;
+  static map_type *make(size_t) { return new map_type(); }
+};
+
+template<typename KeyTag, typename Kind>
+struct bench_setup {
+  typedef key_maker<KeyTag> keys;
+  typedef typename keys::key_type key_type;
+  typedef map_maker<Kind, key_type> maker;
+  typedef typename maker::map_type map_type;
+
+  // Keys 0 to n-1 are inserted; n to 2n-1 are misses.
+  static std::vector<key_type> make_keys(size_t first, size_t n) {
+    std::vector<key_type> out;
+    out.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+      out.push_back(keys::make(first + i));
+    }
+    return out;
+  }
+
+  static map_type *filled(const std::vector<key_type> &present) {
+    map_type *map = maker::make(present.size());
+    for (size_t i = 0; i < present.size(); i++) {
+      map->insert(std::make_pair(present[i], static_cast<uint64_t>(i)));
+    }
+    return map;
+  }
+};
+
+// Hardware counters, and allocations where counted, over the timed region
+// of a benchmark.
+class region_counters {
+public:
+  void start() {
+#ifdef SMOOTH_COUNT_ALLOCATIONS
+    alloc_start_ = thread_alloc_stats();
+#endif
+    perf_.start();
+  }
+
+  void stop() {
+    perf_.stop();
+#ifdef SMOOTH_COUNT_ALLOCATIONS
+    allocations_ += thread_alloc_stats() - alloc_start_;
+#endif
+  }
+
+  // Totals per operation as benchmark counters.
+  void report(benchmark::State &state, uint64_t ops) const {
+    if (ops == 0) {
+      return;
+    }
+    for (size_t i = 0; i < k_num_perf_counters; i++) {
+      perf_counter_id id = static_cast<perf_counter_id>(i);
+      if (perf_.available(id)) {
+        state.counters[std::string(perf_counter_name(id)) + "/op"] = static_cast<double>(perf_.total(id)) / ops;
+      }
+    }
+#ifdef SMOOTH_COUNT_ALLOCATIONS
+    state.counters["allocs/op"] = static_cast<double>(allocations_.allocations) / ops;
+    state.counters["frees/op"] = static_cast<double>(allocations_.frees) / ops;
+    state.counters["alloc_bytes/op"] = static_cast<double>(allocations_.bytes) / ops;
+#endif
+  }
+
+private:
+  perf_counters perf_;
+#ifdef SMOOTH_COUNT_ALLOCATIONS
+  alloc_stats alloc_start_;
+  alloc_stats allocations_;
+#endif
+};
+
+template<typename KeyTag, typename Kind>
+static void BM_Insert(benchmark::State &state) {
+  typedef bench_setup<KeyTag, Kind> setup;
+  size_t n = static_cast<size_t>(state.range(0));
+  auto present = setup::make_keys(0, n);
+  region_counters counters;
+  counters.start();
+  for (auto _ : state) {
+    auto *map = setup::maker::make(n);
+    for (size_t i = 0; i < n; i++) {
+      map->insert(std::make_pair(present[i], static_cast<uint64_t>(i)));
+    }
+    state.PauseTiming();
+    counters.stop();
+    delete map;
+    counters.start();
+    state.ResumeTiming();
+  }
+  counters.stop();
+  state.SetItemsProcessed(state.iterations() * n);
+  counters.report(state, state.iterations() * n);
+}
+
+template<typename KeyTag, typename Kind>
+static void BM_FindHit(benchmark::State &state) {
+  typedef bench_setup<KeyTag, Kind> setup;
+  size_t n = static_cast<size_t>(state.range(0));
+  auto present = setup::make_keys(0, n);
+  auto *map = setup::filled(present);
+  size_t i = 0;
+  region_counters counters;
+  counters.start();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map->find(present[i]));
+    if (++i == n) {
+      i = 0;
+    }
+  }
+  counters.stop();
+  state.SetItemsProcessed(state.iterations());
+  counters.report(state, state.iterations());
+  delete map;
+}
+
+template<typename KeyTag, typename Kind>
+static void BM_FindMiss(benchmark::State &state) {
+  typedef bench_setup<KeyTag, Kind> setup;
+  size_t n = static_cast<size_t>(state.range(0));
+  auto present = setup::make_keys(0, n);
+  auto absent = setup::make_keys(n, n);
+  auto *map = setup::filled(present);
+  size_t i = 0;
+  region_counters counters;
+  counters.start();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map->find(absent[i]));
+    if (++i == n) {
+      i = 0;
+    }
+  }
+  counters.stop();
+  state.SetItemsProcessed(state.iterations());
+  counters.report(state, state.iterations());
+  delete map;
+}
+
+template<typename KeyTag, typename Kind>
+static void BM_Erase(benchmark::State &state) {
+  typedef bench_setup<KeyTag, Kind> setup;
+  size_t n = static_cast<size_t>(state.range(0));
+  auto present = setup::make_keys(0, n);
+  region_counters counters;
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto *map = setup::filled(present);
+    counters.start();
+    state.ResumeTiming();
+    for (size_t i = 0; i < n; i++) {
+      benchmark::DoNotOptimize(map->erase(present[i]));
+    }
+    state.PauseTiming();
+    counters.stop();
+    delete map;
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+  counters.report(state, state.iterations() * n);
+}
+
+template<typename KeyTag, typename Kind>
+static void BM_Iterate(benchmark::State &state) {
+  typedef bench_setup<KeyTag, Kind> setup;
+  size_t n = static_cast<size_t>(state.range(0));
+  auto *map = setup::filled(setup::make_keys(0, n));
+  region_counters counters;
+  counters.start();
+  for (auto _ : state) {
+    uint64_t sum = 0;
+    for (auto it = map->begin(); it != map->end(); ++it) {
+      sum += it->second;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  counters.stop();
+  state.SetItemsProcessed(state.iterations() * n);
+  counters.report(state, state.iterations() * n);
+  delete map;
+}
+
+// Per round: four hits, one miss, and one key erased and inserted again,
+// so the size stays at n.
+template<typename KeyTag, typename Kind>
+static void BM_Mixed(benchmark::State &state) {
+  typedef bench_setup<KeyTag, Kind> setup;
+  size_t n = static_cast<size_t>(state.range(0));
+  auto present = setup::make_keys(0, n);
+  auto absent = setup::make_keys(n, n);
+  auto *map = setup::filled(present);
+  uint64_t x = 0;
+  size_t churn = 0;
+  region_counters counters;
+  counters.start();
+  for (auto _ : state) {
+    for (int j = 0; j < 4; j++) {
+      x = x * 6364136223846793005ull + 1442695040888963407ull;
+      benchmark::DoNotOptimize(map->find(present[(x >> 33) % n]));
+    }
+    benchmark::DoNotOptimize(map->find(absent[(x >> 17) % n]));
+    map->erase(present[churn]);
+    map->insert(std::make_pair(present[churn], static_cast<uint64_t>(churn)));
+    if (++churn == n) {
+      churn = 0;
+    }
+  }
+  counters.stop();
+  state.SetItemsProcessed(state.iterations() * 7);
+  counters.report(state, state.iterations() * 7);
+  delete map;
+}
+
+#define SMOOTH_BENCHMARK_SIZES ->RangeMultiplier(10)->Range(1000, 100000000)->Unit(benchmark::kNanosecond)
+
+#define SMOOTH_BENCHMARK_MAPS(workload, key)                                             \
+  BENCHMARK_TEMPLATE(workload, key, smooth_map) SMOOTH_BENCHMARK_SIZES;                  \
+  BENCHMARK_TEMPLATE(workload, key, smooth_fixed_map) SMOOTH_BENCHMARK_SIZES;            \
+  BENCHMARK_TEMPLATE(workload, key, std_map) SMOOTH_BENCHMARK_SIZES
+
+#define SMOOTH_BENCHMARK_KEYS(workload)                 \
+  SMOOTH_BENCHMARK_MAPS(workload, int64_t);             \
+  SMOOTH_BENCHMARK_MAPS(workload, short_string);        \
+  SMOOTH_BENCHMARK_MAPS(workload, long_string);         \
+  SMOOTH_BENCHMARK_MAPS(workload, pod32)
+
+SMOOTH_BENCHMARK_KEYS(BM_Insert);
+SMOOTH_BENCHMARK_KEYS(BM_FindHit);
+SMOOTH_BENCHMARK_KEYS(BM_FindMiss);
+SMOOTH_BENCHMARK_KEYS(BM_Erase);
+SMOOTH_BENCHMARK_KEYS(BM_Iterate);
+SMOOTH_BENCHMARK_KEYS(BM_Mixed);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,303 @@
+#pragma once
+
+#include "smooth/hash.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Operation streams for workload_bench: YCSB-style synthetic mixes and
+// binary traces of recorded operations.
+namespace workload {
+
+enum trace_op : uint8_t {
+  k_trace_read,
+  k_trace_update,
+  k_trace_insert,
+  k_trace_scan,
+  k_trace_read_modify_write,
+  k_trace_erase,
+  k_num_trace_ops
+};
+
+inline const char *trace_op_name(trace_op op) {
+  static const char *const names[k_num_trace_ops] = {"read", "update", "insert", "scan", "read_modify_write", "erase"};
+  return names[op];
+}
+
+// One recorded operation; arg is the scan length and zero otherwise.
+struct trace_event {
+  uint64_t key;
+  uint32_t arg;
+  uint8_t op;
+  uint8_t reserved[3];
+};
+static_assert(sizeof(trace_event) == 16, "trace files store 16-byte events");
+
+// Trace files are the 8 bytes of k_trace_magic followed by trace_event
+// records in little-endian byte order.
+const char k_trace_magic[8] = {'S', 'M', 'T', 'R', 'A', 'C', 'E', '1'};
+
+class trace_writer {
+public:
+  explicit trace_writer(const std::string &path) : file_(std::fopen(path.c_str(), "wb")) {
+    if (file_ == nullptr) {
+      throw std::runtime_error("cannot create trace " + path);
+    }
+    write_all(k_trace_magic, sizeof(k_trace_magic));
+  }
+
+  ~trace_writer() { std::fclose(file_); }
+
+  trace_writer(const trace_writer &) = delete;
+  trace_writer &operator=(const trace_writer &) = delete;
+
+  void write(const trace_event *events, size_t count) { write_all(events, count * sizeof(trace_event)); }
+
+  void flush() {
+    if (std::fflush(file_) != 0) {
+      throw std::runtime_error("error writing trace");
+    }
+  }
+
+private:
+  void write_all(const void *data, size_t bytes) {
+    if (std::fwrite(data, 1, bytes, file_) != bytes) {
+      throw std::runtime_error("error writing trace");
+    }
+  }
+
+  std::FILE *file_;
+};
+
+class trace_reader {
+public:
+  explicit trace_reader(const std::string &path) : file_(std::fopen(path.c_str(), "rb")) {
+    if (file_ == nullptr) {
+      throw std::runtime_error("cannot open trace " + path);
+    }
+    char magic[sizeof(k_trace_magic)];
+    if (std::fread(magic, 1, sizeof(magic), file_) != sizeof(magic) ||
+        std::memcmp(magic, k_trace_magic, sizeof(magic)) != 0) {
+      std::fclose(file_);
+      throw std::runtime_error(path + " is not a trace file");
+    }
+  }
+
+  ~trace_reader() { std::fclose(file_); }
+
+  trace_reader(const trace_reader &) = delete;
+  trace_reader &operator=(const trace_reader &) = delete;
+
+  // Read up to max events into out; returns how many, 0 at the end.
+  size_t read(std::vector<trace_event> &out, size_t max) {
+    out.resize(max);
+    size_t count = std::fread(out.data(), sizeof(trace_event), max, file_);
+    if (count < max && std::ferror(file_)) {
+      throw std::runtime_error("error reading trace");
+    }
+    out.resize(count);
+    for (size_t i = 0; i < count; i++) {
+      if (out[i].op >= k_num_trace_ops) {
+        throw std::runtime_error("trace has an unknown operation");
+      }
+    }
+    return count;
+  }
+
+private:
+  std::FILE *file_;
+};
+
+// Zipfian ranks in [0, items), rank 0 the most popular, by the method of
+// Gray et al., "Quickly Generating Billion-Record Synthetic Databases", as
+// YCSB's ZipfianGenerator. The item count may grow; zeta is extended
+// incrementally, so growing by one costs one pow().
+class zipfian_generator {
+public:
+  explicit zipfian_generator(uint64_t items, double theta = 0.99)
+      : items_(0), theta_(theta), zeta2_(zeta(0, 2, theta, 0.0)), zetan_(0.0) {
+    grow(items < 1 ? 1 : items);
+  }
+
+  void grow(uint64_t items) {
+    if (items <= items_) {
+      return;
+    }
+    zetan_ = zeta(items_, items, theta_, zetan_);
+    items_ = items;
+    alpha_ = 1.0 / (1.0 - theta_);
+    eta_ = (1.0 - std::pow(2.0 / items_, 1.0 - theta_)) / (1.0 - zeta2_ / zetan_);
+  }
+
+  template<typename Rng>
+  uint64_t next(Rng &rng) {
+    double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    double uz = u * zetan_;
+    if (uz < 1.0) {
+      return 0;
+    }
+    if (uz < 1.0 + std::pow(0.5, theta_)) {
+      return items_ > 1 ? 1 : 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(items_ * std::pow(eta_ * u - eta_ + 1.0, alpha_));
+    return rank < items_ ? rank : items_ - 1;
+  }
+
+  uint64_t items() const { return items_; }
+
+private:
+  // zeta(to) given zeta(from) = sum.
+  static double zeta(uint64_t from, uint64_t to, double theta, double sum) {
+    for (uint64_t i = from; i < to; i++) {
+      sum += 1.0 / std::pow(static_cast<double>(i + 1), theta);
+    }
+    return sum;
+  }
+
+  uint64_t items_;
+  double theta_;
+  double zeta2_;
+  double zetan_;
+  double alpha_;
+  double eta_;
+};
+
+enum key_distribution {
+  k_dist_uniform,
+  k_dist_zipfian,  // Popular keys spread over the key space, as YCSB's scrambled zipfian
+  k_dist_hotspot,  // hot_ops of the operations go to the first hot_fraction of the keys
+  k_dist_latest,   // Zipfian over recency: the newest keys are the most popular
+};
+
+struct workload_options {
+  key_distribution distribution = k_dist_zipfian;
+  double theta = 0.99;
+  double hot_fraction = 0.2;
+  double hot_ops = 0.8;
+  uint32_t max_scan_length = 100;
+  uint64_t seed = 1;
+};
+
+// Operation proportions; they need not sum to one.
+struct operation_mix {
+  double read = 0;
+  double update = 0;
+  double insert = 0;
+  double scan = 0;
+  double read_modify_write = 0;
+  double erase = 0;
+};
+
+// The core YCSB workloads, a to f. Returns false for other letters.
+// Sets the distribution YCSB uses for the workload in options.
+inline bool ycsb_workload(char letter, operation_mix &mix, workload_options &options) {
+  mix = operation_mix();
+  options.distribution = k_dist_zipfian;
+  switch (letter) {
+    case 'a': mix.read = 0.5; mix.update = 0.5; break;
+    case 'b': mix.read = 0.95; mix.update = 0.05; break;
+    case 'c': mix.read = 1.0; break;
+    case 'd': mix.read = 0.95; mix.insert = 0.05; options.distribution = k_dist_latest; break;
+    case 'e': mix.scan = 0.95; mix.insert = 0.05; break;
+    case 'f': mix.read = 0.5; mix.read_modify_write = 0.5; break;
+    default: return false;
+  }
+  return true;
+}
+
+// Key ids 0 to records-1 are loaded first; inserts then add the next ids
+// and other operations pick among the ids inserted so far. Erased ids may
+// be picked again, which makes a miss.
+class operation_stream {
+public:
+  operation_stream(const operation_mix &mix, const workload_options &options, uint64_t records)
+      : options_(options),
+        inserted_(records),
+        rng_(options.seed),
+        // Computing zeta takes a pass over the records; skip it when unused.
+        zipf_(options.distribution == k_dist_zipfian || options.distribution == k_dist_latest ? records : 1,
+              options.theta) {
+    const double weights[k_num_trace_ops] = {mix.read, mix.update, mix.insert, mix.scan, mix.read_modify_write,
+                                             mix.erase};
+    double total = 0;
+    for (size_t i = 0; i < k_num_trace_ops; i++) {
+      total += weights[i];
+    }
+    if (total <= 0) {
+      throw std::invalid_argument("operation mix is empty");
+    }
+    double sum = 0;
+    for (size_t i = 0; i < k_num_trace_ops; i++) {
+      sum += weights[i];
+      cumulative_[i] = sum / total;
+    }
+  }
+
+  trace_event next() {
+    trace_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.op = choose_op();
+    if (event.op == k_trace_insert) {
+      event.key = inserted_++;
+      if (options_.distribution == k_dist_latest) {
+        zipf_.grow(inserted_);
+      }
+      return event;
+    }
+    event.key = choose_key();
+    if (event.op == k_trace_scan) {
+      event.arg = std::uniform_int_distribution<uint32_t>(1, options_.max_scan_length)(rng_);
+    }
+    return event;
+  }
+
+  uint64_t inserted() const { return inserted_; }
+
+private:
+  uint8_t choose_op() {
+    double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng_);
+    for (uint8_t i = 0; i < k_num_trace_ops; i++) {
+      if (u < cumulative_[i]) {
+        return i;
+      }
+    }
+    return k_num_trace_ops - 1;
+  }
+
+  uint64_t choose_key() {
+    uint64_t n = inserted_ == 0 ? 1 : inserted_;
+    switch (options_.distribution) {
+      case k_dist_uniform:
+        return std::uniform_int_distribution<uint64_t>(0, n - 1)(rng_);
+      case k_dist_zipfian:
+        // Spread the popular ranks so they do not all sit at low ids.
+        return smooth::hash_mix64(zipf_.next(rng_)) % n;
+      case k_dist_hotspot: {
+        uint64_t hot = static_cast<uint64_t>(n * options_.hot_fraction);
+        hot = hot < 1 ? 1 : (hot > n ? n : hot);
+        if (hot == n || std::uniform_real_distribution<double>(0.0, 1.0)(rng_) < options_.hot_ops) {
+          return std::uniform_int_distribution<uint64_t>(0, hot - 1)(rng_);
+        }
+        return std::uniform_int_distribution<uint64_t>(hot, n - 1)(rng_);
+      }
+      case k_dist_latest:
+      default: {
+        uint64_t rank = zipf_.next(rng_);
+        return rank < n ? n - 1 - rank : 0;
+      }
+    }
+  }
+
+  workload_options options_;
+  uint64_t inserted_;
+  std::mt19937_64 rng_;
+  zipfian_generator zipf_;
+  double cumulative_[k_num_trace_ops];
+};
+
+}  // namespace workload
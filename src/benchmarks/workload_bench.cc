@@ -0,0 +1,294 @@
+// Runs an operation stream against smooth::hashmap<uint64_t, uint64_t> and
+// reports throughput and per-operation latency percentiles.
+//
+//   workload_bench ycsb [--workload=a..f] [--records=N] [--ops=N]
+//                       [--distribution=uniform|zipfian|hotspot|latest]
+//                       [--theta=0.99] [--hot-fraction=0.2] [--hot-ops=0.8]
+//                       [--seed=N] [--record=trace.bin]
+//   workload_bench replay trace.bin
+//
+// ycsb loads keys 0 to records-1, then runs ops operations of the chosen
+// YCSB core workload (default a, 1M records, 10M operations).
+// --distribution overrides the workload's key distribution. --record
+// writes the load and run operations to a trace. replay runs a trace from
+// an empty map, e.g. one captured from a service; the trace format is in
+// workload.h.
+//
+// Operations are generated or read in batches outside the timed region.
+// Throughput is over the time spent executing batches, and latencies come
+// from timing each operation. Where perf_event_open is allowed, hardware
+// counters over the same batches are reported per operation.
+
+#include "smooth/hash.h"
+#include "smooth/hashmap.h"
+#include "smooth/latency.h"
+#include "src/benchmarks/perf_counters.h"
+#include "src/benchmarks/workload.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace smooth;
+using namespace workload;
+
+const size_t k_batch_events = 1 << 16;
+
+class runner {
+public:
+  runner() : busy_(0), checksum_(0) {}
+
+  // Run events and time each one.
+  void run(const std::vector<trace_event> &events) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    counters_.start();
+    for (const trace_event &event : events) {
+      uint64_t begin = tsc_clock::now();
+      apply(event);
+      uint64_t end = tsc_clock::now();
+      histograms_[event.op].record(end > begin ? end - begin : 0);
+    }
+    counters_.stop();
+    busy_ += std::chrono::steady_clock::now() - start;
+    clock_.calibrate();
+  }
+
+  // Run events untimed, e.g. a load phase.
+  void load(const std::vector<trace_event> &events) {
+    for (const trace_event &event : events) {
+      apply(event);
+    }
+  }
+
+  void report(const char *label) const {
+    uint64_t ops = 0;
+    for (size_t op = 0; op < k_num_trace_ops; op++) {
+      ops += histograms_[op].count();
+    }
+    double seconds = std::chrono::duration<double>(busy_).count();
+    std::printf("%s: %llu operations in %.3fs, %.0f ops/s, %zu keys at the end\n", label,
+                static_cast<unsigned long long>(ops), seconds, seconds > 0 ? ops / seconds : 0.0, map_.size());
+    // The counts include the per-operation timing.
+    if (counters_.any_available()) {
+      std::printf("counters: %s\n", counters_.per_op(ops).c_str());
+    } else {
+      std::printf("counters: unavailable (perf_event_open not permitted or not supported)\n");
+    }
+    std::printf("%-18s %12s %10s %10s %10s %10s %12s\n", "operation", "count", "mean_ns", "p50_ns", "p99_ns",
+                "p99.9_ns", "max_ns");
+    for (size_t op = 0; op < k_num_trace_ops; op++) {
+      const latency_histogram &h = histograms_[op];
+      if (h.count() == 0) {
+        continue;
+      }
+      std::printf("%-18s %12llu %10.1f %10llu %10llu %10llu %12llu\n", trace_op_name(static_cast<trace_op>(op)),
+                  static_cast<unsigned long long>(h.count()), h.mean() * clock_.ns_per_tick(),
+                  static_cast<unsigned long long>(clock_.to_nanos(h.percentile(0.5))),
+                  static_cast<unsigned long long>(clock_.to_nanos(h.percentile(0.99))),
+                  static_cast<unsigned long long>(clock_.to_nanos(h.percentile(0.999))),
+                  static_cast<unsigned long long>(clock_.to_nanos(h.max())));
+    }
+    // Keeps the reads from being optimized away.
+    std::fprintf(stderr, "checksum %llu\n", static_cast<unsigned long long>(checksum_));
+  }
+
+private:
+  void apply(const trace_event &event) {
+    switch (event.op) {
+      case k_trace_read: {
+        auto it = map_.find(event.key);
+        if (it != map_.end()) {
+          checksum_ += it->second;
+        }
+        break;
+      }
+      case k_trace_update: {
+        auto it = map_.find(event.key);
+        if (it != map_.end()) {
+          it->second = event.key;
+        }
+        break;
+      }
+      case k_trace_insert:
+        map_.insert(std::make_pair(event.key, event.key));
+        break;
+      case k_trace_scan: {
+        // A hash map has no key order; visit about arg elements from the
+        // cursor the key maps to instead.
+        uint64_t &sum = checksum_;
+        map_.scan(static_cast<size_t>(hash_mix64(event.key)),
+                  [&sum](const std::pair<uint64_t, uint64_t> &kv) { sum += kv.second; }, event.arg);
+        break;
+      }
+      case k_trace_read_modify_write: {
+        auto it = map_.find(event.key);
+        if (it != map_.end()) {
+          it->second += 1;
+        }
+        break;
+      }
+      case k_trace_erase:
+        map_.erase(event.key);
+        break;
+    }
+  }
+
+  hashmap<uint64_t, uint64_t> map_;
+  latency_histogram histograms_[k_num_trace_ops];
+  tsc_clock clock_;
+  perf_counters counters_;
+  std::chrono::steady_clock::duration busy_;
+  uint64_t checksum_;
+};
+
+static bool parse_flag(const std::string &arg, const char *name, std::string &value) {
+  std::string prefix = std::string("--") + name + "=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  value = arg.substr(prefix.size());
+  return true;
+}
+
+static int usage(const char *program) {
+  std::fprintf(stderr,
+               "usage: %s ycsb [--workload=a..f] [--records=N] [--ops=N]\n"
+               "                 [--distribution=uniform|zipfian|hotspot|latest] [--theta=X]\n"
+               "                 [--hot-fraction=X] [--hot-ops=X] [--seed=N] [--record=FILE]\n"
+               "       %s replay FILE\n",
+               program, program);
+  return 1;
+}
+
+static int run_ycsb(int argc, char **argv) {
+  char letter = 'a';
+  uint64_t records = 1000000;
+  uint64_t ops = 10000000;
+  std::string distribution;
+  std::string record_path;
+  workload_options options;
+  double theta = options.theta;
+  double hot_fraction = options.hot_fraction;
+  double hot_ops = options.hot_ops;
+  uint64_t seed = options.seed;
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    std::string value;
+    if (parse_flag(arg, "workload", value) && value.size() == 1) {
+      letter = value[0];
+    } else if (parse_flag(arg, "records", value)) {
+      records = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (parse_flag(arg, "ops", value)) {
+      ops = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (parse_flag(arg, "distribution", value)) {
+      distribution = value;
+    } else if (parse_flag(arg, "theta", value)) {
+      theta = std::strtod(value.c_str(), nullptr);
+    } else if (parse_flag(arg, "hot-fraction", value)) {
+      hot_fraction = std::strtod(value.c_str(), nullptr);
+    } else if (parse_flag(arg, "hot-ops", value)) {
+      hot_ops = std::strtod(value.c_str(), nullptr);
+    } else if (parse_flag(arg, "seed", value)) {
+      seed = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (parse_flag(arg, "record", value)) {
+      record_path = value;
+    } else {
+      return usage(argv[0]);
+    }
+  }
+
+  operation_mix mix;
+  if (!ycsb_workload(letter, mix, options)) {
+    return usage(argv[0]);
+  }
+  if (distribution == "uniform") {
+    options.distribution = k_dist_uniform;
+  } else if (distribution == "zipfian") {
+    options.distribution = k_dist_zipfian;
+  } else if (distribution == "hotspot") {
+    options.distribution = k_dist_hotspot;
+  } else if (distribution == "latest") {
+    options.distribution = k_dist_latest;
+  } else if (!distribution.empty()) {
+    return usage(argv[0]);
+  }
+  options.theta = theta;
+  options.hot_fraction = hot_fraction;
+  options.hot_ops = hot_ops;
+  options.seed = seed;
+
+  std::unique_ptr<trace_writer> recorder;
+  if (!record_path.empty()) {
+    recorder.reset(new trace_writer(record_path));
+  }
+  runner bench;
+  std::vector<trace_event> batch;
+  batch.reserve(k_batch_events);
+  for (uint64_t key = 0; key < records;) {
+    batch.clear();
+    for (; key < records && batch.size() < k_batch_events; key++) {
+      trace_event event = trace_event();
+      event.op = k_trace_insert;
+      event.key = key;
+      batch.push_back(event);
+    }
+    bench.load(batch);
+    if (recorder) {
+      recorder->write(batch.data(), batch.size());
+    }
+  }
+
+  operation_stream stream(mix, options, records);
+  for (uint64_t done = 0; done < ops;) {
+    batch.clear();
+    for (; done < ops && batch.size() < k_batch_events; done++) {
+      batch.push_back(stream.next());
+    }
+    bench.run(batch);
+    if (recorder) {
+      recorder->write(batch.data(), batch.size());
+    }
+  }
+  if (recorder) {
+    recorder->flush();
+  }
+  std::string label = std::string("ycsb-") + letter;
+  bench.report(label.c_str());
+  return 0;
+}
+
+static int run_replay(int argc, char **argv) {
+  if (argc != 3) {
+    return usage(argv[0]);
+  }
+  trace_reader reader(argv[2]);
+  runner bench;
+  std::vector<trace_event> batch;
+  while (reader.read(batch, k_batch_events) > 0) {
+    bench.run(batch);
+  }
+  bench.report("replay");
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    return usage(argv[0]);
+  }
+  std::string mode = argv[1];
+  try {
+    if (mode == "ycsb") {
+      return run_ycsb(argc, argv);
+    }
+    if (mode == "replay") {
+      return run_replay(argc, argv);
+    }
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "%s: %s\n", argv[0], e.what());
+    return 1;
+  }
+  return usage(argv[0]);
+}
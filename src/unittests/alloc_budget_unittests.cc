@@ -0,0 +1,161 @@
+#include "gtest/gtest.h"
+#include "smooth/fixed_hashmap.h"
+#include "smooth/hashmap.h"
+#include "smooth/mmap_array.h"
+#include "smooth/tree_list.h"
+#include "src/benchmarks/alloc_counter.h"
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+// Allocation budgets of the map operations. A failure here means an
+// operation allocates more than it used to; if that is intended, raise the
+// budget in the same change and say why.
+
+using namespace smooth;
+
+typedef std::pair<uint64_t, uint64_t> entry;
+
+TEST(AllocCounterTest, CountsNewAndMalloc) {
+  alloc_scope scope;
+  int *one = new int(1);
+  int *many = new int[10];
+  delete one;
+  delete[] many;
+  alloc_stats stats = scope.delta();
+  EXPECT_EQ(stats.allocations, 2u);
+  EXPECT_EQ(stats.frees, 2u);
+  EXPECT_EQ(stats.bytes, sizeof(int) * 11);
+
+  if (!alloc_counter_covers_malloc()) {
+    GTEST_SKIP() << "malloc is not interposed on this platform";
+  }
+  scope.restart();
+  void *p = std::malloc(100);
+  p = std::realloc(p, 200);
+  std::free(p);
+  stats = scope.delta();
+  EXPECT_EQ(stats.allocations, 2u);
+  EXPECT_EQ(stats.frees, 2u);
+  EXPECT_EQ(stats.bytes, 300u);
+}
+
+// One node per element in a list bucket, and nothing else.
+TEST(AllocBudgetTest, ListInsert) {
+  tree_list<entry> bucket;
+  alloc_scope scope;
+  for (uint64_t i = 0; i < 5; i++) {
+    bucket.insert(entry(i, i));
+  }
+  alloc_stats stats = scope.delta();
+  EXPECT_EQ(stats.allocations, 5u);
+  EXPECT_EQ(stats.frees, 0u);
+}
+
+// Treefying copies each list node into a tree node, then frees the list.
+TEST(AllocBudgetTest, Treefy) {
+  tree_list<entry> bucket;
+  for (uint64_t i = 0; i < 10; i++) {
+    bucket.insert(entry(i, i));
+  }
+  ASSERT_FALSE(bucket.is_tree());
+  alloc_scope scope;
+  bucket.insert(entry(10, 10));
+  ASSERT_TRUE(bucket.is_tree());
+  alloc_stats stats = scope.delta();
+  EXPECT_EQ(stats.allocations, 11u);
+  EXPECT_EQ(stats.frees, 10u);
+
+  // Tree inserts allocate one node.
+  scope.restart();
+  bucket.insert(entry(11, 11));
+  EXPECT_EQ(scope.delta().allocations, 1u);
+}
+
+TEST(AllocBudgetTest, FixedHashMapOperations) {
+  fixed_hashmap<uint64_t, uint64_t> map(1024);
+  alloc_scope scope;
+  for (uint64_t i = 0; i < 500; i++) {
+    map.insert(entry(i, i));
+  }
+  alloc_stats stats = scope.delta();
+  EXPECT_EQ(stats.allocations, 500u);
+
+  scope.restart();
+  for (uint64_t i = 0; i < 500; i++) {
+    map[i] = i + 1;
+    EXPECT_TRUE(map.find(i) != map.end());
+    EXPECT_TRUE(map.find(i + 1000) == map.end());
+  }
+  stats = scope.delta();
+  EXPECT_EQ(stats.allocations, 0u);
+  EXPECT_EQ(stats.frees, 0u);
+
+  scope.restart();
+  for (uint64_t i = 0; i < 500; i++) {
+    map.erase(i);
+  }
+  stats = scope.delta();
+  EXPECT_EQ(stats.allocations, 0u);
+  EXPECT_EQ(stats.frees, 500u);
+}
+
+// Small tables come from new char[]; large ones are mapped and not heap.
+TEST(AllocBudgetTest, MmapArray) {
+  alloc_scope scope;
+  {
+    mmap_array<uint64_t> small(16);
+  }
+  alloc_stats stats = scope.delta();
+  EXPECT_EQ(stats.allocations, 1u);
+  EXPECT_EQ(stats.bytes, 16 * sizeof(uint64_t));
+  EXPECT_EQ(stats.frees, 1u);
+
+  scope.restart();
+  {
+    mmap_array<uint64_t> large(k_threshold_for_mmap);
+  }
+  EXPECT_EQ(scope.delta().allocations, 0u);
+}
+
+// While a rehash is in progress each insert also moves an element: the
+// step's std::vector from steal_elements and the moved element's new node,
+// on top of the inserted element's node.
+TEST(AllocBudgetTest, InsertDuringRehash) {
+  hashmap<uint64_t, uint64_t> map(1024);
+  uint64_t key = 0;
+  while (!map.is_rehashing()) {
+    map.insert(entry(key, key));
+    key++;
+  }
+  size_t checked = 0;
+  while (map.is_rehashing() && checked < 100) {
+    alloc_scope scope;
+    map.insert(entry(key, key));
+    key++;
+    alloc_stats stats = scope.delta();
+    EXPECT_LE(stats.allocations, 1 + 2 * static_cast<uint64_t>(k_num_items_to_steal)) << "at key " << key;
+    checked++;
+  }
+  EXPECT_GT(checked, 0u);
+}
+
+// Over growth from empty, with every table and every element move.
+TEST(AllocBudgetTest, GrowthPerInsert) {
+  const uint64_t n = 100000;
+  hashmap<uint64_t, uint64_t> map;
+  alloc_scope scope;
+  for (uint64_t i = 0; i < n; i++) {
+    map.insert(entry(i, i));
+  }
+  alloc_stats stats = scope.delta();
+  // Each insert pays for its node plus, amortized, one step's vector and
+  // one moved node.
+  EXPECT_LE(stats.allocations, 3 * n);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
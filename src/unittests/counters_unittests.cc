@@ -0,0 +1,131 @@
+#include "gtest/gtest.h"
+#include "smooth/counters.h"
+#include "smooth/hashmap.h"
+#include <thread>
+#include <vector>
+
+using namespace smooth;
+
+TEST(CountersTest, SumsOverThreads) {
+  counter_snapshot before = counters_snapshot();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([] {
+      for (int i = 0; i < 1000; ++i) {
+        SMOOTH_COUNT(k_counter_lookups);
+      }
+      SMOOTH_COUNT_N(k_counter_elements_stolen, 7);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  // The threads have exited; their counts are kept.
+  counter_snapshot delta = counters_snapshot().since(before);
+  ASSERT_EQ(delta[k_counter_lookups], 4000u);
+  ASSERT_EQ(delta[k_counter_elements_stolen], 28u);
+  ASSERT_EQ(delta[k_counter_hits], 0u);
+}
+
+TEST(CountersTest, Names) {
+  ASSERT_STREQ(counter_name(k_counter_lookups), "lookups");
+  ASSERT_STREQ(counter_name(k_counter_un_treefies), "un_treefies");
+}
+
+TEST(CountersTest, HashMapEvents) {
+  counter_snapshot before = counters_snapshot();
+  hashmap<int, int> map;
+  for (int i = 0; i < 1000; ++i) {
+    map.insert(std::make_pair(i, i));
+  }
+  for (int i = 0; i < 2000; ++i) {
+    map.find(i);
+    map.contains(i);
+  }
+  counter_snapshot delta = counters_snapshot().since(before);
+  ASSERT_EQ(delta[k_counter_lookups], 4000u);
+  ASSERT_EQ(delta[k_counter_hits], 2000u);
+  ASSERT_EQ(delta[k_counter_misses], 2000u);
+  ASSERT_GT(delta[k_counter_nodes_visited], 0u);
+  ASSERT_GE(delta[k_counter_keys_compared], 2000u);
+  ASSERT_GT(delta[k_counter_migration_steps], 0u);
+  ASSERT_GE(delta[k_counter_elements_stolen], delta[k_counter_migration_steps]);
+}
+
+// Gives every key the same chain tag, the top byte of the hash times
+// 0x9E3779B97F4A7C15 (see fixed_hashmap::tag_of()), so a lookup that gets
+// past the lookup filter walks its bucket.
+struct same_tag_hash {
+  size_t operator()(int key) const {
+    // Inverse of the tag multiplier modulo 2^64, by Newton's method.
+    const uint64_t multiplier = 0x9E3779B97F4A7C15ULL;
+    uint64_t inverse = multiplier;
+    for (int i = 0; i < 5; ++i) {
+      inverse *= 2 - multiplier * inverse;
+    }
+    return static_cast<size_t>((static_cast<uint64_t>(key) + 1) * inverse);
+  }
+};
+
+TEST(CountersTest, LookupFilterKeptByClear) {
+  fixed_hashmap<int, int, same_tag_hash> map(1024);
+  map.enable_lookup_filter();
+  for (int i = 0; i < 800; ++i) {
+    map.emplace(i, i);
+  }
+  map.clear();
+  ASSERT_TRUE(map.has_lookup_filter());
+  for (int i = 1000; i < 1800; ++i) {
+    map.emplace(i, i);
+  }
+  // The keys from before clear() left the filter too, so nearly all of
+  // these misses stop there instead of walking a bucket.
+  counter_snapshot before = counters_snapshot();
+  for (int i = 0; i < 500; ++i) {
+    ASSERT_FALSE(map.contains(i));
+  }
+  counter_snapshot delta = counters_snapshot().since(before);
+  ASSERT_LT(delta[k_counter_nodes_visited], 100u);
+  for (int i = 1000; i < 1800; ++i) {
+    ASSERT_TRUE(map.contains(i));
+  }
+}
+
+TEST(CountersTest, NodesVisitedByLookupsOnly) {
+  fixed_hashmap<int, int> map(4);
+  counter_snapshot before = counters_snapshot();
+  // Long chains, so inserts and erases walk nodes looking for their key.
+  for (int i = 0; i < 40; ++i) {
+    map.emplace(i, i);
+    map.insert(std::make_pair(i, i));
+    map[i] = i;
+  }
+  for (int i = 0; i < 40; i += 2) {
+    map.erase(i);
+  }
+  ASSERT_EQ(counters_snapshot().since(before)[k_counter_nodes_visited], 0u);
+  for (int i = 0; i < 40; ++i) {
+    ASSERT_EQ(map.contains(i), i % 2 == 1);
+  }
+  ASSERT_GT(counters_snapshot().since(before)[k_counter_nodes_visited], 0u);
+}
+
+TEST(CountersTest, TreefyEvents) {
+  counter_snapshot before = counters_snapshot();
+  tree_list<int> list;
+  for (int i = 0; i < 12; ++i) {
+    list.insert(i);
+  }
+  for (int i = 0; i < 10; ++i) {
+    list.erase(i);
+  }
+  list.insert(100);
+  counter_snapshot delta = counters_snapshot().since(before);
+  ASSERT_EQ(delta[k_counter_treefies], 1u);
+  ASSERT_EQ(delta[k_counter_un_treefies], 1u);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
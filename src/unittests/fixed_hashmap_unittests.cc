@@ -1,6 +1,8 @@
 #include "gtest/gtest.h"
 #include "smooth/fixed_hashmap.h"
 #include <iostream>
+#include <algorithm>
+#include <memory>
 
 using namespace smooth;
 
@@ -73,7 +75,8 @@ TEST(FixedHashMapTest, Erase) {
 }
 
 TEST(FixedHashMapTest, EraseByIterator) {
-  fixed_hashmap<int, std::string> map;
+  // Relies on the bucket order of an identity hash.
+  fixed_hashmap<int, std::string, std::hash<int>> map;
 
   map.emplace(1, "one");
   map.emplace(2, "two");
@@ -266,11 +269,262 @@ TEST(FixedHashMapTest, Swap) {
   ASSERT_EQ(map1.find(4)->second, "four");
 }
 
+TEST(FixedHashMapTest, SparseIteration) {
+  fixed_hashmap<int, int> map(1 << 16);
+  for (int i = 0; i < 1000; ++i) {
+    map.emplace(i, i);
+  }
+  // Leave a handful of elements spread over a large table.
+  for (int i = 0; i < 1000; ++i) {
+    if (i % 97 != 0) {
+      map.erase(i);
+    }
+  }
+
+  std::vector<int> keys;
+  for (auto it = map.begin(); it != map.end(); ++it) {
+    keys.push_back(it->first);
+  }
+  std::sort(keys.begin(), keys.end());
+  ASSERT_EQ(keys.size(), map.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    ASSERT_EQ(keys[i], static_cast<int>(i * 97));
+  }
+
+  while (!map.empty()) {
+    map.steal_elements(1);
+  }
+  ASSERT_EQ(map.begin(), map.end());
+}
+
+struct same_bucket_hash {
+  size_t operator()(int) const { return 0; }
+};
+
+TEST(FixedHashMapTest, EraseByIteratorInTreeBucket) {
+  fixed_hashmap<int, int, same_bucket_hash> map(4);
+  for (int i = 0; i < 50; ++i) {
+    map.emplace(i, i);
+  }
+
+  int visited = 0;
+  for (auto it = map.begin(); it != map.end();) {
+    visited++;
+    if (it->first % 3 != 0) {
+      it = map.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  ASSERT_EQ(visited, 50);
+  ASSERT_EQ(map.size(), 17);
+  for (int i = 0; i < 50; ++i) {
+    ASSERT_EQ(map.contains(i), i % 3 == 0);
+  }
+}
+
+TEST(FixedHashMapTest, MoveAssignmentReleasesOldElements) {
+  auto value = std::make_shared<int>(0);
+  fixed_hashmap<int, std::shared_ptr<int>> list_map(64);
+  fixed_hashmap<int, std::shared_ptr<int>, same_bucket_hash> tree_map(4);
+  for (int i = 0; i < 50; ++i) {
+    list_map.emplace(i, value);
+    tree_map.emplace(i, value);
+  }
+  ASSERT_EQ(value.use_count(), 101);
+
+  list_map = fixed_hashmap<int, std::shared_ptr<int>>(4);
+  tree_map = fixed_hashmap<int, std::shared_ptr<int>, same_bucket_hash>(4);
+  ASSERT_EQ(value.use_count(), 1);
+  ASSERT_EQ(list_map.size(), 0);
+  ASSERT_EQ(tree_map.size(), 0);
+}
 
 TEST(FixedHashMapTest, TransparentHash) {
 
 }
 
+TEST(FixedHashMapTest, PrecomputedHash) {
+  fixed_hashmap<std::string, int> map(64);
+  for (int i = 0; i < 100; ++i) {
+    std::string key = "key" + std::to_string(i);
+    auto result = map.insert_with_hash(std::make_pair(key, i), map.hash_of(key));
+    ASSERT_TRUE(result.second);
+  }
+  ASSERT_FALSE(map.insert_with_hash(std::make_pair(std::string("key7"), 0), map.hash_of("key7")).second);
+  ASSERT_EQ(map.size(), 100);
+
+  for (int i = 0; i < 100; ++i) {
+    std::string key = "key" + std::to_string(i);
+    auto it = map.find_with_hash(key, map.hash_of(key));
+    ASSERT_NE(it, map.end());
+    ASSERT_EQ(it->second, i);
+    ASSERT_EQ(it, map.find(key));
+  }
+
+  ASSERT_EQ(map.erase_with_hash("key3", map.hash_of("key3")), 1);
+  ASSERT_EQ(map.erase_with_hash("key3", map.hash_of("key3")), 0);
+  ASSERT_FALSE(map.contains("key3"));
+  ASSERT_EQ(map.size(), 99);
+}
+
+TEST(FixedHashMapTest, LookupFilter) {
+  fixed_hashmap<int, int> map(128);
+  for (int i = 0; i < 50; ++i) {
+    map.emplace(i, i);
+  }
+  // Enabling picks up the elements already there.
+  map.enable_lookup_filter();
+  ASSERT_TRUE(map.has_lookup_filter());
+  for (int i = 50; i < 90; ++i) {
+    map.insert(std::make_pair(i, i));
+  }
+  map.at(90) = 90;
+  for (int i = 0; i < 91; ++i) {
+    ASSERT_TRUE(map.contains(i)) << i;
+    ASSERT_NE(map.find(i), map.end());
+  }
+  for (int i = 91; i < 1000; ++i) {
+    ASSERT_FALSE(map.contains(i));
+    ASSERT_EQ(map.find(i), map.end());
+    ASSERT_EQ(map.erase(i), 0);
+  }
+
+  map.erase(3);
+  auto it = map.find(4);
+  map.erase(it);
+  ASSERT_FALSE(map.contains(3));
+  ASSERT_FALSE(map.contains(4));
+  ASSERT_TRUE(map.contains(5));
+
+  while (!map.empty()) {
+    for (auto& kv : map.steal_elements(1)) {
+      ASSERT_FALSE(map.contains(kv.first));
+    }
+  }
+  map.disable_lookup_filter();
+  ASSERT_FALSE(map.has_lookup_filter());
+}
+
+// Every key lands in bucket 0, but the high bits differ, so the keys carry
+// different tags.
+struct high_bits_hash {
+  size_t operator()(int key) const { return static_cast<size_t>(key) << 20; }
+};
+
+TEST(FixedHashMapTest, TaggedChainLookups) {
+  fixed_hashmap<int, int, high_bits_hash> map(16);
+  for (int i = 0; i < 40; ++i) {
+    ASSERT_TRUE(map.emplace(i, i).second);
+    ASSERT_FALSE(map.insert(std::make_pair(i, -1)).second);
+  }
+  map.at(40) = 40;
+  for (int i = 0; i <= 40; ++i) {
+    ASSERT_EQ(map.at(i), i);
+    ASSERT_TRUE(map.contains(i));
+  }
+  ASSERT_FALSE(map.contains(41));
+
+  // Erase back down past the tree-to-list threshold.
+  for (int i = 0; i < 39; ++i) {
+    ASSERT_EQ(map.erase(i), 1);
+    ASSERT_EQ(map.erase(i), 0);
+  }
+  map.emplace(100, 100);
+  for (int i = 0; i < 39; ++i) {
+    ASSERT_EQ(map.find(i), map.end());
+  }
+  ASSERT_EQ(map.find(39)->second, 39);
+  ASSERT_EQ(map.find(40)->second, 40);
+  ASSERT_EQ(map.find(100)->second, 100);
+  ASSERT_EQ(map.size(), 3);
+}
+
+TEST(FixedHashMapTest, Stats) {
+  fixed_hashmap<int, int, same_bucket_hash> collided(64);
+  for (int i = 0; i < 20; ++i) {
+    collided.emplace(i, i);
+  }
+  auto stats = collided.stats();
+  ASSERT_FALSE(stats.sampled());
+  ASSERT_EQ(stats.bucket_count, 64u);
+  ASSERT_EQ(stats.size, 20u);
+  ASSERT_EQ(stats.used_buckets, 1u);
+  ASSERT_EQ(stats.max_chain, 20u);
+  ASSERT_EQ(stats.chain_lengths[0], 63u);
+  ASSERT_EQ(stats.chain_lengths[20], 1u);
+  ASSERT_EQ(stats.tree_buckets, 1u);
+  ASSERT_GE(stats.max_tree_depth, 5u);
+  ASSERT_LE(stats.max_tree_depth, 20u);
+
+  fixed_hashmap<int, int> map(1 << 12);
+  for (int i = 0; i < 3000; ++i) {
+    map.emplace(i, i);
+  }
+  auto full = map.stats(0);
+  ASSERT_FALSE(full.sampled());
+  ASSERT_EQ(full.sampled_elements, 3000u);
+  ASSERT_LT(full.average_probe(), 2.0);
+
+  auto sample = map.stats(256);
+  ASSERT_TRUE(sample.sampled());
+  ASSERT_LE(sample.sampled_buckets, 256u);
+  ASSERT_GT(sample.sampled_buckets, 128u);
+  // Counted from the whole table even when the chains are sampled.
+  ASSERT_EQ(sample.used_buckets, full.used_buckets);
+  ASSERT_EQ(full.used_buckets, full.sampled_buckets - full.chain_lengths[0]);
+}
+
+TEST(FixedHashMapTest, MemoryUsage) {
+  fixed_hashmap<int, std::string, same_bucket_hash> collided(64);
+  auto empty = collided.memory_usage();
+  ASSERT_EQ(empty.list_nodes + empty.tree_nodes, 0u);
+  ASSERT_EQ(empty.payload_bytes, 0u);
+  ASSERT_EQ(empty.bucket_mmap_bytes, 0u);
+  ASSERT_GT(empty.bucket_heap_bytes, 0u);
+
+  std::string long_value(100, 'x');
+  for (int i = 0; i < 20; ++i) {
+    collided.emplace(i, long_value);
+  }
+  auto usage = collided.memory_usage();
+  ASSERT_EQ(usage.tree_nodes, 20u);
+  ASSERT_EQ(usage.list_nodes, 0u);
+  ASSERT_EQ(usage.payload_bytes, 20 * heap_usage<std::string>()(long_value));
+  ASSERT_EQ(usage.total(), usage.object_bytes + usage.bucket_heap_bytes + usage.tree_node_bytes +
+                               usage.payload_bytes);
+
+  // Back below the un-treefy threshold; the bucket turns into a list on
+  // the next insert.
+  for (int i = 0; i < 18; ++i) {
+    collided.erase(i);
+  }
+  collided.emplace(100, "short");
+  usage = collided.memory_usage();
+  ASSERT_EQ(usage.tree_nodes, 0u);
+  ASSERT_EQ(usage.list_nodes, 3u);
+  ASSERT_EQ(usage.payload_bytes, 2 * heap_usage<std::string>()(long_value));
+
+  collided.at(100).assign(200, 'y');
+  collided.recount_payload();
+  ASSERT_GT(collided.memory_usage().payload_bytes, usage.payload_bytes);
+
+  while (!collided.empty()) {
+    collided.steal_elements(1);
+  }
+  usage = collided.memory_usage();
+  ASSERT_EQ(usage.list_nodes + usage.tree_nodes, 0u);
+  ASSERT_EQ(usage.payload_bytes, 0u);
+
+  fixed_hashmap<int, int> large(1 << 12);
+  usage = large.memory_usage();
+  ASSERT_GE(usage.bucket_mmap_bytes, (1u << 12) * sizeof(fixed_hashmap<int, int>::bucket_type));
+  ASSERT_EQ(usage.bucket_mmap_bytes % platform_page_size(), 0u);
+  ASSERT_EQ(usage.filter_bytes, 0u);
+  large.enable_lookup_filter();
+  ASSERT_GT(large.memory_usage().filter_bytes, 0u);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
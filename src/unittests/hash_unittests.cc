@@ -0,0 +1,263 @@
+#include "gtest/gtest.h"
+#include "smooth/hash.h"
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace smooth;
+
+namespace {
+
+struct point {
+  int32_t x;
+  int32_t y;
+};
+
+enum class color : uint16_t { red = 1, green = 2 };
+
+// Flip every input bit of each sample and check that each output bit flips
+// with probability close to one half.
+template<typename HashFn>
+void check_avalanche(size_t len, size_t samples, double tolerance, HashFn hash_fn) {
+  std::mt19937_64 rng(len);
+  std::vector<uint8_t> input(len);
+  std::vector<size_t> flips(64, 0);
+  size_t trials = 0;
+  size_t input_bits = std::min<size_t>(len * 8, 512);
+  // Short inputs have few bits to flip; take more samples.
+  samples = std::max(samples, 20000 / input_bits);
+  for (size_t s = 0; s < samples; s++) {
+    for (auto &byte : input) {
+      byte = static_cast<uint8_t>(rng());
+    }
+    uint64_t base = hash_fn(input.data(), len);
+    for (size_t i = 0; i < input_bits; i++) {
+      // Spread the flipped bits over long inputs.
+      size_t bit = input_bits == len * 8 ? i : (i * len * 8) / input_bits;
+      input[bit / 8] ^= uint8_t(1) << (bit % 8);
+      uint64_t diff = base ^ hash_fn(input.data(), len);
+      input[bit / 8] ^= uint8_t(1) << (bit % 8);
+      for (size_t j = 0; j < 64; j++) {
+        flips[j] += (diff >> j) & 1;
+      }
+      trials++;
+    }
+  }
+  for (size_t j = 0; j < 64; j++) {
+    double rate = static_cast<double>(flips[j]) / trials;
+    ASSERT_NEAR(rate, 0.5, tolerance) << "len " << len << " output bit " << j;
+  }
+}
+
+// Copies of the same long double whose padding bytes, if any, differ.
+void long_double_pair(long double value, long double *a, long double *b) {
+  std::memset(a, 0x00, sizeof(*a));
+  std::memset(b, 0xff, sizeof(*b));
+  std::memcpy(a, &value, float_value_bytes<long double>());
+  std::memcpy(b, &value, float_value_bytes<long double>());
+}
+
+}  // namespace
+
+namespace smooth {
+template<> struct is_trivially_hashable<point> : std::true_type {};
+}
+
+TEST(HashTest, IntegerMixerAvalanche) {
+  check_avalanche(8, 2000, 0.05, [](const uint8_t *p, size_t) {
+    return hash_mix64(hash_read64(p));
+  });
+}
+
+TEST(HashTest, BytesAvalanche) {
+  // One-byte inputs are covered by OneByteInputsDistinct; 256 values are
+  // too few for a per-bit bound.
+  for (size_t len : {2, 3, 4, 8, 13, 16, 17, 40, 64, 100, 256, 257, 1000, 3000}) {
+    check_avalanche(len, 100, 0.05, [](const uint8_t *p, size_t n) {
+      return hash_bytes(p, n);
+    });
+  }
+}
+
+TEST(HashTest, ScalarMatchesAvx2) {
+  if (!hash_has_avx2()) {
+    GTEST_SKIP() << "CPU has no AVX2";
+  }
+  std::mt19937_64 rng(5);
+  std::vector<uint8_t> buffer(5000);
+  for (auto &byte : buffer) {
+    byte = static_cast<uint8_t>(rng());
+  }
+  for (size_t len = 0; len < 4200; len += 7) {
+    for (size_t offset = 0; offset < 4; offset++) {
+      ASSERT_EQ(hash_bytes(buffer.data() + offset, len, 17),
+                hash_bytes_scalar(buffer.data() + offset, len, 17)) << len;
+    }
+  }
+}
+
+TEST(HashTest, OneByteInputsDistinct) {
+  std::set<uint64_t> seen;
+  std::set<uint64_t> low_bits;
+  for (int i = 0; i < 256; i++) {
+    uint8_t byte = static_cast<uint8_t>(i);
+    uint64_t h = hash_bytes(&byte, 1);
+    ASSERT_TRUE(seen.insert(h).second) << i;
+    low_bits.insert(h & 1023);
+  }
+  // 256 values in 1024 buckets should rarely collide.
+  ASSERT_GT(low_bits.size(), 200u);
+}
+
+TEST(HashTest, AllLengthsDistinct) {
+  std::vector<uint8_t> zeros(2100, 0);
+  std::set<uint64_t> seen;
+  for (size_t len = 0; len < zeros.size(); len++) {
+    ASSERT_TRUE(seen.insert(hash_bytes(zeros.data(), len)).second) << len;
+  }
+}
+
+TEST(HashTest, SeedChangesHash) {
+  std::string text(300, 'x');
+  for (size_t len : {0, 5, 30, 300}) {
+    ASSERT_NE(hash_bytes(text.data(), len, 1), hash_bytes(text.data(), len, 2));
+  }
+}
+
+TEST(HashTest, StripeOrderMatters) {
+  std::vector<uint8_t> input(1024);
+  for (size_t i = 0; i < input.size(); i++) {
+    input[i] = static_cast<uint8_t>(i / 64);
+  }
+  uint64_t before = hash_bytes(input.data(), input.size());
+  std::swap_ranges(input.begin(), input.begin() + 64, input.begin() + 64);
+  ASSERT_NE(before, hash_bytes(input.data(), input.size()));
+}
+
+TEST(HashTest, SequentialIntegersSpreadOverBuckets) {
+  const size_t buckets = 1024;
+  std::vector<size_t> counts(buckets, 0);
+  hash<uint64_t> hasher;
+  for (uint64_t i = 0; i < buckets * 64; i++) {
+    counts[hasher(i) & (buckets - 1)]++;
+  }
+  for (size_t count : counts) {
+    ASSERT_GT(count, 24u);
+    ASSERT_LT(count, 104u);
+  }
+}
+
+TEST(HashTest, TypeSelection) {
+  ASSERT_EQ(hash<int>()(42), hash_mix64(42));
+  ASSERT_EQ(hash<color>()(color::green), hash<uint16_t>()(2));
+  ASSERT_EQ(hash<std::string>()("hello"), hash_bytes("hello", 5));
+  ASSERT_EQ(hash<double>()(0.0), hash<double>()(-0.0));
+  ASSERT_NE(hash<double>()(1.0), hash<double>()(2.0));
+
+  point p{3, 4};
+  ASSERT_EQ(hash<point>()(p), hash_bytes(&p, sizeof(p)));
+
+  int value = 0;
+  ASSERT_EQ(hash<int *>()(&value), hash_mix64(reinterpret_cast<uintptr_t>(&value)));
+}
+
+TEST(HashTest, LongDoubleHashesValueBytesOnly) {
+  keyed_hash<long double> keyed;
+  for (long double value : {1.5L, -3.25L, 1e300L}) {
+    long double a, b;
+    long_double_pair(value, &a, &b);
+    ASSERT_EQ(hash<long double>()(a), hash<long double>()(b)) << static_cast<double>(value);
+    ASSERT_EQ(hash<long double>()(b), hash_bytes(&a, float_value_bytes<long double>()));
+    ASSERT_EQ(keyed(a), keyed(b)) << static_cast<double>(value);
+    ASSERT_EQ(keyed(b), siphash13(&a, float_value_bytes<long double>(), keyed.key0(), keyed.key1()));
+  }
+  ASSERT_EQ(hash<long double>()(0.0L), hash<long double>()(-0.0L));
+  ASSERT_EQ(keyed(0.0L), keyed(-0.0L));
+  ASSERT_NE(hash<long double>()(1.0L), hash<long double>()(2.0L));
+  ASSERT_LE(float_value_bytes<long double>(), sizeof(long double));
+  ASSERT_EQ(float_value_bytes<double>(), sizeof(double));
+}
+
+TEST(HashTest, SipHashReferenceVector) {
+  // Test vector from the SipHash paper (SipHash-2-4, 15-byte message).
+  uint8_t key[16];
+  uint8_t message[15];
+  for (int i = 0; i < 16; i++) {
+    key[i] = static_cast<uint8_t>(i);
+  }
+  for (int i = 0; i < 15; i++) {
+    message[i] = static_cast<uint8_t>(i);
+  }
+  ASSERT_EQ((siphash<2, 4>(message, sizeof(message), hash_read64(key), hash_read64(key + 8))),
+            0xa129ca6149be45e5ull);
+}
+
+TEST(HashTest, KeyedHashInstancesDiffer) {
+  keyed_hash<uint64_t> a;
+  keyed_hash<uint64_t> b;
+  ASSERT_TRUE(a.key0() != b.key0() || a.key1() != b.key1());
+  ASSERT_NE(a(12345), b(12345));
+
+  keyed_hash<std::string> s1;
+  keyed_hash<std::string> s2;
+  ASSERT_NE(s1("header-name"), s2("header-name"));
+}
+
+TEST(HashTest, KeyedHashCopiesAgree) {
+  keyed_hash<std::string> a;
+  keyed_hash<std::string> copy = a;
+  ASSERT_EQ(a("content-type"), copy("content-type"));
+
+  keyed_hash<uint64_t> fixed(1, 2);
+  ASSERT_EQ(fixed(7), keyed_hash<uint64_t>(1, 2)(7));
+  ASSERT_EQ(keyed_hash<std::string>(1, 2)("abc"), siphash13("abc", 3, 1, 2));
+}
+
+TEST(HashTest, KeyedHashSpreadsAttackKeys) {
+  // Keys that all collide under an identity hash with power-of-two masking.
+  const size_t buckets = 1024;
+  std::vector<size_t> counts(buckets, 0);
+  keyed_hash<uint64_t> hasher;
+  for (uint64_t i = 0; i < buckets * 64; i++) {
+    counts[hasher(i << 24) & (buckets - 1)]++;
+  }
+  for (size_t count : counts) {
+    ASSERT_LT(count, 128u);
+  }
+}
+
+TEST(HashTest, KeyedHashSequentialKeysUnderEveryKey) {
+  // At hashmap's maximum load of 3/4 a random function practically never
+  // puts 12 keys in one bucket; no key may make sequential integers do so.
+  const size_t buckets = 2048;
+  for (int instance = 0; instance < 2000; instance++) {
+    keyed_hash<uint64_t> hasher;
+    std::vector<size_t> counts(buckets, 0);
+    for (uint64_t i = 0; i < buckets * 3 / 4; i++) {
+      ASSERT_LT(++counts[hasher(i) & (buckets - 1)], 12u) << hasher.key0() << " " << hasher.key1();
+    }
+  }
+}
+
+TEST(HashTest, KeyedHashReseed) {
+  keyed_hash<uint64_t> a(1, 2);
+  size_t before = a(42);
+  a.reseed();
+  ASSERT_TRUE(a.key0() != 1 || a.key1() != 2);
+  ASSERT_NE(a(42), before);
+
+  static_assert(is_reseedable_hash<keyed_hash<std::string>>::value, "keyed_hash can be reseeded");
+  static_assert(!is_reseedable_hash<hash<std::string>>::value, "smooth::hash has no key");
+  static_assert(!is_reseedable_hash<std::hash<int>>::value, "std::hash has no key");
+  std::hash<int> plain;
+  ASSERT_FALSE(reseed_hash(plain));
+  ASSERT_TRUE(reseed_hash(a));
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,6 +1,10 @@
 #include "gtest/gtest.h"
 #include "smooth/hashmap.h"
 #include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <vector>
 
 using namespace smooth;
 
@@ -218,6 +222,766 @@ TEST(HashMapTest, MassiveErase) {
     EXPECT_EQ(map.size(), 0);
 }
 
+TEST(HashMapTest, InsertAfterClear) {
+    hashmap<int, std::string> map;
+    map.insert(std::make_pair(1, "one"));
+    map.clear();
+
+    map.insert(std::make_pair(2, "two"));
+    ASSERT_EQ(map.size(), 1);
+    ASSERT_TRUE(map.contains(2));
+    ASSERT_FALSE(map.contains(1));
+}
+
+TEST(HashMapTest, ScanVisitsEveryElement) {
+    hashmap<int, int> map;
+    for (int i = 0; i < 1000; ++i) {
+        map.insert(std::make_pair(i, i));
+    }
+
+    std::map<int, int> seen;
+    size_t cursor = 0;
+    do {
+        cursor = map.scan(cursor, [&seen](const std::pair<int, int>& kv) { seen[kv.first]++; });
+    } while (cursor != 0);
+
+    ASSERT_EQ(seen.size(), 1000);
+    for (auto& pair : seen) {
+        ASSERT_EQ(pair.second, 1);
+    }
+}
+
+TEST(HashMapTest, ScanEmptyMap) {
+    const hashmap<int, int> map;
+    int calls = 0;
+    ASSERT_EQ(map.scan(0, [&calls](const std::pair<int, int>&) { calls++; }), 0);
+    ASSERT_EQ(calls, 0);
+}
+
+TEST(HashMapTest, ScanWhileGrowing) {
+    hashmap<int, int> map(2);
+    for (int i = 0; i < 1000; ++i) {
+        map.insert(std::make_pair(i, i));
+    }
+
+    std::set<int> seen;
+    size_t cursor = 0;
+    int next_key = 1000;
+    do {
+        cursor = map.scan(cursor, [&seen](std::pair<int, int>& kv) { seen.insert(kv.first); }, 1);
+        // Keep the map growing and migrating between calls.
+        for (int i = 0; i < 20 && next_key < 20000; ++i) {
+            map.insert(std::make_pair(next_key, next_key));
+            next_key++;
+        }
+    } while (cursor != 0);
+
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_TRUE(seen.count(i)) << i;
+    }
+}
+
+TEST(HashMapTest, ScanWhileShrinking) {
+    hashmap<int, int> map;
+    for (int i = 0; i < 20000; ++i) {
+        map.insert(std::make_pair(i, i));
+    }
+
+    // Keys below 1000 stay for the whole scan, the rest are erased during it.
+    std::set<int> seen;
+    size_t cursor = 0;
+    int next_erase = 1000;
+    do {
+        cursor = map.scan(cursor, [&seen](const std::pair<int, int>& kv) { seen.insert(kv.first); }, 4);
+        for (int i = 0; i < 50 && next_erase < 20000; ++i) {
+            map.erase(next_erase++);
+        }
+    } while (cursor != 0);
+
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_TRUE(seen.count(i)) << i;
+    }
+}
+
+TEST(HashMapTest, IteratorsFromOldTable) {
+    hashmap<int, int> map(2);
+    for (int i = 0; i < 100; ++i) {
+        map.insert(std::make_pair(i, i));
+    }
+    ASSERT_TRUE(map.is_rehashing());
+
+    std::set<int> seen;
+    for (auto it = map.begin(); it != map.end(); ++it) {
+        ASSERT_TRUE(seen.insert(it->first).second);
+    }
+    ASSERT_EQ(seen.size(), 100);
+
+    auto a = map.find(7);
+    auto b = map.find(7);
+    ASSERT_TRUE(a == b);
+    ASSERT_FALSE(a == map.find(8));
+}
+
+TEST(HashMapTest, SafeIteratorEraseAndUpdate) {
+    hashmap<int, int> map(2);
+    for (int i = 0; i < 1000; ++i) {
+        map.insert(std::make_pair(i, i));
+    }
+    ASSERT_TRUE(map.is_rehashing());
+
+    int visited = 0;
+    for (auto it = map.safe_begin(); it != map.end();) {
+        visited++;
+        if (it->first % 2 == 0) {
+            it = map.erase(it);
+        } else {
+            it->second = -it->first;
+            ++it;
+        }
+    }
+    ASSERT_EQ(visited, 1000);
+    ASSERT_EQ(map.size(), 500);
+    for (int i = 0; i < 1000; ++i) {
+        if (i % 2 == 0) {
+            ASSERT_FALSE(map.contains(i));
+        } else {
+            ASSERT_EQ(map.at(i), -i);
+        }
+    }
+}
+
+TEST(HashMapTest, SafeIteratorPausesRehashing) {
+    hashmap<int, int> map(2);
+    for (int i = 0; i < 100; ++i) {
+        map.insert(std::make_pair(i, i));
+    }
+    ASSERT_TRUE(map.is_rehashing());
+
+    std::set<int> seen;
+    int next_key = 100;
+    {
+        auto it = map.safe_begin();
+        auto copy = it;
+        for (; it != map.end(); ++it) {
+            seen.insert(it->first);
+            // Inserts neither migrate elements nor start a new rehash.
+            if (next_key < 400) {
+                map.insert(std::make_pair(next_key, next_key));
+                next_key++;
+            }
+            ASSERT_TRUE(map.is_rehashing());
+        }
+    }
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_TRUE(seen.count(i)) << i;
+    }
+
+    // Rehashing resumes once the iterators are gone.
+    for (int i = 0; i < 1000 && map.is_rehashing(); ++i) {
+        map.at(0);
+    }
+    ASSERT_FALSE(map.is_rehashing());
+    ASSERT_EQ(map.size(), static_cast<size_t>(next_key));
+    for (int i = 0; i < next_key; ++i) {
+        ASSERT_TRUE(map.contains(i));
+    }
+}
+
+TEST(HashMapTest, SafeIteratorCopiesStaySafe) {
+    hashmap<int, int> map;
+    for (int i = 0; i < 10; ++i) {
+        map.insert(std::make_pair(i, i));
+    }
+    auto it = map.safe_begin();
+    auto copy = it;
+    auto assigned = map.safe_begin();
+    assigned = it;
+    map.insert(std::make_pair(10, 10));
+    ++copy;
+    ++assigned;
+    ASSERT_TRUE(copy == assigned);
+}
+
+TEST(HashMapTest, RandomElementEmptyMap) {
+    hashmap<int, int> map;
+    std::mt19937_64 rng(1);
+    ASSERT_TRUE(map.random_element(rng) == map.end());
+    ASSERT_TRUE(map.fair_random_element(rng) == map.end());
+    std::vector<hashmap<int, int>::iterator> out;
+    ASSERT_EQ(map.sample_some(5, std::back_inserter(out), rng), 0);
+    ASSERT_TRUE(out.empty());
+}
+
+TEST(HashMapTest, RandomElementReachesEveryElement) {
+    hashmap<int, int> map;
+    for (int i = 0; i < 100; ++i) {
+        map.insert(std::make_pair(i, i * 2));
+    }
+    std::mt19937_64 rng(42);
+    std::set<int> seen;
+    std::set<int> seen_fair;
+    // Bucket layout differs per run with keyed hashing; an element is
+    // picked by a fair sample roughly once in 4000 draws at worst.
+    for (int i = 0; i < 100000; ++i) {
+        auto it = map.random_element(rng);
+        ASSERT_TRUE(it != map.end());
+        ASSERT_EQ(it->second, it->first * 2);
+        seen.insert(it->first);
+
+        auto fair = map.fair_random_element(rng);
+        ASSERT_TRUE(fair != map.end());
+        ASSERT_EQ(fair->second, fair->first * 2);
+        seen_fair.insert(fair->first);
+    }
+    ASSERT_EQ(seen.size(), 100);
+    ASSERT_EQ(seen_fair.size(), 100);
+}
+
+TEST(HashMapTest, RandomElementDuringRehash) {
+    hashmap<int, int> map;
+    std::mt19937_64 rng(7);
+    int next_key = 0;
+    bool sampled_while_rehashing = false;
+    // Keep inserting until sampling has been exercised while rehashing.
+    while (next_key < 5000) {
+        map.insert(std::make_pair(next_key, next_key));
+        next_key++;
+        if (!map.is_rehashing()) {
+            continue;
+        }
+        for (int i = 0; i < 4; ++i) {
+            auto it = map.random_element(rng);
+            ASSERT_TRUE(it != map.end());
+            ASSERT_TRUE(it->first >= 0 && it->first < next_key);
+            ASSERT_EQ(it->first, it->second);
+            ASSERT_TRUE(map.contains(it->first));
+            sampled_while_rehashing = true;
+        }
+        std::vector<hashmap<int, int>::iterator> out;
+        size_t n = map.sample_some(8, std::back_inserter(out), rng);
+        ASSERT_EQ(n, out.size());
+        ASSERT_LE(n, 8u);
+        for (auto& it : out) {
+            ASSERT_EQ(it->first, it->second);
+            ASSERT_TRUE(it->first >= 0 && it->first < next_key);
+        }
+    }
+    ASSERT_TRUE(sampled_while_rehashing);
+}
+
+TEST(HashMapTest, SampleSomeCapsAtSize) {
+    hashmap<int, int> map;
+    for (int i = 0; i < 3; ++i) {
+        map.insert(std::make_pair(i, i));
+    }
+    std::mt19937_64 rng(3);
+    std::vector<hashmap<int, int>::iterator> out;
+    size_t n = map.sample_some(10, std::back_inserter(out), rng);
+    ASSERT_LE(n, 3u);
+    ASSERT_EQ(n, out.size());
+    for (auto& it : out) {
+        ASSERT_TRUE(map.contains(it->first));
+    }
+}
+
+TEST(HashMapTest, RangeCursorsPartitionMap) {
+    hashmap<int, int> map;
+    for (int i = 0; i < 1000; ++i) {
+        map.insert(std::make_pair(i, i));
+    }
+    for (size_t k : {1, 3, 4, 7}) {
+        std::map<int, int> seen;
+        for (auto& cursor : split_range_cursors(k)) {
+            while (!map.scan_range(cursor, [&](const std::pair<int, int>& kv) { seen[kv.first]++; }, 16)) {
+            }
+        }
+        ASSERT_EQ(seen.size(), 1000);
+        for (auto& kv : seen) {
+            ASSERT_EQ(kv.second, 1);
+        }
+    }
+}
+
+TEST(HashMapTest, RangeCursorsResumeWhileResizing) {
+    hashmap<int, int> map;
+    for (int i = 0; i < 2000; ++i) {
+        map.insert(std::make_pair(i, i));
+    }
+    // Keys below 1000 stay in the map throughout.
+    auto cursors = split_range_cursors(5);
+    std::vector<std::string> saved;
+    for (auto& cursor : cursors) {
+        saved.push_back(cursor.serialize());
+    }
+    std::set<int> seen;
+    int next_key = 2000;
+    int next_erase = 1000;
+    bool done = false;
+    while (!done) {
+        done = true;
+        for (auto& text : saved) {
+            auto cursor = range_cursor::deserialize(text);
+            if (cursor.finished()) {
+                continue;
+            }
+            done = false;
+            map.scan_range(cursor, [&](const std::pair<int, int>& kv) { seen.insert(kv.first); }, 8);
+            text = cursor.serialize();
+        }
+        // Grow, then shrink back down.
+        if (next_key < 6000) {
+            for (int i = 0; i < 50; ++i, ++next_key) {
+                map.insert(std::make_pair(next_key, next_key));
+            }
+        } else {
+            for (int i = 0; i < 100 && next_erase < next_key; ++i, ++next_erase) {
+                map.erase(next_erase);
+            }
+        }
+    }
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_TRUE(seen.count(i)) << i;
+    }
+}
+
+TEST(HashMapTest, PrecomputedHashDuringRehash) {
+    hashmap<std::string, int> map;
+    bool checked_while_rehashing = false;
+    for (int i = 0; i < 3000; ++i) {
+        std::string key = "k" + std::to_string(i);
+        size_t h = map.hash_of(key);
+        ASSERT_TRUE(map.insert_with_hash(std::make_pair(key, i), h).second);
+        if (map.is_rehashing()) {
+            // Keys may sit in either table; one hash must find them all.
+            for (int j = 0; j <= i; j += 37) {
+                std::string probe = "k" + std::to_string(j);
+                auto it = map.find_with_hash(probe, map.hash_of(probe));
+                ASSERT_TRUE(it != map.end());
+                ASSERT_EQ(it->second, j);
+            }
+            checked_while_rehashing = true;
+        }
+    }
+    ASSERT_TRUE(checked_while_rehashing);
+    ASSERT_FALSE(map.insert_with_hash(std::make_pair(std::string("k5"), 0), map.hash_of("k5")).second);
+    ASSERT_TRUE(map.find_with_hash("missing", map.hash_of("missing")) == map.end());
+
+    const auto& const_map = map;
+    ASSERT_EQ(const_map.find_with_hash("k10", map.hash_of("k10"))->second, 10);
+
+    for (int i = 0; i < 3000; i += 2) {
+        std::string key = "k" + std::to_string(i);
+        ASSERT_EQ(map.erase_with_hash(key, map.hash_of(key)), 1);
+    }
+    ASSERT_EQ(map.size(), 1500);
+    for (int i = 0; i < 3000; ++i) {
+        ASSERT_EQ(map.contains("k" + std::to_string(i)), i % 2 == 1);
+    }
+}
+
+TEST(HashMapTest, LookupFilterThroughRehashing) {
+    hashmap<int, int> map;
+    map.enable_lookup_filter();
+    std::set<int> expected;
+    // Grow, then shrink, checking hits and misses while tables migrate.
+    for (int i = 0; i < 5000; ++i) {
+        map.insert(std::make_pair(i * 2, i));
+        expected.insert(i * 2);
+        if (i % 97 == 0) {
+            for (int j = 0; j < 2 * i; j += 13) {
+                ASSERT_EQ(map.contains(j), expected.count(j) == 1) << j;
+            }
+        }
+    }
+    for (int i = 0; i < 5000; i += 1) {
+        if (i % 3 != 0) {
+            ASSERT_EQ(map.erase(i * 2), 1);
+            expected.erase(i * 2);
+        }
+        ASSERT_EQ(map.erase(i * 2 + 1), 0);
+    }
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_EQ(map.contains(i), expected.count(i) == 1) << i;
+        ASSERT_EQ(map.find(i) != map.end(), expected.count(i) == 1) << i;
+    }
+
+    map.clear();
+    ASSERT_TRUE(map.has_lookup_filter());
+    map.insert(std::make_pair(1, 1));
+    ASSERT_TRUE(map.contains(1));
+    ASSERT_FALSE(map.contains(2));
+}
+
+// Sends every key to bucket 0 until it is reseeded.
+struct attackable_hash {
+    uint64_t seed = 0;
+    size_t operator()(int key) const {
+        return seed == 0 ? 0 : static_cast<size_t>(hash_mix64(static_cast<uint64_t>(key) + seed));
+    }
+    void reseed() { seed++; }
+};
+
+// Collides under every seed.
+struct hopeless_hash {
+    size_t operator()(int) const { return 0; }
+    void reseed() {}
+};
+
+struct constant_hash {
+    size_t operator()(int) const { return 0; }
+};
+
+TEST(HashMapTest, CollisionAttackReseeds) {
+    hashmap<int, int, attackable_hash> map;
+    for (int i = 0; i < 2000; ++i) {
+        map.insert(std::make_pair(i, i));
+        if (i % 7 == 0) {
+            // Lookups by precomputed hash still work while the reseed migrates.
+            for (int j = 0; j <= i; ++j) {
+                auto it = map.find_with_hash(j, map.hash_of(j));
+                ASSERT_NE(it, map.end()) << j;
+                ASSERT_EQ(it->second, j);
+            }
+            ASSERT_FALSE(map.contains(i + 1));
+        }
+    }
+    ASSERT_EQ(map.reseed_count(), 1);
+    for (int i = 0; i < 2000; i += 2) {
+        ASSERT_EQ(map.erase_with_hash(i, map.hash_of(i)), 1);
+    }
+    ASSERT_EQ(map.size(), 1000);
+    for (int i = 0; i < 2000; ++i) {
+        ASSERT_EQ(map.contains(i), i % 2 == 1) << i;
+    }
+}
+
+TEST(HashMapTest, ReseedsAreSpacedOut) {
+    hashmap<int, int, hopeless_hash> hopeless;
+    for (int i = 0; i < 2000; ++i) {
+        hopeless.insert(std::make_pair(i, i));
+    }
+    // One reseed per doubling from 16 elements.
+    ASSERT_GE(hopeless.reseed_count(), 1);
+    ASSERT_LE(hopeless.reseed_count(), 7);
+
+    hashmap<int, int, constant_hash> constant;
+    for (int i = 0; i < 200; ++i) {
+        constant.insert(std::make_pair(i, i));
+    }
+    ASSERT_EQ(constant.reseed_count(), 0);
+    for (int i = 0; i < 2000; ++i) {
+        ASSERT_EQ(hopeless.at(i), i);
+    }
+}
+
+TEST(HashMapTest, StatsDuringRehash) {
+    hashmap<int, int> map;
+    ASSERT_NE(map.stats().dump().find("No stats available"), std::string::npos);
+    int i = 0;
+    while (!map.is_rehashing() || map.size() < 1000) {
+        map.insert(std::make_pair(i, i));
+        i++;
+    }
+    auto stats = map.stats();
+    ASSERT_TRUE(stats.rehashing);
+    ASSERT_EQ(stats.main.size + stats.old.size, map.size());
+    ASSERT_EQ(stats.main.bucket_count, 2 * stats.old.bucket_count);
+    ASSERT_GT(stats.buckets_to_migrate, 0u);
+    ASSERT_LE(stats.buckets_to_migrate, stats.old.bucket_count);
+    std::string text = stats.dump();
+    ASSERT_NE(text.find("Hash table 0 stats (main hash table):"), std::string::npos);
+    ASSERT_NE(text.find("Hash table 1 stats (old hash table):"), std::string::npos);
+    ASSERT_NE(text.find(" buckets left to migrate: "), std::string::npos);
+
+    while (map.is_rehashing()) {
+        map.erase(-1);
+    }
+    stats = map.stats();
+    ASSERT_FALSE(stats.rehashing);
+    ASSERT_EQ(stats.main.size, map.size());
+    ASSERT_EQ(stats.old.size, 0u);
+    ASSERT_EQ(stats.main.sampled_elements, map.size());
+}
+
+TEST(HashMapTest, MemoryUsage) {
+    hashmap<int, std::string> map;
+    std::string value(64, 'v');
+    int i = 0;
+    while (!map.is_rehashing() || map.size() < 1000) {
+        map.insert(std::make_pair(i, value));
+        i++;
+    }
+    auto usage = map.memory_usage();
+    ASSERT_EQ(usage.object_bytes, sizeof(map));
+    ASSERT_EQ(usage.list_nodes + usage.tree_nodes, map.size());
+    ASSERT_EQ(usage.payload_bytes, map.size() * heap_usage<std::string>()(value));
+    ASSERT_GT(usage.bucket_mmap_bytes, 0u);
+    ASSERT_NE(usage.dump().find(" key/value payload: "), std::string::npos);
+
+    while (map.is_rehashing()) {
+        map.erase(-1);
+    }
+    auto settled = map.memory_usage();
+    ASSERT_EQ(settled.list_nodes + settled.tree_nodes, map.size());
+    ASSERT_EQ(settled.payload_bytes, usage.payload_bytes);
+    // The old table's arrays are gone.
+    ASSERT_LT(settled.bucket_heap_bytes + settled.bucket_mmap_bytes,
+              usage.bucket_heap_bytes + usage.bucket_mmap_bytes);
+}
+
+struct recording_listener : map_event_listener {
+    std::vector<rehash_start_event> starts;
+    std::vector<rehash_finish_event> finishes;
+    size_t steps = 0;
+    size_t moved = 0;
+    size_t empty_steps = 0;
+    size_t treefies = 0;
+    size_t un_treefies = 0;
+    std::vector<size_t> un_treefy_lengths;
+
+    void on_rehash_start(const rehash_start_event& e) override { starts.push_back(e); }
+    void on_rehash_step(const rehash_step_event& e) override {
+        steps++;
+        moved += e.moved;
+        if (e.moved == 0) {
+            empty_steps++;
+        }
+    }
+    void on_rehash_finish(const rehash_finish_event& e) override { finishes.push_back(e); }
+    void on_treefy(const treefy_event&) override { treefies++; }
+    void on_un_treefy(const treefy_event& e) override {
+        un_treefies++;
+        un_treefy_lengths.push_back(e.chain_length);
+    }
+};
+
+TEST(HashMapTest, EventListener) {
+    recording_listener events;
+    hashmap<int, int> map(16);
+    map.set_event_listener(&events);
+    ASSERT_EQ(map.event_listener(), &events);
+
+    int i = 0;
+    while (!map.is_rehashing()) {
+        map.insert(std::make_pair(i, i));
+        i++;
+    }
+    ASSERT_EQ(events.starts.size(), 1u);
+    ASSERT_EQ(events.starts[0].kind, k_rehash_grow);
+    ASSERT_EQ(events.starts[0].old_bucket_count, 16u);
+    ASSERT_EQ(events.starts[0].new_bucket_count, 32u);
+    ASSERT_EQ(events.starts[0].size, map.size());
+
+    size_t size_at_start = map.size();
+    while (map.is_rehashing()) {
+        map.erase(-1);
+    }
+    ASSERT_EQ(events.finishes.size(), 1u);
+    ASSERT_EQ(events.finishes[0].kind, k_rehash_grow);
+    ASSERT_EQ(events.finishes[0].bucket_count, 32u);
+    ASSERT_EQ(events.finishes[0].steps, events.steps);
+    ASSERT_GE(events.finishes[0].time, events.starts[0].time);
+    ASSERT_EQ(events.moved, size_at_start);
+    ASSERT_EQ(events.empty_steps, 0u);
+
+    // Erase down to trigger a shrink.
+    for (int k = 0; k < i; ++k) {
+        map.erase(k);
+    }
+    map.insert(std::make_pair(-2, 0));
+    while (map.is_rehashing()) {
+        map.erase(-1);
+    }
+    ASSERT_GE(events.starts.size(), 2u);
+    ASSERT_EQ(events.starts.back().kind, k_rehash_shrink);
+    ASSERT_EQ(events.finishes.size(), events.starts.size());
+
+    map.set_event_listener(nullptr);
+    size_t starts = events.starts.size();
+    for (int k = 0; k < 1000; ++k) {
+        map.insert(std::make_pair(k, k));
+    }
+    ASSERT_EQ(events.starts.size(), starts);
+}
+
+TEST(HashMapTest, EventListenerTreefyAndReseed) {
+    recording_listener events;
+    // Sizes that neither grow nor shrink a 16-bucket table.
+    hashmap<int, int, constant_hash> map(16);
+    map.set_event_listener(&events);
+    for (int i = 0; i < 11; ++i) {
+        map.insert(std::make_pair(i, i));
+    }
+    ASSERT_FALSE(map.is_rehashing());
+    ASSERT_EQ(events.treefies, 1u);
+    ASSERT_EQ(events.un_treefies, 0u);
+    for (int i = 0; i < 8; ++i) {
+        map.erase(i);
+    }
+    map.insert(std::make_pair(100, 100));
+    ASSERT_EQ(events.un_treefies, 1u);
+
+    // Erasing every element un-treefies only with the last erase.
+    recording_listener emptied;
+    hashmap<int, int, constant_hash> tree(16);
+    tree.set_event_listener(&emptied);
+    for (int i = 0; i < 11; ++i) {
+        tree.insert(std::make_pair(i, i));
+    }
+    for (int i = 0; i < 10; ++i) {
+        tree.erase(i);
+    }
+    ASSERT_EQ(emptied.treefies, 1u);
+    ASSERT_EQ(emptied.un_treefies, 0u);
+    tree.erase(10);
+    ASSERT_EQ(emptied.un_treefies, 1u);
+    ASSERT_EQ(emptied.un_treefy_lengths.back(), 0u);
+    ASSERT_EQ(tree.memory_usage().tree_nodes, 0u);
+
+    recording_listener reseeds;
+    hashmap<int, int, attackable_hash> attacked;
+    attacked.set_event_listener(&reseeds);
+    for (int i = 0; i < 100; ++i) {
+        attacked.insert(std::make_pair(i, i));
+    }
+    ASSERT_EQ(attacked.reseed_count(), 1);
+    bool saw_reseed = false;
+    for (const auto& start : reseeds.starts) {
+        if (start.kind == k_rehash_reseed) {
+            saw_reseed = true;
+            ASSERT_EQ(start.old_bucket_count, start.new_bucket_count);
+        }
+    }
+    ASSERT_TRUE(saw_reseed);
+}
+
+TEST(HashMapTest, ScanGuardDefersReseed) {
+    hashmap<int, int, attackable_hash> map;
+    for (int i = 0; i < 8; ++i) {
+        map.insert(std::make_pair(i, i));
+    }
+    std::set<int> seen;
+    int next_key = 8;
+    {
+        hashmap<int, int, attackable_hash>::scan_guard guard(map);
+        size_t cursor = 0;
+        do {
+            cursor = map.scan(cursor, [&seen](const std::pair<int, int>& kv) { seen.insert(kv.first); }, 1);
+            for (int i = 0; i < 20; ++i, ++next_key) {
+                map.insert(std::make_pair(next_key, next_key));
+            }
+        } while (cursor != 0);
+        ASSERT_GE(next_key, 2 * static_cast<int>(k_collision_chain_length));
+        ASSERT_EQ(map.reseed_count(), 0);
+    }
+    for (int i = 0; i < 8; ++i) {
+        ASSERT_TRUE(seen.count(i)) << i;
+    }
+    // Once a resize started under the guard finishes, the long chain reseeds.
+    for (int i = 0; map.reseed_count() == 0; ++i) {
+        ASSERT_LT(i, 10000);
+        map.erase(-1);
+    }
+}
+
+// Collides for keys below 32 until it is reseeded, and spreads the rest.
+struct partly_attackable_hash {
+    uint64_t seed = 0;
+    size_t operator()(int key) const {
+        if (seed == 0 && key < 32) {
+            return 0;
+        }
+        return static_cast<size_t>(hash_mix64(static_cast<uint64_t>(key) + seed));
+    }
+    void reseed() { seed++; }
+};
+
+TEST(HashMapTest, RangeCursorsAcrossReseed) {
+    hashmap<int, int, partly_attackable_hash> map;
+    for (int i = 32; i < 2000; ++i) {
+        map.insert(std::make_pair(i, i));
+    }
+    while (map.is_rehashing()) {
+        map.erase(-1);
+    }
+    for (int i = 0; map.reseed_count() == 0; ++i) {
+        ASSERT_LT(i, 32);
+        map.insert(std::make_pair(i, i));
+    }
+    // old_ still hashes with seed 0 while the guard holds the migration.
+    hashmap<int, int, partly_attackable_hash>::scan_guard guard(map);
+    ASSERT_TRUE(map.is_rehashing());
+    std::vector<int> present;
+    for (auto& kv : map) {
+        present.push_back(kv.first);
+    }
+
+    auto cursors = split_range_cursors(3);
+    std::map<int, std::set<size_t>> slices;
+    int next_key = 10000;
+    bool done = false;
+    while (!done) {
+        done = true;
+        for (size_t c = 0; c < cursors.size(); ++c) {
+            if (cursors[c].finished()) {
+                continue;
+            }
+            done = false;
+            map.scan_range(cursors[c], [&](const std::pair<int, int>& kv) { slices[kv.first].insert(c); }, 8);
+        }
+        for (int i = 0; i < 20; ++i, ++next_key) {
+            map.insert(std::make_pair(next_key, next_key));
+        }
+    }
+    ASSERT_TRUE(map.is_rehashing());
+    for (int key : present) {
+        ASSERT_EQ(slices[key].size(), 1u) << key;
+    }
+}
+
+#ifndef NDEBUG
+TEST(HashMapDeathTest, UnsafeIteratorDetectsModification) {
+    hashmap<int, int> map;
+    map.insert(std::make_pair(1, 1));
+    map.insert(std::make_pair(2, 2));
+    EXPECT_DEATH({
+        auto it = map.begin();
+        map.insert(std::make_pair(3, 3));
+        ++it;
+    }, "");
+}
+
+TEST(HashMapDeathTest, SlicedSafeIteratorIsUnsafe) {
+    hashmap<int, int> map;
+    map.insert(std::make_pair(1, 1));
+    map.insert(std::make_pair(2, 2));
+    using iterator = hashmap<int, int>::iterator;
+    auto safe = map.safe_begin();
+    EXPECT_DEATH({
+        iterator it = safe;
+        map.insert(std::make_pair(3, 3));
+        ++it;
+    }, "");
+    EXPECT_DEATH({
+        auto it = map.end();
+        it = safe;
+        map.insert(std::make_pair(3, 3));
+        ++it;
+    }, "");
+}
+
+TEST(HashMapDeathTest, StaleHashAfterReseed) {
+    hashmap<int, int, attackable_hash> map;
+    size_t stale = map.hash_of(0);
+    for (int i = 0; map.reseed_count() == 0; ++i) {
+        map.insert(std::make_pair(i, i));
+    }
+    ASSERT_NE(map.hash_of(0), stale);
+    EXPECT_DEATH(map.find_with_hash(0, stale), "");
+    EXPECT_DEATH(map.insert_with_hash(std::make_pair(0, 0), stale), "");
+    EXPECT_DEATH(map.erase_with_hash(0, stale), "");
+}
+#endif
 
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
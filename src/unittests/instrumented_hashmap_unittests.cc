@@ -0,0 +1,43 @@
+#include "gtest/gtest.h"
+#include "smooth/instrumented_hashmap.h"
+#include <string>
+
+using namespace smooth;
+
+TEST(InstrumentedHashMapTest, RecordsBySplitRehashState) {
+  instrumented_hashmap<int, int> map;
+  uint64_t rehashing_inserts = 0;
+  for (int i = 0; i < 5000; ++i) {
+    rehashing_inserts += map.map().is_rehashing();
+    map.insert(std::make_pair(i, i));
+  }
+  for (int i = 0; i < 6000; ++i) {
+    map.find(i);
+    map.contains(i);
+  }
+  map.at(1) = 2;
+  map.erase(1);
+
+  ASSERT_EQ(map.size(), 4999u);
+  ASSERT_EQ(map.histogram(k_op_insert, true).count(), rehashing_inserts);
+  ASSERT_EQ(map.histogram(k_op_insert, false).count() + rehashing_inserts, 5000u);
+  ASSERT_GT(rehashing_inserts, 0u);
+  ASSERT_EQ(map.histogram(k_op_find, false).count() + map.histogram(k_op_find, true).count(), 6000u);
+  ASSERT_EQ(map.histogram(k_op_at, false).count() + map.histogram(k_op_at, true).count(), 1u);
+  ASSERT_LE(map.percentile_ns(k_op_find, false, 0.5), map.percentile_ns(k_op_find, false, 0.999));
+
+  std::string text = map.dump();
+  ASSERT_NE(text.find("insert (rehashing): count="), std::string::npos);
+  ASSERT_NE(text.find("p99.9="), std::string::npos);
+  ASSERT_EQ(text.find("contains (rehashing)") == std::string::npos,
+            map.histogram(k_op_contains, true).count() == 0);
+
+  map.reset_latencies();
+  ASSERT_EQ(map.histogram(k_op_insert, false).count(), 0u);
+  ASSERT_EQ(map.dump(), "");
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,64 @@
+#include "gtest/gtest.h"
+#include "smooth/latency.h"
+#include <random>
+#include <thread>
+
+using namespace smooth;
+
+TEST(LatencyTest, BucketBoundsAreContiguous) {
+  for (size_t i = 0; i + 1 < k_latency_buckets; ++i) {
+    uint64_t top = latency_histogram::bucket_top(i);
+    ASSERT_EQ(latency_histogram::bucket_of(top), i) << i;
+    ASSERT_EQ(latency_histogram::bucket_of(top + 1), i + 1) << i;
+  }
+  ASSERT_EQ(latency_histogram::bucket_of(~uint64_t(0)), k_latency_buckets - 1);
+  ASSERT_EQ(latency_histogram::bucket_top(k_latency_buckets - 1), ~uint64_t(0));
+}
+
+TEST(LatencyTest, RelativeError) {
+  std::mt19937_64 rng(3);
+  for (int i = 0; i < 100000; ++i) {
+    uint64_t value = rng() >> (rng() % 64);
+    uint64_t top = latency_histogram::bucket_top(latency_histogram::bucket_of(value));
+    ASSERT_GE(top, value);
+    ASSERT_LE(static_cast<double>(top - value), value / 16.0 + 1);
+  }
+}
+
+TEST(LatencyTest, Percentiles) {
+  latency_histogram h;
+  ASSERT_EQ(h.percentile(0.99), 0u);
+  for (uint64_t v = 1; v <= 1000; ++v) {
+    h.record(v);
+  }
+  h.record(1000000);
+  ASSERT_EQ(h.count(), 1001u);
+  ASSERT_EQ(h.max(), 1000000u);
+  ASSERT_NEAR(static_cast<double>(h.percentile(0.5)), 500.0, 500.0 / 16);
+  ASSERT_NEAR(static_cast<double>(h.percentile(0.99)), 990.0, 990.0 / 16);
+  ASSERT_EQ(h.percentile(1.0), 1000000u);
+  ASSERT_EQ(h.percentile(0.0), 1u);
+
+  latency_histogram other;
+  other.record(5);
+  h.merge(other);
+  ASSERT_EQ(h.count(), 1002u);
+  h.reset();
+  ASSERT_EQ(h.count(), 0u);
+  ASSERT_EQ(h.max(), 0u);
+}
+
+TEST(LatencyTest, ClockMeasuresSleep) {
+  tsc_clock clock;
+  ASSERT_GT(clock.ns_per_tick(), 0.0);
+  uint64_t start = tsc_clock::now();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  uint64_t ns = clock.to_nanos(tsc_clock::now() - start);
+  ASSERT_GE(ns, 15000000u);
+  ASSERT_LE(ns, 2000000000u);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
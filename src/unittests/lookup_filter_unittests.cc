@@ -0,0 +1,82 @@
+#include "gtest/gtest.h"
+#include "smooth/lookup_filter.h"
+#include <random>
+#include <vector>
+
+using namespace smooth;
+
+TEST(LookupFilterTest, NoFalseNegatives) {
+  counting_bloom_filter filter(1024);
+  std::mt19937_64 rng(1);
+  std::vector<uint64_t> added;
+  for (int i = 0; i < 768; i++) {
+    added.push_back(rng());
+    filter.add(added.back());
+  }
+  for (uint64_t h : added) {
+    ASSERT_TRUE(filter.may_contain(h));
+  }
+}
+
+TEST(LookupFilterTest, FalsePositiveRate) {
+  // 3/4 load, hashmap's maximum.
+  counting_bloom_filter filter(4096);
+  std::mt19937_64 rng(2);
+  for (int i = 0; i < 3072; i++) {
+    filter.add(rng());
+  }
+  int false_positives = 0;
+  const int probes = 100000;
+  for (int i = 0; i < probes; i++) {
+    false_positives += filter.may_contain(rng()) ? 1 : 0;
+  }
+  ASSERT_LT(false_positives, probes / 20);
+}
+
+TEST(LookupFilterTest, RemoveRestoresMisses) {
+  counting_bloom_filter filter(256);
+  std::vector<uint64_t> hashes;
+  for (uint64_t i = 0; i < 200; i++) {
+    hashes.push_back(hash_mix64(i));
+    filter.add(hashes.back());
+  }
+  // Remove half: the rest must still be found.
+  for (size_t i = 0; i < hashes.size(); i += 2) {
+    filter.remove(hashes[i]);
+  }
+  for (size_t i = 1; i < hashes.size(); i += 2) {
+    ASSERT_TRUE(filter.may_contain(hashes[i]));
+  }
+  for (size_t i = 1; i < hashes.size(); i += 2) {
+    filter.remove(hashes[i]);
+  }
+  for (uint64_t h : hashes) {
+    ASSERT_FALSE(filter.may_contain(h));
+  }
+}
+
+TEST(LookupFilterTest, SaturatedCountersStick) {
+  counting_bloom_filter filter(1);
+  // The same hash added more often than a counter can count.
+  for (int i = 0; i < 40; i++) {
+    filter.add(42);
+  }
+  for (int i = 0; i < 39; i++) {
+    filter.remove(42);
+  }
+  ASSERT_TRUE(filter.may_contain(42));
+}
+
+TEST(LookupFilterTest, Clear) {
+  counting_bloom_filter filter(64);
+  filter.add(7);
+  ASSERT_TRUE(filter.may_contain(7));
+  filter.clear();
+  ASSERT_FALSE(filter.may_contain(7));
+  ASSERT_EQ(filter.memory_bytes(), 64u * 10 / 128 * 64);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,58 @@
+#include "gtest/gtest.h"
+#include "smooth/memory_usage.h"
+#include <string>
+#include <utility>
+
+using namespace smooth;
+
+struct blob {
+  size_t bytes;
+};
+
+namespace smooth {
+template<>
+struct heap_usage<blob> {
+  size_t operator()(const blob &b) const { return b.bytes; }
+};
+}  // namespace smooth
+
+TEST(MemoryUsageTest, HeapUsage) {
+  ASSERT_EQ(heap_usage<int>()(42), 0u);
+  // Short strings stay in the small-string buffer.
+  ASSERT_EQ(heap_usage<std::string>()(std::string("short")), 0u);
+  std::string long_string(1000, 'x');
+  ASSERT_GE(heap_usage<std::string>()(long_string), 1001u);
+
+  std::pair<std::string, blob> kv(long_string, blob{24});
+  size_t pair_bytes = heap_usage<std::pair<std::string, blob>>()(kv);
+  ASSERT_EQ(pair_bytes, heap_usage<std::string>()(long_string) + 24);
+}
+
+TEST(MemoryUsageTest, TotalAndDump) {
+  memory_breakdown a;
+  a.object_bytes = 1;
+  a.bucket_heap_bytes = 2;
+  a.bucket_mmap_bytes = 4;
+  a.list_node_bytes = 8;
+  a.tree_node_bytes = 16;
+  a.payload_bytes = 32;
+  a.filter_bytes = 64;
+  a.list_nodes = 1;
+  a.tree_nodes = 2;
+  ASSERT_EQ(a.total(), 127u);
+
+  memory_breakdown sum = a;
+  sum += a;
+  ASSERT_EQ(sum.total(), 254u);
+  ASSERT_EQ(sum.list_nodes, 2u);
+  ASSERT_EQ(sum.tree_nodes, 4u);
+
+  std::string text = sum.dump();
+  ASSERT_NE(text.find("total: 254\n"), std::string::npos);
+  ASSERT_NE(text.find(" tree nodes: 32 (4 nodes)\n"), std::string::npos);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
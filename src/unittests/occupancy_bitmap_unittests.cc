@@ -0,0 +1,79 @@
+#include "gtest/gtest.h"
+#include "smooth/occupancy_bitmap.h"
+#include <vector>
+
+using namespace smooth;
+
+TEST(OccupancyBitmapTest, EmptyBitmap) {
+  occupancy_bitmap bitmap(100);
+  ASSERT_EQ(bitmap.size(), 100);
+  ASSERT_EQ(bitmap.count(), 0);
+  ASSERT_EQ(bitmap.find_next(0), 100);
+}
+
+TEST(OccupancyBitmapTest, SetResetTest) {
+  occupancy_bitmap bitmap(130);
+  bitmap.set(0);
+  bitmap.set(64);
+  bitmap.set(129);
+  ASSERT_TRUE(bitmap.test(0));
+  ASSERT_TRUE(bitmap.test(64));
+  ASSERT_TRUE(bitmap.test(129));
+  ASSERT_FALSE(bitmap.test(1));
+  ASSERT_EQ(bitmap.count(), 3);
+
+  bitmap.reset(64);
+  ASSERT_FALSE(bitmap.test(64));
+  ASSERT_EQ(bitmap.count(), 2);
+}
+
+TEST(OccupancyBitmapTest, FindNext) {
+  occupancy_bitmap bitmap(200);
+  bitmap.set(3);
+  bitmap.set(63);
+  bitmap.set(64);
+  bitmap.set(190);
+
+  ASSERT_EQ(bitmap.find_next(0), 3);
+  ASSERT_EQ(bitmap.find_next(3), 3);
+  ASSERT_EQ(bitmap.find_next(4), 63);
+  ASSERT_EQ(bitmap.find_next(64), 64);
+  ASSERT_EQ(bitmap.find_next(65), 190);
+  ASSERT_EQ(bitmap.find_next(191), 200);
+  ASSERT_EQ(bitmap.find_next(500), 200);
+}
+
+TEST(OccupancyBitmapTest, FindNextSkipsLongEmptyRuns) {
+  const size_t kSize = 1 << 16;
+  occupancy_bitmap bitmap(kSize);
+  std::vector<size_t> set_bits = {5, 700, 701, 4096, 40000, kSize - 1};
+  for (size_t bit : set_bits) {
+    bitmap.set(bit);
+  }
+
+  std::vector<size_t> found;
+  for (size_t i = bitmap.find_next(0); i < kSize; i = bitmap.find_next(i + 1)) {
+    found.push_back(i);
+  }
+  ASSERT_EQ(found, set_bits);
+}
+
+TEST(OccupancyBitmapTest, MoveAndSwap) {
+  occupancy_bitmap a(64);
+  a.set(10);
+  occupancy_bitmap b(std::move(a));
+  ASSERT_EQ(a.size(), 0);
+  ASSERT_TRUE(b.test(10));
+
+  occupancy_bitmap c(128);
+  c.set(100);
+  b.swap(c);
+  ASSERT_EQ(b.size(), 128);
+  ASSERT_TRUE(b.test(100));
+  ASSERT_TRUE(c.test(10));
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,58 @@
+#include "gtest/gtest.h"
+#include "src/benchmarks/perf_counters.h"
+#include <cstdint>
+
+static uint64_t spin(uint64_t rounds) {
+  volatile uint64_t x = 1;
+  for (uint64_t i = 0; i < rounds; i++) {
+    x = x * 6364136223846793005ull + 1442695040888963407ull;
+  }
+  return x;
+}
+
+TEST(PerfCountersTest, NothingCountedWithoutStart) {
+  perf_counters counters;
+  spin(100000);
+  for (size_t i = 0; i < k_num_perf_counters; i++) {
+    EXPECT_EQ(counters.total(static_cast<perf_counter_id>(i)), 0u);
+  }
+}
+
+TEST(PerfCountersTest, PerOpListsOnlyAvailableCounters) {
+  perf_counters counters;
+  std::string report = counters.per_op(10);
+  for (size_t i = 0; i < k_num_perf_counters; i++) {
+    perf_counter_id id = static_cast<perf_counter_id>(i);
+    bool listed = report.find(std::string(perf_counter_name(id)) + "/op=") != std::string::npos;
+    EXPECT_EQ(listed, counters.available(id)) << perf_counter_name(id);
+  }
+}
+
+TEST(PerfCountersTest, InstructionsAccumulate) {
+  perf_counters counters;
+  if (!counters.available(k_perf_instructions)) {
+    GTEST_SKIP() << "perf_event_open cannot count instructions here";
+  }
+  counters.start();
+  spin(1000000);
+  counters.stop();
+  uint64_t once = counters.total(k_perf_instructions);
+  EXPECT_GT(once, 1000000u);
+
+  // Work outside start() and stop() is not counted.
+  spin(10000000);
+  counters.start();
+  spin(1000000);
+  counters.stop();
+  uint64_t twice = counters.total(k_perf_instructions);
+  EXPECT_GT(twice, once + once / 2);
+  EXPECT_LT(twice, once * 3);
+
+  counters.reset();
+  EXPECT_EQ(counters.total(k_perf_instructions), 0u);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
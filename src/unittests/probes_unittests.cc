@@ -0,0 +1,50 @@
+#include "gtest/gtest.h"
+#include "smooth/hashmap.h"
+#include "smooth/probes.h"
+
+using namespace smooth;
+
+TEST(ProbesTest, ArgumentsOnlyEvaluatedWhenCompiledIn) {
+  int evaluated = 0;
+  SMOOTH_PROBE1(test, ++evaluated);
+  SMOOTH_PROBE4(test, ++evaluated, ++evaluated, ++evaluated, ++evaluated);
+#ifdef SMOOTH_HAVE_PROBES
+  ASSERT_EQ(evaluated, 5);
+#else
+  ASSERT_EQ(evaluated, 0);
+#endif
+}
+
+// Passes through every probe site: mapped arrays, growth, migration steps,
+// treefy and un-treefy, and shrinking.
+TEST(ProbesTest, MapLifecycle) {
+  hashmap<int, int> map;
+  for (int i = 0; i < 10000; ++i) {
+    map.insert(std::make_pair(i, i));
+  }
+  for (int i = 0; i < 10000; ++i) {
+    ASSERT_EQ(map.erase(i), 1);
+  }
+  while (map.is_rehashing()) {
+    map.erase(-1);
+  }
+  ASSERT_EQ(map.size(), 0u);
+
+  // Buckets live in zeroed tables; value-initialize to match.
+  tree_list_trivial<int> bucket = tree_list_trivial<int>();
+  for (int i = 0; i < 12; ++i) {
+    bucket.insert(i);
+  }
+  ASSERT_TRUE(bucket.is_tree());
+  while (bucket.size() > 2) {
+    bucket.erase(bucket.begin());
+  }
+  bucket.insert(100);
+  ASSERT_FALSE(bucket.is_tree());
+  bucket.clear();
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
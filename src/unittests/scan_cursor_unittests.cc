@@ -0,0 +1,84 @@
+#include "gtest/gtest.h"
+#include "smooth/scan_cursor.h"
+#include <limits>
+#include <stdexcept>
+
+using namespace smooth;
+
+TEST(ScanCursorTest, ReverseBits) {
+  ASSERT_EQ(reverse_bits(0), 0u);
+  ASSERT_EQ(reverse_bits(1), size_t(1) << (sizeof(size_t) * 8 - 1));
+  ASSERT_EQ(reverse_bits(reverse_bits(12345)), 12345u);
+}
+
+TEST(ScanCursorTest, SplitCoversWholeSpace) {
+  const size_t max = std::numeric_limits<size_t>::max();
+  for (size_t count : {1, 2, 3, 4, 7, 16, 100}) {
+    auto cursors = split_range_cursors(count);
+    ASSERT_EQ(cursors.size(), count);
+    ASSERT_EQ(cursors.front().first(), 0u);
+    ASSERT_EQ(cursors.back().last(), max);
+    for (size_t i = 1; i < count; i++) {
+      ASSERT_EQ(cursors[i].first(), cursors[i - 1].last() + 1);
+    }
+    for (auto &cursor : cursors) {
+      ASSERT_FALSE(cursor.finished());
+      ASSERT_EQ(reverse_bits(cursor.position()), cursor.first());
+    }
+  }
+  ASSERT_THROW(split_range_cursors(0), std::invalid_argument);
+}
+
+TEST(ScanCursorTest, ContainsHash) {
+  auto cursors = split_range_cursors(4);
+  for (size_t h = 0; h < 64; h++) {
+    int owners = 0;
+    for (auto &cursor : cursors) {
+      owners += cursor.contains_hash(h) ? 1 : 0;
+    }
+    ASSERT_EQ(owners, 1);
+  }
+}
+
+TEST(ScanCursorTest, AdvanceFinishesAtRangeEnd) {
+  auto cursors = split_range_cursors(2);
+  // Bit-reversed, cursor 1 is the first position of the upper half.
+  cursors[0].advance(2);
+  ASSERT_FALSE(cursors[0].finished());
+  ASSERT_EQ(cursors[0].position(), 2u);
+  cursors[0].advance(1);
+  ASSERT_TRUE(cursors[0].finished());
+
+  cursors[1].advance(0);
+  ASSERT_TRUE(cursors[1].finished());
+}
+
+TEST(ScanCursorTest, SerializeRoundTrip) {
+  auto cursors = split_range_cursors(3);
+  cursors[1].advance(reverse_bits(cursors[1].first() + 1000));
+  for (auto &cursor : cursors) {
+    auto copy = range_cursor::deserialize(cursor.serialize());
+    ASSERT_EQ(copy.first(), cursor.first());
+    ASSERT_EQ(copy.last(), cursor.last());
+    ASSERT_EQ(copy.position(), cursor.position());
+    ASSERT_EQ(copy.finished(), cursor.finished());
+  }
+  cursors[2].advance(0);
+  ASSERT_TRUE(range_cursor::deserialize(cursors[2].serialize()).finished());
+}
+
+TEST(ScanCursorTest, DeserializeRejectsMalformed) {
+  ASSERT_THROW(range_cursor::deserialize(""), std::invalid_argument);
+  ASSERT_THROW(range_cursor::deserialize("rc1:0:1"), std::invalid_argument);
+  ASSERT_THROW(range_cursor::deserialize("rc2:0:ffff:0:0"), std::invalid_argument);
+  ASSERT_THROW(range_cursor::deserialize("rc1:0:ffff:0:2"), std::invalid_argument);
+  ASSERT_THROW(range_cursor::deserialize("rc1:ffff:0:0:0"), std::invalid_argument);
+  ASSERT_THROW(range_cursor::deserialize("rc1:0:ffff:0:0x"), std::invalid_argument);
+  // Position 1 reverses to the top of the space, outside [0, 0xffff].
+  ASSERT_THROW(range_cursor::deserialize("rc1:0:ffff:1:0"), std::invalid_argument);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
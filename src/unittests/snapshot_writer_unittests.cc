@@ -0,0 +1,282 @@
+#include "gtest/gtest.h"
+#include "smooth/fixed_hashmap.h"
+#include "smooth/snapshot_writer.h"
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace smooth;
+
+static std::string temp_path(const char *name) {
+  const char *dir = std::getenv("TMPDIR");
+  return std::string(dir ? dir : "/tmp") + "/" + name + "." + std::to_string(::getpid());
+}
+
+static snapshot_options small_buffers() {
+  snapshot_options options;
+  options.buffer_size = k_snapshot_alignment;
+  options.buffer_count = 2;
+  options.sync_on_finish = false;
+  return options;
+}
+
+TEST(SnapshotWriterTest, EmptyMap) {
+  fixed_hashmap<int64_t, int64_t> map;
+  std::string path = temp_path("empty_snapshot");
+  {
+    snapshot_writer<fixed_hashmap<int64_t, int64_t>> writer(map, path, small_buffers());
+    writer.run();
+    ASSERT_TRUE(writer.finished());
+    ASSERT_EQ(writer.entries_written(), 0);
+    ASSERT_EQ(writer.bytes_written(), k_snapshot_header_size + k_snapshot_footer_size);
+  }
+
+  fixed_hashmap<int64_t, int64_t> loaded;
+  ASSERT_EQ(load_snapshot(path, &loaded), 0);
+  std::remove(path.c_str());
+}
+
+TEST(SnapshotWriterTest, RoundTripIntegers) {
+  const int64_t kCount = 20000;
+  fixed_hashmap<int64_t, int64_t> map(4096);
+  for (int64_t i = 0; i < kCount; ++i) {
+    map.emplace(i, i * 3);
+  }
+
+  std::string path = temp_path("int_snapshot");
+  {
+    snapshot_writer<fixed_hashmap<int64_t, int64_t>> writer(map, path, small_buffers());
+    writer.run();
+    ASSERT_EQ(writer.entries_written(), kCount);
+  }
+
+  fixed_hashmap<int64_t, int64_t> loaded(4096);
+  ASSERT_EQ(load_snapshot(path, &loaded), kCount);
+  for (int64_t i = 0; i < kCount; ++i) {
+    ASSERT_EQ(loaded.at(i), i * 3);
+  }
+  std::remove(path.c_str());
+}
+
+TEST(SnapshotWriterTest, RoundTripStringsAcrossBuffers) {
+  fixed_hashmap<std::string, std::string> map(64);
+  for (int i = 0; i < 500; ++i) {
+    // Values larger than one buffer force records to straddle buffers.
+    map.emplace("key" + std::to_string(i), std::string(i * 17, static_cast<char>('a' + i % 26)));
+  }
+
+  std::string path = temp_path("string_snapshot");
+  snapshot_writer<fixed_hashmap<std::string, std::string>> writer(map, path, small_buffers());
+  writer.run();
+
+  fixed_hashmap<std::string, std::string> loaded(64);
+  ASSERT_EQ(load_snapshot(path, &loaded), 500);
+  for (int i = 0; i < 500; ++i) {
+    ASSERT_EQ(loaded.at("key" + std::to_string(i)), std::string(i * 17, static_cast<char>('a' + i % 26)));
+  }
+  std::remove(path.c_str());
+}
+
+TEST(SnapshotWriterTest, IncrementalStepsWhileServing) {
+  fixed_hashmap<int64_t, int64_t> map(1024);
+  for (int64_t i = 0; i < 2000; ++i) {
+    map.emplace(i, i);
+  }
+
+  std::string path = temp_path("incremental_snapshot");
+  snapshot_writer<fixed_hashmap<int64_t, int64_t>> writer(map, path, small_buffers());
+  int64_t next_key = 2000;
+  size_t steps = 0;
+  while (!writer.step(16)) {
+    // Keys inserted while the snapshot is running may or may not be included.
+    map.emplace(next_key, next_key);
+    next_key++;
+    steps++;
+  }
+  ASSERT_GT(steps, 1);
+
+  fixed_hashmap<int64_t, int64_t> loaded(1024);
+  size_t count = load_snapshot(path, &loaded);
+  ASSERT_GE(count, 2000);
+  for (int64_t i = 0; i < 2000; ++i) {
+    ASSERT_TRUE(loaded.contains(i));
+  }
+  std::remove(path.c_str());
+}
+
+// Completes one write per call to reap(), however many are queued, and
+// records whether it was ever asked to wait.
+class slow_io : public snapshot_io {
+public:
+  slow_io(int fd, bool *waited) : fd_(fd), waited_(waited) {}
+
+  void submit(size_t slot, const char *data, size_t len, uint64_t offset) override {
+    queued_.push_back(write{slot, std::string(data, len), offset});
+  }
+
+  void submit_sync(size_t slot) override { queued_.push_back(write{slot, std::string(), 0}); }
+
+  void reap(bool wait, std::vector<size_t> *done) override {
+    if (wait) {
+      *waited_ = true;
+    }
+    if (queued_.empty()) {
+      return;
+    }
+    write next = queued_.front();
+    queued_.erase(queued_.begin());
+    ASSERT_EQ(snapshot_pwrite_fully(fd_, next.data.data(), next.data.size(), next.offset), 0);
+    done->push_back(next.slot);
+  }
+
+private:
+  struct write {
+    size_t slot;
+    std::string data;
+    uint64_t offset;
+  };
+
+  int fd_;
+  bool *waited_;
+  std::vector<write> queued_;
+};
+
+TEST(SnapshotWriterTest, StepNeverWaitsForIo) {
+  // Buckets of about ten 1 KB records each, so every bucket overflows a
+  // ring of one 4 KB buffer.
+  fixed_hashmap<int64_t, std::string> map(8);
+  for (int64_t i = 0; i < 80; ++i) {
+    map.emplace(i, std::string(1000 + i, static_cast<char>('a' + i % 26)));
+  }
+
+  bool waited = false;
+  snapshot_options options = small_buffers();
+  options.buffer_count = 1;
+  options.io_factory = [&waited](int fd, size_t) { return std::unique_ptr<snapshot_io>(new slow_io(fd, &waited)); };
+  std::string path = temp_path("slow_snapshot");
+  {
+    snapshot_writer<fixed_hashmap<int64_t, std::string>> writer(map, path, options);
+    size_t steps = 0;
+    while (!writer.step(1)) {
+      ASSERT_FALSE(waited) << "step() waited for I/O at step " << steps;
+      steps++;
+      ASSERT_LT(steps, 10000u);
+    }
+    ASSERT_FALSE(waited);
+    ASSERT_GT(steps, 20u);
+  }
+
+  fixed_hashmap<int64_t, std::string> loaded(8);
+  ASSERT_EQ(load_snapshot(path, &loaded), 80u);
+  for (int64_t i = 0; i < 80; ++i) {
+    ASSERT_EQ(loaded.at(i), std::string(1000 + i, static_cast<char>('a' + i % 26)));
+  }
+  std::remove(path.c_str());
+}
+
+// Writes synchronously but holds the sync back until *release is set, the
+// way a slow disk would.
+class held_sync_io : public snapshot_io {
+public:
+  held_sync_io(int fd, const bool *release, bool *synced) : fd_(fd), release_(release), synced_(synced) {}
+
+  void submit(size_t slot, const char *data, size_t len, uint64_t offset) override {
+    ASSERT_EQ(snapshot_pwrite_fully(fd_, data, len, offset), 0);
+    done_.push_back(slot);
+  }
+
+  void submit_sync(size_t slot) override {
+    ASSERT_FALSE(sync_pending_);
+    sync_pending_ = true;
+    sync_slot_ = slot;
+  }
+
+  void reap(bool, std::vector<size_t> *done) override {
+    done->insert(done->end(), done_.begin(), done_.end());
+    done_.clear();
+    if (sync_pending_ && *release_) {
+      ASSERT_EQ(::fdatasync(fd_), 0);
+      *synced_ = true;
+      sync_pending_ = false;
+      done->push_back(sync_slot_);
+    }
+  }
+
+private:
+  int fd_;
+  const bool *release_;
+  bool *synced_;
+  bool sync_pending_ = false;
+  size_t sync_slot_ = 0;
+  std::vector<size_t> done_;
+};
+
+TEST(SnapshotWriterTest, StepNeverWaitsForSync) {
+  fixed_hashmap<int64_t, int64_t> map;
+  for (int64_t i = 0; i < 100; ++i) {
+    map.emplace(i, -i);
+  }
+
+  bool release = false;
+  bool synced = false;
+  snapshot_options options = small_buffers();
+  options.sync_on_finish = true;
+  options.io_factory = [&](int fd, size_t) {
+    return std::unique_ptr<snapshot_io>(new held_sync_io(fd, &release, &synced));
+  };
+  std::string path = temp_path("held_sync_snapshot");
+  {
+    snapshot_writer<fixed_hashmap<int64_t, int64_t>> writer(map, path, options);
+    // A step() that waited for the held sync would never return.
+    for (int i = 0; i < 100; ++i) {
+      ASSERT_FALSE(writer.step());
+    }
+    ASSERT_FALSE(writer.finished());
+    ASSERT_FALSE(synced);
+
+    release = true;
+    ASSERT_TRUE(writer.step());
+    ASSERT_TRUE(synced);
+    ASSERT_TRUE(writer.finished());
+  }
+
+  fixed_hashmap<int64_t, int64_t> loaded;
+  ASSERT_EQ(load_snapshot(path, &loaded), 100u);
+  std::remove(path.c_str());
+}
+
+TEST(SnapshotWriterTest, DirectIoRequest) {
+  fixed_hashmap<int64_t, int64_t> map;
+  for (int64_t i = 0; i < 100; ++i) {
+    map.emplace(i, -i);
+  }
+
+  snapshot_options options = small_buffers();
+  options.direct_io = true;
+  options.sync_on_finish = true;
+  std::string path = temp_path("direct_snapshot");
+  {
+    // Falls back to buffered I/O where O_DIRECT is not supported.
+    snapshot_writer<fixed_hashmap<int64_t, int64_t>> writer(map, path, options);
+    writer.run();
+  }
+
+  fixed_hashmap<int64_t, int64_t> loaded;
+  ASSERT_EQ(load_snapshot(path, &loaded), 100);
+  ASSERT_EQ(loaded.at(42), -42);
+  std::remove(path.c_str());
+}
+
+TEST(SnapshotWriterTest, RejectsUnalignedBuffers) {
+  fixed_hashmap<int64_t, int64_t> map;
+  snapshot_options options;
+  options.buffer_size = 1000;
+  ASSERT_THROW((snapshot_writer<fixed_hashmap<int64_t, int64_t>>(map, temp_path("bad_snapshot"), options)),
+               std::invalid_argument);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,60 @@
+#include "gtest/gtest.h"
+#include "smooth/table_stats.h"
+#include <string>
+
+using namespace smooth;
+
+TEST(TableStatsTest, Histogram) {
+  table_stats stats;
+  stats.bucket_count = 6;
+  stats.size = 1 + 3 + 60;
+  stats.add_bucket(0, false, 0);
+  stats.add_bucket(0, false, 0);
+  stats.add_bucket(1, false, 0);
+  stats.add_bucket(3, false, 0);
+  stats.add_bucket(60, true, 7);
+  stats.add_bucket(0, false, 0);
+  stats.used_buckets = 3;
+
+  ASSERT_FALSE(stats.sampled());
+  ASSERT_EQ(stats.chain_lengths[0], 3u);
+  ASSERT_EQ(stats.chain_lengths[1], 1u);
+  ASSERT_EQ(stats.chain_lengths[3], 1u);
+  ASSERT_EQ(stats.chain_lengths[k_stats_chain_slots - 1], 1u);
+  ASSERT_EQ(stats.max_chain, 60u);
+  ASSERT_EQ(stats.tree_buckets, 1u);
+  ASSERT_EQ(stats.max_tree_depth, 7u);
+  ASSERT_DOUBLE_EQ(stats.average_chain(), 64.0 / 3);
+  // 1 + (1 + 2 + 3) + (1 + ... + 60) comparisons over 64 elements.
+  ASSERT_DOUBLE_EQ(stats.average_probe(), (1 + 6 + 1830) / 64.0);
+}
+
+TEST(TableStatsTest, Dump) {
+  table_stats stats;
+  stats.bucket_count = 4;
+  stats.size = 3;
+  stats.add_bucket(2, false, 0);
+  stats.add_bucket(0, false, 0);
+  stats.add_bucket(1, false, 0);
+  stats.used_buckets = 2;
+
+  std::string text = stats.dump(0, "main hash table");
+  ASSERT_EQ(text.find("Hash table 0 stats (main hash table):\n"), 0u);
+  ASSERT_NE(text.find(" table size: 4\n"), std::string::npos);
+  ASSERT_NE(text.find(" number of elements: 3\n"), std::string::npos);
+  ASSERT_NE(text.find(" different slots: 2\n"), std::string::npos);
+  ASSERT_NE(text.find(" max chain length: 2\n"), std::string::npos);
+  ASSERT_NE(text.find(" avg chain length (counted): 1.50\n"), std::string::npos);
+  ASSERT_NE(text.find("   0: 1 (33.33%)\n"), std::string::npos);
+  ASSERT_NE(text.find(" sampled buckets: 3 of 4\n"), std::string::npos);
+  // Empty slots of the histogram are left out.
+  ASSERT_EQ(text.find("   3: "), std::string::npos);
+
+  table_stats empty;
+  ASSERT_NE(empty.dump(1, "old hash table").find("No stats available"), std::string::npos);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
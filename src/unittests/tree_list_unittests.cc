@@ -329,6 +329,42 @@ TYPED_TEST(TreeListTest, TestEraseIteratorFromTree) {
     }
 }
 
+TYPED_TEST(TreeListTest, FindTaggedThroughTreefy) {
+    tree_list<int> list;
+    auto tag = [](int v) { return static_cast<uint8_t>(v % 3); };
+    auto check = [&](int lo, int hi) {
+        for (int v = 0; v < 20; ++v) {
+            auto it = list.find_tagged(tag(v), [v](int x) { return x == v; });
+            if (v >= lo && v < hi) {
+                ASSERT_NE(it, list.end()) << v;
+                ASSERT_EQ(v, *it);
+            } else {
+                ASSERT_EQ(it, list.end()) << v;
+            }
+            // A wrong tag hides the element even though it matches.
+            ASSERT_EQ(list.find_tagged(static_cast<uint8_t>(tag(v) + 1), [v](int x) { return x == v; }), list.end());
+        }
+    };
+
+    for (int v = 0; v < 15; ++v) {
+        if (v % 2 == 0) {
+            list.insert_tagged(v, tag(v));
+        } else {
+            list.emplace_tagged(tag(v), v);
+        }
+        check(0, v + 1);
+    }
+
+    // Erase down through the un-treefy threshold from the front, so the
+    // header tags must follow the remaining nodes.
+    for (int v = 0; v < 12; ++v) {
+        list.erase(v);
+        check(v + 1, 15);
+    }
+    list.insert_tagged(15, tag(15));
+    check(12, 16);
+}
+
 
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
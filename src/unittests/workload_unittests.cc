@@ -0,0 +1,132 @@
+#include "gtest/gtest.h"
+#include "src/benchmarks/workload.h"
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace workload;
+
+TEST(WorkloadTest, ZipfianIsSkewed) {
+  zipfian_generator zipf(1000);
+  std::mt19937_64 rng(7);
+  std::vector<size_t> counts(1000, 0);
+  const size_t samples = 200000;
+  for (size_t i = 0; i < samples; i++) {
+    uint64_t rank = zipf.next(rng);
+    ASSERT_LT(rank, 1000u);
+    counts[rank]++;
+  }
+  // With theta 0.99 over 1000 items rank 0 takes about 13%, and each rank
+  // is roughly twice as popular as the one at twice its index.
+  ASSERT_GT(counts[0], samples / 10);
+  ASSERT_LT(counts[0], samples / 6);
+  ASSERT_GT(counts[0], counts[1]);
+  ASSERT_GT(counts[10], counts[100]);
+
+  zipf.grow(2000);
+  ASSERT_EQ(zipf.items(), 2000u);
+  bool above = false;
+  for (size_t i = 0; i < samples && !above; i++) {
+    above = zipf.next(rng) >= 1000;
+  }
+  ASSERT_TRUE(above);
+}
+
+TEST(WorkloadTest, YcsbMix) {
+  operation_mix mix;
+  workload_options options;
+  ASSERT_FALSE(ycsb_workload('g', mix, options));
+  ASSERT_TRUE(ycsb_workload('b', mix, options));
+  ASSERT_EQ(options.distribution, k_dist_zipfian);
+
+  operation_stream stream(mix, options, 10000);
+  size_t counts[k_num_trace_ops] = {};
+  for (int i = 0; i < 100000; i++) {
+    trace_event event = stream.next();
+    ASSERT_LT(event.key, 10000u);
+    counts[event.op]++;
+  }
+  ASSERT_EQ(counts[k_trace_read] + counts[k_trace_update], 100000u);
+  ASSERT_GT(counts[k_trace_update], 4000u);
+  ASSERT_LT(counts[k_trace_update], 6000u);
+}
+
+TEST(WorkloadTest, LatestPrefersNewKeys) {
+  operation_mix mix;
+  workload_options options;
+  ASSERT_TRUE(ycsb_workload('d', mix, options));
+  ASSERT_EQ(options.distribution, k_dist_latest);
+  operation_stream stream(mix, options, 10000);
+  size_t recent = 0;
+  size_t reads = 0;
+  uint64_t next_insert = 10000;
+  for (int i = 0; i < 20000; i++) {
+    trace_event event = stream.next();
+    if (event.op == k_trace_insert) {
+      ASSERT_EQ(event.key, next_insert++);
+      continue;
+    }
+    reads++;
+    ASSERT_LT(event.key, stream.inserted());
+    if (event.key + 100 >= stream.inserted()) {
+      recent++;
+    }
+  }
+  ASSERT_GT(recent, reads / 2);
+}
+
+TEST(WorkloadTest, Hotspot) {
+  operation_mix mix;
+  mix.read = 1;
+  workload_options options;
+  options.distribution = k_dist_hotspot;
+  options.hot_fraction = 0.1;
+  options.hot_ops = 0.9;
+  operation_stream stream(mix, options, 10000);
+  size_t hot = 0;
+  for (int i = 0; i < 100000; i++) {
+    if (stream.next().key < 1000) {
+      hot++;
+    }
+  }
+  ASSERT_GT(hot, 88000u);
+  ASSERT_LT(hot, 92000u);
+}
+
+TEST(WorkloadTest, TraceRoundTrip) {
+  std::string path = ::testing::TempDir() + "workload_unittests.trace";
+  std::vector<trace_event> written;
+  for (uint32_t i = 0; i < 1000; i++) {
+    trace_event event = trace_event();
+    event.op = static_cast<uint8_t>(i % k_num_trace_ops);
+    event.key = i * 0x9E3779B97F4A7C15ull;
+    event.arg = i;
+    written.push_back(event);
+  }
+  {
+    trace_writer writer(path);
+    writer.write(written.data(), written.size());
+    writer.flush();
+  }
+  trace_reader reader(path);
+  std::vector<trace_event> batch;
+  std::vector<trace_event> read;
+  while (reader.read(batch, 300) > 0) {
+    read.insert(read.end(), batch.begin(), batch.end());
+  }
+  ASSERT_EQ(read.size(), written.size());
+  for (size_t i = 0; i < read.size(); i++) {
+    ASSERT_EQ(read[i].op, written[i].op);
+    ASSERT_EQ(read[i].key, written[i].key);
+    ASSERT_EQ(read[i].arg, written[i].arg);
+  }
+  std::remove(path.c_str());
+
+  ASSERT_THROW({ trace_reader missing(path); }, std::runtime_error);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}